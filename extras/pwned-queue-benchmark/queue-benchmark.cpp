@@ -0,0 +1,238 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+#include <boost/program_options.hpp>
+
+#include <pwned-lib/boundedqueue.hpp>
+#include <pwned-lib/lockfreequeue.hpp>
+
+namespace po = boost::program_options;
+
+po::options_description desc("Allowed options");
+
+void hello()
+{
+  std::cout << "#pwned queue benchmark 1.0.0 - Copyright (c) 2019 Oliver Lau" << std::endl
+            << std::endl;
+}
+
+void usage()
+{
+  std::cout << desc << std::endl;
+}
+
+namespace
+{
+
+struct Setup
+{
+  unsigned int numProducers;
+  unsigned int numConsumers;
+  uint64_t numItems;
+  std::size_t capacity;
+  std::size_t batchSize;
+};
+
+// items are 1..numItems per producer; 0 tells a consumer to stop
+constexpr uint64_t Stop = 0;
+
+template <typename Produce, typename Consume, typename Finish>
+double measure(const Setup &setup, Produce produce, Consume consume, Finish finish)
+{
+  std::vector<std::thread> producers;
+  std::vector<std::thread> consumers;
+  std::vector<uint64_t> sums(setup.numConsumers, 0);
+  const auto t0 = std::chrono::high_resolution_clock::now();
+  for (unsigned int c = 0; c < setup.numConsumers; ++c)
+  {
+    consumers.emplace_back([&consume, &sums, c] { sums[c] = consume(); });
+  }
+  for (unsigned int p = 0; p < setup.numProducers; ++p)
+  {
+    producers.emplace_back(produce);
+  }
+  for (auto &thread : producers)
+  {
+    thread.join();
+  }
+  finish();
+  for (auto &thread : consumers)
+  {
+    thread.join();
+  }
+  const std::chrono::duration<double> dt = std::chrono::high_resolution_clock::now() - t0;
+  uint64_t sum = 0;
+  for (uint64_t s : sums)
+  {
+    sum += s;
+  }
+  if (sum != setup.numProducers * (setup.numItems * (setup.numItems + 1) / 2))
+  {
+    std::cerr << "ERROR: items got lost." << std::endl;
+  }
+  return double(setup.numProducers * setup.numItems) / dt.count();
+}
+
+double runMutexQueue(const Setup &setup)
+{
+  pwned::BoundedQueue<uint64_t> queue(setup.capacity);
+  return measure(
+      setup,
+      [&queue, &setup] {
+        for (uint64_t i = 1; i <= setup.numItems; ++i)
+        {
+          queue.push(uint64_t(i));
+        }
+      },
+      [&queue] {
+        uint64_t sum = 0;
+        uint64_t item;
+        while (queue.pop(item))
+        {
+          sum += item;
+        }
+        return sum;
+      },
+      [&queue] { queue.close(); });
+}
+
+template <typename Queue>
+double runLockFreeQueue(const Setup &setup)
+{
+  Queue queue(setup.capacity);
+  return measure(
+      setup,
+      [&queue, &setup] {
+        std::vector<uint64_t> batch;
+        batch.reserve(setup.batchSize);
+        for (uint64_t i = 1; i <= setup.numItems; ++i)
+        {
+          batch.push_back(i);
+          if (batch.size() == setup.batchSize || i == setup.numItems)
+          {
+            queue.pushBatch(batch.begin(), batch.end());
+            batch.clear();
+          }
+        }
+      },
+      [&queue, &setup] {
+        uint64_t sum = 0;
+        std::vector<uint64_t> batch(setup.batchSize);
+        for (;;)
+        {
+          const std::size_t n = queue.popBatch(batch.begin(), batch.size());
+          std::size_t stops = 0;
+          for (std::size_t i = 0; i < n; ++i)
+          {
+            sum += batch[i];
+            if (batch[i] == Stop)
+            {
+              ++stops;
+            }
+          }
+          if (stops > 0)
+          {
+            // leave the other stop marks to the other consumers
+            std::vector<uint64_t> others(stops - 1, Stop);
+            queue.pushBatch(others.begin(), others.end());
+            return sum;
+          }
+        }
+      },
+      [&queue, &setup] {
+        std::vector<uint64_t> stops(setup.numConsumers, Stop);
+        queue.pushBatch(stops.begin(), stops.end());
+      });
+}
+
+} // namespace
+
+int main(int argc, const char *argv[])
+{
+  hello();
+  Setup setup;
+  unsigned int numRuns;
+  desc.add_options()
+  ("help", "produce help message")
+  ("producers,p", po::value<unsigned int>(&setup.numProducers)->default_value(std::max(1U, std::thread::hardware_concurrency() / 2)), "number of producer threads")
+  ("consumers,c", po::value<unsigned int>(&setup.numConsumers)->default_value(std::max(1U, std::thread::hardware_concurrency() / 2)), "number of consumer threads")
+  ("items,n", po::value<uint64_t>(&setup.numItems)->default_value(1000000), "number of items per producer")
+  ("capacity", po::value<std::size_t>(&setup.capacity)->default_value(1024), "capacity of the queues")
+  ("batch,b", po::value<std::size_t>(&setup.batchSize)->default_value(1), "push and pop this many items at once (lock-free queues only)")
+  ("runs", po::value<unsigned int>(&numRuns)->default_value(3), "number of runs; the best one counts");
+  po::variables_map vm;
+  try
+  {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+  }
+  catch (po::error &e)
+  {
+    std::cerr << "ERROR: " << e.what() << std::endl
+              << std::endl;
+    usage();
+    return EXIT_FAILURE;
+  }
+  po::notify(vm);
+  if (vm.count("help"))
+  {
+    usage();
+    return EXIT_SUCCESS;
+  }
+  setup.numProducers = std::max(1U, setup.numProducers);
+  setup.numConsumers = std::max(1U, setup.numConsumers);
+  setup.batchSize = std::max<std::size_t>(1, setup.batchSize);
+  // room for the stop marks of all consumers
+  setup.capacity = std::max<std::size_t>(setup.capacity, setup.numConsumers);
+  numRuns = std::max(1U, numRuns);
+
+  std::cout << setup.numProducers << " producer(s), "
+            << setup.numConsumers << " consumer(s), "
+            << setup.numItems << " items per producer, "
+            << "capacity " << setup.capacity << ", "
+            << "batches of " << setup.batchSize << std::endl
+            << std::endl;
+
+  auto report = [numRuns](const std::string &name, auto run) {
+    double best = 0;
+    for (unsigned int i = 0; i < numRuns; ++i)
+    {
+      best = std::max(best, run());
+    }
+    std::cout << std::left << std::setw(24) << name
+              << std::right << std::setw(12) << std::fixed << std::setprecision(2) << best / 1e6
+              << " M items/s" << std::endl;
+  };
+  report("mutex (BoundedQueue)", [&setup] { return runMutexQueue(setup); });
+  report("MPMC, blocking", [&setup] { return runLockFreeQueue<pwned::MPMCQueue<uint64_t, pwned::BlockingWait>>(setup); });
+  report("MPMC, spinning", [&setup] { return runLockFreeQueue<pwned::MPMCQueue<uint64_t, pwned::SpinWait>>(setup); });
+  if (setup.numProducers == 1 && setup.numConsumers == 1)
+  {
+    report("SPSC, blocking", [&setup] { return runLockFreeQueue<pwned::SPSCQueue<uint64_t, pwned::BlockingWait>>(setup); });
+    report("SPSC, spinning", [&setup] { return runLockFreeQueue<pwned::SPSCQueue<uint64_t, pwned::SpinWait>>(setup); });
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#include <pwned-lib/util.hpp>
+#include <pwned-lib/hashpipeline.hpp>
+#include <pwned-lib/inputstream.hpp>
+#include <pwned-lib/operationexception.hpp>
+#include <pwned-lib/operationqueue.hpp>
+#include <pwned-lib/passwordhashandcount.hpp>
+#include <pwned-lib/radixsort.hpp>
+
+#include "buildoperation.hpp"
+#include "runstore.hpp"
+
+namespace build
+{
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+enum BuildError
+{
+  cannotOpenInput = 1,
+  cannotReadInput
+};
+
+// every line needs one record plus the radix sort's scratch space for it
+constexpr uint64_t MemUsagePerEntry = 2 * sizeof(pwned::PasswordHashAndCount);
+constexpr uint64_t MinBytesPerLine = 8;
+
+} // namespace
+
+class BuildOperationPrivate
+{
+public:
+  BuildOperationPrivate(const std::string &srcFilename,
+                        RunStore &store,
+                        unsigned int numSortThreads,
+                        const std::vector<pwned::UserPasswordReaderOptions> &options)
+      : srcFilePath(srcFilename)
+      , store(store)
+      , numSortThreads(numSortThreads)
+      , options(options)
+  {
+  }
+  const fs::path srcFilePath;
+  RunStore &store;
+  const unsigned int numSortThreads;
+  const std::vector<pwned::UserPasswordReaderOptions> options;
+};
+
+BuildOperation::BuildOperation(const std::string &srcFilename,
+                               RunStore &store,
+                               uint64_t minMem,
+                               uint64_t maxMem,
+                               unsigned int numSortThreads,
+                               const std::vector<pwned::UserPasswordReaderOptions> &options)
+    : d(std::shared_ptr<BuildOperationPrivate>(new BuildOperationPrivate(srcFilename,
+                                                                         store,
+                                                                         numSortThreads,
+                                                                         options)))
+{
+  priority = srcFilename == "-" ? 0LL : (long long)(fs::file_size(srcFilename));
+  // the size of compressed files or stdin says nothing about the number of lines
+  const bool sizeIsKnown = priority > 0 && pwned::InputStream::compressionOf(srcFilename) == pwned::Compression::none;
+  const uint64_t wanted = sizeIsKnown
+                              ? std::min<uint64_t>(maxMem, (uint64_t(priority) / MinBytesPerLine + 1) * MemUsagePerEntry)
+                              : maxMem;
+  setMemoryDemand(std::min(minMem, wanted), wanted);
+}
+
+void BuildOperation::execute() noexcept(false)
+{
+  if (isCancelled)
+    return;
+  {
+    std::ostringstream output;
+    output << uuid << " "
+           << "Reading " << d->srcFilePath.string()
+           << " (" << pwned::readableSize((uint64_t)priority) << "/" << pwned::readableSize(grantedMemory()) << ") ..."
+           << std::endl;
+    std::cout << output.str();
+  }
+  pwned::InputStream inputFile(d->srcFilePath.string());
+  if (!inputFile.isOpen())
+  {
+    std::ostringstream output;
+    output << uuid << " "
+           << "Cannot open " << d->srcFilePath.string() << "." << std::endl;
+    std::cerr << output.str();
+    throw pwned::OperationException("Cannot open input file", BuildError::cannotOpenInput);
+  }
+  pwned::UserPasswordReader reader(inputFile, d->options);
+  // reads on the I/O lane and hashes on the CPU lane
+  pwned::HashPipeline pipeline(reader);
+  bool more = true;
+  while (more)
+  {
+    // runs grow with the memory other operations have given back
+    const uint64_t maxEntries = std::max<uint64_t>(1, requestMemory(wantedMemory()) / MemUsagePerEntry);
+    std::vector<pwned::PasswordHashAndCount> run;
+    run.reserve(maxEntries);
+    while (run.size() < maxEntries && !isCancelled)
+    {
+      more = pipeline.next(run, maxEntries);
+      if (!more)
+        break;
+      if (isPaused)
+      {
+        queue->operationWait();
+        isPaused = false;
+      }
+    }
+    if (isCancelled)
+      return;
+    if (run.empty())
+      break;
+    pwned::radixSortAndMerge(run, d->numSortThreads);
+    run.shrink_to_fit();
+    if (isCancelled)
+      return;
+    d->store.add(std::move(run));
+    if (isPaused)
+    {
+      queue->operationWait();
+      isPaused = false;
+    }
+  }
+  if (inputFile.bad())
+  {
+    std::ostringstream output;
+    output << uuid << " "
+           << "ERROR: reading " << d->srcFilePath.string() << " failed; its hashes are incomplete." << std::endl;
+    std::cerr << output.str();
+    throw pwned::OperationException("Cannot read input file", BuildError::cannotReadInput);
+  }
+}
+
+} // namespace build
@@ -0,0 +1,49 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __buildoperation_hpp__
+#define __buildoperation_hpp__
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <pwned-lib/operation.hpp>
+#include <pwned-lib/userpasswordreader.hpp>
+
+namespace build
+{
+
+class RunStore;
+class BuildOperationPrivate;
+
+class BuildOperation : public pwned::Operation
+{
+public:
+  std::shared_ptr<BuildOperationPrivate> d;
+  BuildOperation(const std::string &srcFilename,
+                 RunStore &store,
+                 uint64_t minMem,
+                 uint64_t maxMem,
+                 unsigned int numSortThreads,
+                 const std::vector<pwned::UserPasswordReaderOptions> &options);
+  void execute() noexcept(false) override;
+};
+
+} // namespace build
+
+#endif // __buildoperation_hpp__
@@ -0,0 +1,339 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include <pwned-lib/operationqueue.hpp>
+#include <pwned-lib/threadpool.hpp>
+#include <pwned-lib/util.hpp>
+#include <pwned-lib/pagecache.hpp>
+#include <pwned-lib/inputstream.hpp>
+#include <pwned-lib/mergesink.hpp>
+#include <pwned-lib/userpasswordreader.hpp>
+
+#include "buildoperation.hpp"
+#include "runstore.hpp"
+
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+po::options_description desc("Allowed options");
+
+void hello()
+{
+  std::cout << "#pwned build 1.0.0 - Copyright (c) 2019 Oliver Lau" << std::endl
+            << std::endl;
+}
+
+void info()
+{
+  std::cout << "This program comes with ABSOLUTELY NO WARRANTY; for details" << std::endl
+            << "type `pwned-merger --warranty`. This is free software, and" << std::endl
+            << "you are welcome to redistribute it under certain conditions;" << std::endl
+            << "type `pwned-merger --license` for details." << std::endl
+            << std::endl;
+}
+
+void usage()
+{
+  std::cout << desc << std::endl;
+}
+
+static const unsigned int DefaultNumThreads = 4;
+static const unsigned int DefaultBits = 24;
+
+int main(int argc, const char *argv[])
+{
+  hello();
+  pwned::MemoryStat memStat;
+  pwned::getMemoryStat(memStat);
+  uint64_t memFreeAssumedMBytes;
+  std::cout << "Physical memory (total/app/available): "
+            << pwned::readableSize(memStat.phys.total) << "/"
+            << pwned::readableSize(memStat.phys.app) << "/"
+            << pwned::readableSize(memStat.phys.avail)
+            << std::endl
+            << std::endl;
+  std::vector<std::string> filenames;
+  std::string srcDirectory;
+  std::string dstFilename;
+  std::string indexFilename;
+  std::string bloomFilename;
+  unsigned int bloomBitsPerKey;
+  std::string histogramFilename;
+  std::string checksumFilename;
+  std::string tmpDirectory = (fs::temp_directory_path() / "net.ersatzworld.pwned.build").string();
+  std::vector<pwned::UserPasswordReaderOptions> options;
+  bool forceMD5;
+  bool cacheNeutral;
+  bool compressTemp;
+  bool autoMD5;
+  bool forceHex;
+  bool autoHex;
+  unsigned int numThreads;
+  unsigned int numIoThreads;
+  unsigned int bits;
+  desc.add_options()("help", "produce help message")
+  ("input,I", po::value<std::vector<std::string>>(&filenames), "set user:pass input file(s) (.txt, .gz, .bz2, .xz, .zst, .zip, .7z or - for stdin)")
+  ("src,S", po::value<std::string>(&srcDirectory), "set user:pass input directory")
+  ("output,O", po::value<std::string>(&dstFilename), "set MD5:count output file")
+  ("index,X", po::value<std::string>(&indexFilename), "also write index to this file")
+  ("bits,B", po::value<unsigned int>(&bits)->default_value(DefaultBits), "set bit count of index key")
+  ("bloom", po::value<std::string>(&bloomFilename), "also write a membership filter to this file")
+  ("bloom-bits", po::value<unsigned int>(&bloomBitsPerKey)->default_value(pwned::BloomFilter::DefaultBitsPerKey), "set bits per hash of the membership filter")
+  ("histogram", po::value<std::string>(&histogramFilename), "also write a histogram of the counts to this file")
+  ("checksum", po::value<std::string>(&checksumFilename), "also write the CRC-32 of the output file to this file")
+  ("tmp", po::value<std::string>(&tmpDirectory)->default_value(tmpDirectory), "set directory for runs that do not fit into RAM")
+  ("ram", po::value<uint64_t>(&memFreeAssumedMBytes)->default_value(memStat.phys.avail / 1024 / 1024), "program can use as many as the given MB of RAM (overrides automatic free memory detection)")
+  ("threads,T", po::value<unsigned int>(&numThreads)->default_value(DefaultNumThreads), "run in this many threads")
+  ("io-threads", po::value<unsigned int>(&numIoThreads)->default_value(pwned::ThreadPool::DefaultIoThreads), "write files in this many threads, in addition to one reader per file being read")
+  ("compress-temp", po::bool_switch(&compressTemp)->default_value(false), "pack spilled runs to save disk space and I/O at the expense of CPU time")
+  ("cache-neutral", po::bool_switch(&cacheNeutral)->default_value(false), "drop streamed data from the page cache to keep the cached pages of other processes")
+  ("force-md5", po::bool_switch(&forceMD5)->default_value(false), "convert MD5 encoded passwords")
+  ("auto-md5", po::bool_switch(&autoMD5)->default_value(false), "convert MD5 encoded passwords if some are found")
+  ("force-hex", po::bool_switch(&forceHex)->default_value(false), "convert hex encoded passwords")
+  ("auto-hex", po::bool_switch(&autoHex)->default_value(false), "convert hex encoded passwords if some are found");
+  po::variables_map vm;
+  try
+  {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+  }
+  catch (const po::error &e)
+  {
+    std::cerr << "ERROR: " << e.what() << std::endl
+              << std::endl;
+    usage();
+    return EXIT_FAILURE;
+  }
+  po::notify(vm);
+  pwned::setCacheNeutralIO(cacheNeutral);
+  if (vm.count("help") > 0)
+  {
+    usage();
+    return EXIT_SUCCESS;
+  }
+  if (numThreads == 0)
+  {
+    numThreads = DefaultNumThreads;
+  }
+  // every operation running at the same time keeps an I/O thread busy with reading
+  pwned::ThreadPool::setLaneSize(pwned::Lane::io, numThreads + std::max(1U, numIoThreads));
+  if (bits == 0 || bits > 32)
+  {
+    std::cerr << "ERROR: bit count of index key must be between 1 and 32." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (srcDirectory.size() > 0)
+  {
+    std::cout << "Scanning '" << srcDirectory << "' for files ..." << std::flush;
+    fs::recursive_directory_iterator fileTreeIterator(srcDirectory);
+    for (const auto &f : fileTreeIterator)
+    {
+      const std::string &filePath = f.path().string();
+      if (fs::is_regular_file(f) && pwned::InputStream::isSupported(filePath))
+      {
+        filenames.push_back(filePath);
+      }
+    }
+    std::cout << std::endl;
+  }
+  if (filenames.empty())
+  {
+    usage();
+    return EXIT_FAILURE;
+  }
+  if (dstFilename.empty())
+  {
+    std::cerr << "ERROR: output filename not given." << std::endl;
+    usage();
+    return EXIT_FAILURE;
+  }
+  if (!fs::exists(tmpDirectory))
+  {
+    boost::system::error_code ec;
+    fs::create_directories(tmpDirectory, ec);
+    if (ec)
+    {
+      std::cerr << "Cannot create working directory '" << tmpDirectory << "'." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (forceMD5)
+  {
+    options.push_back(pwned::UserPasswordReaderOptions::forceEvaluateMD5Hashes);
+  }
+  else if (autoMD5)
+  {
+    options.push_back(pwned::UserPasswordReaderOptions::autoEvaluateMD5Hashes);
+  }
+  if (forceHex)
+  {
+    options.push_back(pwned::UserPasswordReaderOptions::forceEvaluateHexEncodedPasswords);
+  }
+  else if (autoHex)
+  {
+    options.push_back(pwned::UserPasswordReaderOptions::autoEvaluateHexEncodedPasswords);
+  }
+  info();
+  std::cout << "Building " << dstFilename << " from " << filenames.size() << " files." << std::endl
+            << std::endl;
+  auto t0 = std::chrono::high_resolution_clock::now();
+  // half of the RAM holds the sorted runs, the other half is shared by the
+  // operations for reading and sorting their chunks
+  const uint64_t maxMem = memFreeAssumedMBytes * 1024ULL * 1024ULL;
+  build::RunStore store(maxMem / 2, tmpDirectory, compressTemp ? pwned::RecordFormat::packed : pwned::RecordFormat::raw);
+  pwned::OperationQueue<build::BuildOperation> opQueue(numThreads);
+  const unsigned int numSortThreads = std::max(1U, std::thread::hardware_concurrency() / numThreads);
+  opQueue.setMemoryBudget(maxMem / 2);
+  for (const auto &filename : filenames)
+  {
+    build::BuildOperation *op = new build::BuildOperation(filename,
+                                                          store,
+                                                          maxMem / 2 / uint64_t(numThreads),
+                                                          maxMem / 2,
+                                                          numSortThreads,
+                                                          options);
+    opQueue.add(op);
+  }
+  // stdin cannot serve as password source and keyboard at the same time
+  const bool readFromStdin = std::find(filenames.begin(), filenames.end(), "-") != filenames.end();
+  pwned::TermIO termIO;
+  // waitForFinished() resets the queue, so it cannot tell about a cancel
+  std::atomic<bool> cancelled{false};
+  std::thread keyThread([&opQueue, &termIO, &cancelled, readFromStdin] {
+    if (readFromStdin)
+      return;
+    termIO.disableEcho();
+    char ch;
+    do
+    {
+      ch = char(getchar());
+      switch (ch)
+      {
+      case ' ':
+        if (opQueue.isRunning())
+        {
+          std::cout << "Pausing ... " << std::flush;
+          opQueue.pause();
+        }
+        else
+        {
+          std::cout << "Resuming ... " << std::flush;
+          opQueue.resume();
+        }
+        break;
+      case 'q':
+        std::cout << "Cancelling all operations ..." << std::endl;
+        cancelled = true;
+        opQueue.resume();
+        opQueue.cancel();
+        break;
+      default:
+        break;
+      }
+    } while (ch != 'q');
+  });
+  keyThread.detach();
+  std::cout << "Executing queue ..." << std::endl;
+  if (!readFromStdin)
+  {
+    std::cout << "([Space] to pause/resume, Q to quit)" << std::endl;
+  }
+  opQueue.execute();
+  opQueue.waitForFinished();
+  if (cancelled)
+  {
+    std::cout << "Cancelled; not building " << dstFilename << "." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (opQueue.failures() > 0)
+  {
+    std::cerr << "ERROR: " << opQueue.failures() << " of " << filenames.size() << " files could not be read; not building " << dstFilename << "." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (store.failed())
+  {
+    std::cerr << "ERROR: cannot spill runs to '" << tmpDirectory << "'; not building " << dstFilename << "." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "Merging " << store.memoryRunCount() << " in-memory and "
+            << store.spilledRunCount() << " spilled runs into " << dstFilename << " ..." << std::endl;
+  std::vector<std::unique_ptr<pwned::MergeSink>> sinks;
+  if (!indexFilename.empty())
+  {
+    sinks.emplace_back(new pwned::IndexSink(indexFilename, bits));
+  }
+  if (!bloomFilename.empty())
+  {
+    sinks.emplace_back(new pwned::BloomFilterSink(bloomFilename, bloomBitsPerKey));
+  }
+  if (!histogramFilename.empty())
+  {
+    sinks.emplace_back(new pwned::HistogramSink(histogramFilename));
+  }
+  if (!checksumFilename.empty())
+  {
+    sinks.emplace_back(new pwned::ChecksumSink(checksumFilename));
+  }
+  std::vector<pwned::MergeSink *> sinkPointers;
+  for (const auto &sink : sinks)
+  {
+    sinkPointers.push_back(sink.get());
+  }
+  const build::RunStore::MergeResult &result = store.merge(dstFilename, sinkPointers);
+  if (result.readFailed)
+  {
+    std::cerr << "ERROR: cannot read the runs spilled to '" << tmpDirectory << "'; removing the incomplete " << dstFilename << "." << std::endl;
+    boost::system::error_code ec;
+    fs::remove(dstFilename, ec);
+    return EXIT_FAILURE;
+  }
+  if (!result.ok)
+  {
+    std::cerr << "ERROR: cannot write output file '" << dstFilename << "'." << std::endl;
+    return EXIT_FAILURE;
+  }
+  for (const auto &sink : sinks)
+  {
+    std::cout << "Writing " << sink->description() << " to " << sink->filename() << " ..." << std::endl;
+    if (!sink->finish())
+    {
+      std::cerr << "ERROR: cannot write " << sink->description() << " to '" << sink->filename() << "'." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto time_span = std::chrono::duration_cast<std::chrono::duration<float>>(t1 - t0);
+  std::cout << "Unique hashes: " << result.records << std::endl
+            << "Total count: " << result.occurrences << std::endl
+            << "Total time: " << pwned::readableTime(time_span.count()) << std::endl
+            << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,305 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include <sstream>
+
+#include <pwned-lib/losertree.hpp>
+#include <pwned-lib/blockio.hpp>
+
+#include "runstore.hpp"
+
+namespace build
+{
+
+namespace
+{
+
+inline uint64_t bytesOf(const std::vector<pwned::PasswordHashAndCount> &run)
+{
+  return uint64_t(run.capacity() * sizeof(pwned::PasswordHashAndCount));
+}
+
+std::vector<pwned::PasswordHashAndCount> mergeRuns(const std::vector<pwned::PasswordHashAndCount> &a,
+                                                   const std::vector<pwned::PasswordHashAndCount> &b)
+{
+  std::vector<pwned::PasswordHashAndCount> result;
+  result.reserve(a.size() + b.size());
+  auto i = a.begin();
+  auto j = b.begin();
+  while (i != a.end() && j != b.end())
+  {
+    if (i->hash < j->hash)
+    {
+      result.push_back(*i++);
+    }
+    else if (j->hash < i->hash)
+    {
+      result.push_back(*j++);
+    }
+    else
+    {
+      result.emplace_back(i->hash, i->count + j->count);
+      ++i;
+      ++j;
+    }
+  }
+  result.insert(result.end(), i, a.end());
+  result.insert(result.end(), j, b.end());
+  result.shrink_to_fit();
+  return result;
+}
+
+struct RunCursor
+{
+  pwned::PasswordHashAndCount phc;
+  virtual ~RunCursor() = default;
+  virtual bool read() = 0;
+  virtual bool failed() const
+  {
+    return false;
+  }
+};
+
+struct MemoryRunCursor : public RunCursor
+{
+  const std::vector<pwned::PasswordHashAndCount> &run;
+  std::size_t pos{0};
+  explicit MemoryRunCursor(const std::vector<pwned::PasswordHashAndCount> &run)
+      : run(run)
+  {
+  }
+  bool read() override
+  {
+    if (pos == run.size())
+      return false;
+    phc = run[pos++];
+    return true;
+  }
+};
+
+struct FileRunCursor : public RunCursor
+{
+  pwned::BlockReader reader;
+  explicit FileRunCursor(const fs::path &path)
+      : reader(path.string())
+  {
+  }
+  bool read() override
+  {
+    return reader.read(phc);
+  }
+  bool failed() const override
+  {
+    return reader.failed();
+  }
+};
+
+bool anyFailed(const std::vector<std::unique_ptr<RunCursor>> &cursors)
+{
+  return std::any_of(cursors.begin(), cursors.end(), [](const std::unique_ptr<RunCursor> &cursor) { return cursor->failed(); });
+}
+
+} // namespace
+
+RunStore::RunStore(uint64_t memoryBudget, const std::string &tmpDirectory, pwned::RecordFormat spillFormat)
+    : memoryBudget(memoryBudget)
+    , tmpDirectory(tmpDirectory)
+    , spillFormat(spillFormat)
+{
+}
+
+RunStore::~RunStore()
+{
+  for (const auto &run : spilledRuns)
+  {
+    boost::system::error_code ec;
+    fs::remove(run.path, ec);
+  }
+}
+
+std::size_t RunStore::memoryRunCount() const
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  return memoryRuns.size();
+}
+
+std::size_t RunStore::spilledRunCount() const
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  return spilledRuns.size();
+}
+
+bool RunStore::failed() const
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  return spillFailed;
+}
+
+void RunStore::add(std::vector<pwned::PasswordHashAndCount> &&newRun)
+{
+  std::vector<pwned::PasswordHashAndCount> run = std::move(newRun);
+  std::unique_lock<std::mutex> lock(mtx);
+  for (;;)
+  {
+    auto partner = std::find_if(memoryRuns.begin(), memoryRuns.end(),
+                                [&run](const std::vector<pwned::PasswordHashAndCount> &r) {
+                                  return r.size() <= 2 * run.size() && 2 * r.size() >= run.size();
+                                });
+    if (partner == memoryRuns.end())
+      break;
+    const std::vector<pwned::PasswordHashAndCount> other = std::move(*partner);
+    memoryRuns.erase(partner);
+    memUsed -= bytesOf(other);
+    lock.unlock();
+    run = mergeRuns(run, other);
+    lock.lock();
+  }
+  memUsed += bytesOf(run);
+  memoryRuns.push_back(std::move(run));
+  while (memUsed > memoryBudget && !memoryRuns.empty())
+  {
+    auto largest = std::max_element(memoryRuns.begin(), memoryRuns.end(),
+                                     [](const std::vector<pwned::PasswordHashAndCount> &a, const std::vector<pwned::PasswordHashAndCount> &b) {
+                                       return a.size() < b.size();
+                                     });
+    const std::vector<pwned::PasswordHashAndCount> victim = std::move(*largest);
+    memoryRuns.erase(largest);
+    memUsed -= bytesOf(victim);
+    lock.unlock();
+    SpilledRun spilled;
+    const bool ok = spill(victim, spilled);
+    lock.lock();
+    if (ok)
+    {
+      spilledRuns.push_back(spilled);
+    }
+    else
+    {
+      spillFailed = true;
+    }
+  }
+}
+
+bool RunStore::spill(const std::vector<pwned::PasswordHashAndCount> &run, SpilledRun &spilled) const
+{
+  spilled = SpilledRun{tmpDirectory / fs::unique_path("%%%%-%%%%-%%%%-%%%%.md5"), run.size()};
+  {
+    std::ostringstream output;
+    output << "Spilling " << run.size() << " entries to " << spilled.path.string() << " ..." << std::endl;
+    std::cout << output.str();
+  }
+  pwned::BlockWriter writer(spilled.path.string(),
+                           pwned::BlockWriter::DefaultBlockSize,
+                           pwned::BlockWriter::DefaultQueueDepth,
+                           spillFormat);
+  for (const auto &phc : run)
+  {
+    writer.write(phc);
+  }
+  if (!writer.close())
+  {
+    std::cerr << "ERROR: cannot write to " << spilled.path.string() << "." << std::endl;
+    boost::system::error_code ec;
+    fs::remove(spilled.path, ec);
+    return false;
+  }
+  return true;
+}
+
+RunStore::MergeResult RunStore::merge(const std::string &dstFilename, const std::vector<pwned::MergeSink *> &sinks)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  MergeResult result;
+  if (spillFailed)
+    return result;
+  std::vector<std::unique_ptr<RunCursor>> cursors;
+  for (const auto &run : memoryRuns)
+  {
+    cursors.emplace_back(new MemoryRunCursor(run));
+  }
+  for (const auto &run : spilledRuns)
+  {
+    cursors.emplace_back(new FileRunCursor(run.path));
+  }
+  std::vector<RunCursor *> sources;
+  std::vector<bool> valid;
+  for (const auto &cursor : cursors)
+  {
+    sources.push_back(cursor.get());
+    valid.push_back(cursor->read());
+  }
+  pwned::LoserTree<RunCursor> tree(sources, valid);
+  pwned::BlockWriter dstFile(dstFilename);
+  if (!dstFile.isOpen())
+    return result;
+  if (tree.empty())
+  {
+    result.readFailed = anyFailed(cursors);
+    result.ok = dstFile.close() && !result.readFailed;
+    return result;
+  }
+  uint64_t maxRecords = 0;
+  for (const auto &run : memoryRuns)
+  {
+    maxRecords += run.size();
+  }
+  for (const auto &run : spilledRuns)
+  {
+    maxRecords += run.records;
+  }
+  for (pwned::MergeSink *sink : sinks)
+  {
+    sink->begin(maxRecords);
+  }
+  pwned::PasswordHashAndCount current = tree.top()->phc;
+  current.count = 0;
+  auto emit = [&]() {
+    for (pwned::MergeSink *sink : sinks)
+    {
+      sink->consume(current, result.records);
+    }
+    dstFile.write(current);
+    ++result.records;
+    result.occurrences += current.count;
+  };
+  while (!tree.empty())
+  {
+    const pwned::PasswordHashAndCount &phc = tree.top()->phc;
+    // `==` is unsuitable because it also compares `isValid`, which records
+    // read from a file do not carry
+    if (current.hash.quad.upper == phc.hash.quad.upper && current.hash.quad.lower == phc.hash.quad.lower)
+    {
+      current.count += phc.count;
+    }
+    else
+    {
+      emit();
+      current = phc;
+    }
+    tree.pop();
+  }
+  emit();
+  // a run that could not be read to its end leaves the output incomplete
+  result.readFailed = anyFailed(cursors);
+  result.ok = dstFile.close() && !result.readFailed;
+  return result;
+}
+
+} // namespace build
@@ -0,0 +1,92 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __runstore_hpp__
+#define __runstore_hpp__
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <boost/filesystem.hpp>
+
+#include <pwned-lib/blockio.hpp>
+#include <pwned-lib/passwordhashandcount.hpp>
+#include <pwned-lib/mergesink.hpp>
+
+namespace build
+{
+
+namespace fs = boost::filesystem;
+
+/**
+ * Receives the sorted runs produced by the build operations.
+ *
+ * Runs stay in memory as long as they fit into the memory budget. A new run
+ * is merged right away with an in-memory run of similar size, so duplicates
+ * across input files collapse early and the number of runs stays logarithmic.
+ * Only if the budget is exceeded the largest run is spilled to a temporary file,
+ * packed if `spillFormat` says so.
+ * `merge()` finally combines all runs into the destination file in one pass;
+ * it fails if a run could not be spilled.
+ */
+class RunStore
+{
+public:
+  struct MergeResult
+  {
+    uint64_t records{0};
+    uint64_t occurrences{0};
+    bool ok{false};
+    // a spilled run could not be read to its end
+    bool readFailed{false};
+  };
+
+  RunStore(uint64_t memoryBudget,
+           const std::string &tmpDirectory,
+           pwned::RecordFormat spillFormat = pwned::RecordFormat::raw);
+  ~RunStore();
+  void add(std::vector<pwned::PasswordHashAndCount> &&run);
+  std::size_t memoryRunCount() const;
+  std::size_t spilledRunCount() const;
+  // a run could not be spilled, so its counts are lost
+  bool failed() const;
+  MergeResult merge(const std::string &dstFilename, const std::vector<pwned::MergeSink *> &sinks = {});
+
+private:
+  struct SpilledRun
+  {
+    fs::path path;
+    uint64_t records;
+  };
+  mutable std::mutex mtx;
+  std::list<std::vector<pwned::PasswordHashAndCount>> memoryRuns;
+  std::vector<SpilledRun> spilledRuns;
+  uint64_t memUsed{0};
+  const uint64_t memoryBudget;
+  const fs::path tmpDirectory;
+  const pwned::RecordFormat spillFormat;
+  bool spillFailed{false};
+
+  bool spill(const std::vector<pwned::PasswordHashAndCount> &run, SpilledRun &spilled) const;
+};
+
+} // namespace build
+
+#endif // __runstore_hpp__
@@ -16,54 +16,112 @@
  */
 
 #include <iostream>
-#include <map>
+#include <sstream>
+#include <algorithm>
 
 #include <boost/filesystem.hpp>
 
 #include <pwned-lib/util.hpp>
+#include <pwned-lib/blockio.hpp>
+#include <pwned-lib/hashpipeline.hpp>
+#include <pwned-lib/inputstream.hpp>
+#include <pwned-lib/operationexception.hpp>
 #include <pwned-lib/operationqueue.hpp>
 #include <pwned-lib/userpasswordreader.hpp>
+#include <pwned-lib/radixsort.hpp>
+#include <pwned-lib/threadpool.hpp>
 
 #include "convertoperation.hpp"
 
 namespace fs = boost::filesystem;
 
+namespace
+{
+
+enum ConverterError
+{
+  cannotWriteRun = 1,
+  cannotOpenInput,
+  cannotReadInput
+};
+
+// a multiple of both the record size and the page size
+constexpr std::size_t WriteBlockRecords = 4096 * 50;
+// every line needs one record in the chunk being parsed plus the record
+// and the radix sort's scratch space in the chunk being sorted and written
+constexpr uint64_t MemUsagePerEntry = 3 * sizeof(pwned::PasswordHashAndCount);
+constexpr uint64_t MinBytesPerLine = 8;
+
+void writeRun(const fs::path &dstFilePath, const std::vector<pwned::PasswordHashAndCount> &records, pwned::RecordFormat format)
+{
+  pwned::BlockWriter writer(dstFilePath.string(), WriteBlockRecords * pwned::PasswordHashAndCount::size, pwned::BlockWriter::DefaultQueueDepth, format);
+  for (const auto &phc : records)
+  {
+    writer.write(phc);
+  }
+  if (!writer.close())
+  {
+    std::cerr << "Cannot write to " << dstFilePath.string() << "." << std::endl;
+    boost::system::error_code ec;
+    fs::remove(dstFilePath, ec);
+    throw pwned::OperationException("Cannot write run", ConverterError::cannotWriteRun);
+  }
+}
+
+} // namespace
+
 class ConvertOperationPrivate
 {
 public:
   ConvertOperationPrivate(const std::string &srcFilename,
                           const std::string &dstDirectory,
                           const std::string &outputExt,
-                          uint64_t maxMem,
-                          const std::vector<pwned::UserPasswordReaderOptions> &options)
+                          unsigned int numSortThreads,
+                          pwned::HotKeyTable *hotKeys,
+                          const std::vector<pwned::UserPasswordReaderOptions> &options,
+                          pwned::RecordFormat runFormat)
       : srcFilePath(srcFilename)
       , dstPath(dstDirectory)
       , outputExt(outputExt)
-      , maxMem(maxMem)
+      , numSortThreads(numSortThreads)
+      , hotKeys(hotKeys)
       , options(options)
+      , runFormat(runFormat)
   {
-    inputFile.open(srcFilename, std::ios::binary);
   }
   const fs::path srcFilePath;
   const fs::path dstPath;
   const fs::path outputExt;
-  const uint64_t maxMem;
+  const unsigned int numSortThreads;
+  pwned::HotKeyTable *const hotKeys;
   const std::vector<pwned::UserPasswordReaderOptions> options;
-  std::ifstream inputFile;
+  const pwned::RecordFormat runFormat;
 };
 
 ConvertOperation::ConvertOperation(const std::string &srcFilename,
                                    const std::string &dstDirectory,
                                    const std::string &outputExt,
+                                   uint64_t minMem,
                                    uint64_t maxMem,
-                                   const std::vector<pwned::UserPasswordReaderOptions> &options)
+                                   unsigned int numSortThreads,
+                                   pwned::HotKeyTable *hotKeys,
+                                   const std::vector<pwned::UserPasswordReaderOptions> &options,
+                                   pwned::RecordFormat runFormat)
     : d(std::shared_ptr<ConvertOperationPrivate>(new ConvertOperationPrivate(srcFilename,
                                                                              dstDirectory,
                                                                              outputExt,
-                                                                             maxMem,
-                                                                             options)))
+                                                                             numSortThreads,
+                                                                             hotKeys,
+                                                                             options,
+                                                                             runFormat)))
 {
-  priority = (long long)(fs::file_size(srcFilename));
+  priority = srcFilename == "-" ? 0LL : (long long)(fs::file_size(srcFilename));
+  // the size of compressed files or stdin says nothing about the number of lines
+  const bool sizeIsKnown = priority > 0 && pwned::InputStream::compressionOf(srcFilename) == pwned::Compression::none;
+  const uint64_t wanted = sizeIsKnown
+                              ? std::min<uint64_t>(maxMem, (uint64_t(priority) / MinBytesPerLine + 1) * MemUsagePerEntry)
+                              : maxMem;
+  setMemoryDemand(std::min(minMem, wanted), wanted);
 }
 
 void ConvertOperation::execute() noexcept(false)
@@ -75,27 +133,40 @@ void ConvertOperation::execute() noexcept(false)
     output << uuid << " "
            << "Converting " << d->srcFilePath.string()
            << " into directory " << d->dstPath.string()
-           << " (" << pwned::readableSize((uint64_t)priority) << "/" << pwned::readableSize(d->maxMem) << ") ..."
+           << " (" << pwned::readableSize((uint64_t)priority) << "/" << pwned::readableSize(grantedMemory()) << ") ..."
            << std::endl;
     std::cout << output.str();
   }
-  pwned::UserPasswordReader reader(d->inputFile, d->options);
-  static const uint64_t estimatedMemoryOverheadPerEntry = sizeof(uintptr_t);
-  static const uint64_t memUsagePerEntry = sizeof(pwned::Hash) + sizeof(uint32_t) + sizeof(pwned::PasswordHashAndCount) + estimatedMemoryOverheadPerEntry;
+  pwned::InputStream inputFile(d->srcFilePath.string());
+  if (!inputFile.isOpen())
+  {
+    std::ostringstream output;
+    output << uuid << " "
+           << "Cannot open " << d->srcFilePath.string() << "." << std::endl;
+    std::cerr << output.str();
+    throw pwned::OperationException("Cannot open input file", ConverterError::cannotOpenInput);
+  }
+  pwned::UserPasswordReader reader(inputFile, d->options);
+  pwned::HashPipeline pipeline(reader, d->hotKeys);
+  const fs::path srcFilename = pwned::InputStream::stem(d->srcFilePath.string());
+  // sorts the previous chunk on the CPU lane and writes it on the I/O lane
+  // while the next one is being read and hashed
+  pwned::TaskGroup pendingWrite(pwned::ThreadPool::instance(pwned::Lane::io));
+  pwned::TaskGroup pendingSort(pwned::ThreadPool::instance(pwned::Lane::cpu));
   int splitFileNum = 0;
-  while (!reader.eof())
+  bool more = true;
+  while (more)
   {
-    uint64_t memUsage = 0;
     ++splitFileNum;
-    std::map<pwned::Hash, uint32_t, pwned::HashLess> passwordCountSet;
-    while (!reader.eof() && !reader.bad() && memUsage < d->maxMem)
+    // chunks grow with the memory other operations have given back
+    const uint64_t maxEntries = std::max<uint64_t>(1, requestMemory(wantedMemory()) / MemUsagePerEntry);
+    std::vector<pwned::PasswordHashAndCount> passwordList;
+    passwordList.reserve(maxEntries);
+    while (passwordList.size() < maxEntries && !isCancelled)
     {
-      const pwned::Hash &hash = reader.nextPasswordHash();
-      if (hash.isValid)
-      {
-        passwordCountSet[hash] += 1;
-      }
-      memUsage += memUsagePerEntry;
+      more = pipeline.next(passwordList, maxEntries);
+      if (!more)
+        break;
       if (isPaused)
       {
         queue->operationWait();
@@ -104,44 +175,9 @@ void ConvertOperation::execute() noexcept(false)
     }
     if (isCancelled)
       return;
-    if (isPaused)
-    {
-      queue->operationWait();
-      isPaused = false;
-    }
-    if (passwordCountSet.empty())
-    {
-      {
-        std::ostringstream output;
-        output << uuid << " "
-               << "Nothing to write." << std::endl;
-        std::cout << output.str();
-      }
-      continue;
-    }
-    std::vector<pwned::PasswordHashAndCount> passwordList;
-    passwordList.reserve(passwordCountSet.size());
-    for (auto const &i : passwordCountSet)
-    {
-      passwordList.push_back(pwned::PasswordHashAndCount(i.first, i.second));
-    }
-    if (isCancelled)
-      return;
-    if (isPaused)
-    {
-      queue->operationWait();
-      isPaused = false;
-    }
-    std::sort(passwordList.begin(), passwordList.end(), pwned::PasswordHashAndCountLess());
-    if (isCancelled)
-      return;
-    if (isPaused)
-    {
-      queue->operationWait();
-      isPaused = false;
-    }
-
-    const fs::path srcFilename = d->srcFilePath.stem();
+    // the previous chunk took the last records
+    if (passwordList.empty())
+      break;
 
     auto generatedOutputFilename = [this, &srcFilename, splitFileNum]() {
       return (d->dstPath / (srcFilename.string() + pwned::string_format("-%04x", splitFileNum))).string();
@@ -154,24 +190,32 @@ void ConvertOperation::execute() noexcept(false)
       dstFilePath = generatedOutputFilename() + pwned::string_format("-%04x", n) + d->outputExt.string();
       ++n;
     }
-    {
-      std::ostringstream output;
-      output << uuid << " Writing to " << dstFilePath.string() << " ..." << std::endl;
-      std::cout << output.str();
-    }
-    std::ofstream f(dstFilePath.string(), std::ios::binary);
-    if (f.is_open())
-    {
-      for (const auto &phc : passwordList)
-      {
-        phc.dump(f);
-      }
-      f.close();
-    }
-    if (isPaused)
-    {
-      queue->operationWait();
-      isPaused = false;
-    }
+    pendingSort.wait();
+    pendingWrite.wait();
+    if (isCancelled)
+      return;
+    pendingSort.run([this, &pendingWrite, passwordList = std::move(passwordList), dstFilePath]() mutable {
+      pwned::radixSortAndMerge(passwordList, d->numSortThreads);
+      if (isCancelled)
+        return;
+      pendingWrite.run([this, passwordList = std::move(passwordList), dstFilePath] {
+        {
+          std::ostringstream output;
+          output << uuid << " Writing to " << dstFilePath.string() << " ..." << std::endl;
+          std::cout << output.str();
+        }
+        writeRun(dstFilePath, passwordList, d->runFormat);
+      });
+    });
+  }
+  pendingSort.wait();
+  pendingWrite.wait();
+  if (inputFile.bad())
+  {
+    std::ostringstream output;
+    output << uuid << " "
+           << "ERROR: reading " << d->srcFilePath.string() << " failed; its runs are incomplete." << std::endl;
+    std::cerr << output.str();
+    throw pwned::OperationException("Cannot read input file", ConverterError::cannotReadInput);
   }
 }
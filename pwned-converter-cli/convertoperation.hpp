@@ -22,9 +22,11 @@
 #include <vector>
 #include <memory>
 
+#include <pwned-lib/blockio.hpp>
 #include <pwned-lib/operation.hpp>
 #include <pwned-lib/hash.hpp>
 #include <pwned-lib/passwordhashandcount.hpp>
+#include <pwned-lib/hotkeytable.hpp>
 
 class ConvertOperationPrivate;
 
@@ -35,8 +37,12 @@ public:
   ConvertOperation(const std::string &srcFilename,
                    const std::string &dstDirectory,
                    const std::string &outputExt,
+                   uint64_t minMem,
                    uint64_t maxMem,
-                   const std::vector<pwned::UserPasswordReaderOptions> &options);
+                   unsigned int numSortThreads,
+                   pwned::HotKeyTable *hotKeys,
+                   const std::vector<pwned::UserPasswordReaderOptions> &options,
+                   pwned::RecordFormat runFormat = pwned::RecordFormat::raw);
   void execute() noexcept(false) override;
 };
 
@@ -15,7 +15,6 @@
  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <string>
@@ -23,21 +22,27 @@
 #include <vector>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <cstdint>
 
 #include <boost/filesystem.hpp>
-#include <boost/algorithm/string/predicate.hpp>
 #include <boost/program_options.hpp>
 
 #include <pwned-lib/operationqueue.hpp>
+#include <pwned-lib/threadpool.hpp>
 #include <pwned-lib/util.hpp>
+#include <pwned-lib/blockio.hpp>
+#include <pwned-lib/pagecache.hpp>
+#include <pwned-lib/inputstream.hpp>
+#include <pwned-lib/hotkeytable.hpp>
 #include <pwned-lib/uuid.hpp>
 #include <pwned-lib/userpasswordreader.hpp>
 
 #include "convertoperation.hpp"
 
 namespace fs = boost::filesystem;
-namespace ba = boost::algorithm;
 namespace po = boost::program_options;
 
 po::options_description desc("Allowed options");
@@ -64,6 +69,7 @@ void usage()
 
 static const std::string DefaultOutputExt = ".md5";
 static const unsigned int DefaultNumThreads = 4;
+static const std::size_t DefaultHotKeys = 1000000;
 
 int main(int argc, const char *argv[])
 {
@@ -83,17 +89,27 @@ int main(int argc, const char *argv[])
   std::string outputExt = DefaultOutputExt;
   std::vector<pwned::UserPasswordReaderOptions> options;
   bool forceMD5;
+  bool cacheNeutral;
+  bool compressRuns;
   bool autoMD5;
   bool forceHex;
   bool autoHex;
   unsigned int numThreads;
+  unsigned int numIoThreads;
+  std::size_t numHotKeys;
+  uint32_t hotKeyThreshold;
   desc.add_options()("help", "produce help message")
-  ("input,I", po::value<std::vector<std::string>>(), "set user:pass input file(s)")
+  ("input,I", po::value<std::vector<std::string>>(&filenames), "set user:pass input file(s) (.txt, .gz, .bz2, .xz, .zst, .zip, .7z or - for stdin)")
   ("src,S", po::value<std::string>(&srcDirectory), "set user:pass input directory")
   ("dst,D", po::value<std::string>(&dstDirectory), "set user:pass output directory")
   ("ext", po::value<std::string>(&outputExt)->default_value(DefaultOutputExt), "set extension for output files")
   ("ram", po::value<uint64_t>(&memFreeAssumedMBytes)->default_value(memStat.phys.avail / 1024 / 1024), "program can use as many as the given MB of RAM (overrides automatic free memory detection)")
   ("threads,T", po::value<unsigned int>(&numThreads)->default_value(DefaultNumThreads), "run in this many threads")
+  ("io-threads", po::value<unsigned int>(&numIoThreads)->default_value(pwned::ThreadPool::DefaultIoThreads), "write files in this many threads, in addition to one reader per file being read")
+  ("hot-keys", po::value<std::size_t>(&numHotKeys)->default_value(DefaultHotKeys), "count up to this many frequent hashes across all files in RAM and write them to a separate file at the end (0 to disable)")
+  ("hot-threshold", po::value<uint32_t>(&hotKeyThreshold)->default_value(pwned::HotKeyTable::DefaultThreshold), "treat a hash as frequent after it has been seen this many times among about a million hashes")
+  ("compress-runs", po::bool_switch(&compressRuns)->default_value(false), "pack the sorted runs to save disk space and I/O; only pwned-merger reads them")
+  ("cache-neutral", po::bool_switch(&cacheNeutral)->default_value(false), "drop streamed data from the page cache to keep the cached pages of other processes")
   ("force-md5", po::bool_switch(&forceMD5)->default_value(false), "convert MD5 encoded passwords")
   ("auto-md5", po::bool_switch(&autoMD5)->default_value(false), "convert MD5 encoded passwords if some are found")
   ("force-hex", po::bool_switch(&forceHex)->default_value(false), "convert hex encoded passwords")
@@ -110,6 +126,7 @@ int main(int argc, const char *argv[])
     usage();
   }
   po::notify(vm);
+  pwned::setCacheNeutralIO(cacheNeutral);
   if (vm.count("help") > 0)
   {
     usage();
@@ -119,6 +136,8 @@ int main(int argc, const char *argv[])
   {
     numThreads = DefaultNumThreads;
   }
+  // every operation running at the same time keeps an I/O thread busy with reading
+  pwned::ThreadPool::setLaneSize(pwned::Lane::io, numThreads + std::max(1U, numIoThreads));
   if (srcDirectory.size() > 0)
   {
     std::cout << "Scanning '" << srcDirectory << "' for files ..." << std::flush;
@@ -126,7 +145,7 @@ int main(int argc, const char *argv[])
     for (const auto &f : fileTreeIterator)
     {
       const std::string &filePath = f.path().string();
-      if (fs::is_regular_file(f) && ba::ends_with(filePath, ".txt"))
+      if (fs::is_regular_file(f) && pwned::InputStream::isSupported(filePath))
       {
         filenames.push_back(filePath);
       }
@@ -165,18 +184,46 @@ int main(int argc, const char *argv[])
             << std::endl;
   auto t0 = std::chrono::high_resolution_clock::now();
   std::cout << "Preparing queue ..." << std::endl;
-  pwned::OperationQueue<ConvertOperation> opQueue;
+  pwned::OperationQueue<ConvertOperation> opQueue(numThreads);
+  const unsigned int numSortThreads = std::max(1U, std::thread::hardware_concurrency() / numThreads);
+  uint64_t maxMem = memFreeAssumedMBytes * 1024ULL * 1024ULL;
+  std::unique_ptr<pwned::HotKeyTable> hotKeys;
+  if (numHotKeys > 0)
+  {
+    const uint64_t hotKeyMem = pwned::HotKeyTable::memoryUsage(numHotKeys);
+    if (hotKeyMem < maxMem / 2)
+    {
+      hotKeys.reset(new pwned::HotKeyTable(numHotKeys, hotKeyThreshold));
+      maxMem -= hotKeyMem;
+    }
+    else
+    {
+      std::cout << "Not enough RAM for " << numHotKeys << " hot keys, disabling them." << std::endl;
+    }
+  }
+  // small files leave their share of the RAM to the big ones
+  opQueue.setMemoryBudget(maxMem);
   for (const auto &filename : filenames)
   {
     ConvertOperation *op = new ConvertOperation(filename,
                                                 dstDirectory,
                                                 outputExt,
-                                                memFreeAssumedMBytes * 1024ULL * 1024ULL / uint64_t(numThreads),
-                                                options);
+                                                maxMem / uint64_t(numThreads),
+                                                maxMem,
+                                                numSortThreads,
+                                                hotKeys.get(),
+                                                options,
+                                                compressRuns ? pwned::RecordFormat::packed : pwned::RecordFormat::raw);
     opQueue.add(op);
   }
+  // stdin cannot serve as password source and keyboard at the same time
+  const bool readFromStdin = std::find(filenames.begin(), filenames.end(), "-") != filenames.end();
   pwned::TermIO termIO;
-  std::thread keyThread = pwned::runAsync([&opQueue, &termIO] {
+  // waitForFinished() resets the queue, so it cannot tell about a cancel
+  std::atomic<bool> cancelled{false};
+  std::thread keyThread([&opQueue, &termIO, &cancelled, readFromStdin] {
+    if (readFromStdin)
+      return;
     termIO.disableEcho();
     char ch;
     do
@@ -198,6 +245,7 @@ int main(int argc, const char *argv[])
         break;
       case 'q':
         std::cout << "Cancelling all operations ..." << std::endl;
+        cancelled = true;
         opQueue.resume();
         opQueue.cancel();
         break;
@@ -205,19 +253,54 @@ int main(int argc, const char *argv[])
         break;
       }
     } while (ch != 'q');
-  },
-                                          0);
+  });
   keyThread.detach();
   std::cout << "Executing queue ..." << std::endl;
-  std::cout << "([Space] to pause/resume, Q to quit)" << std::endl;
-  opQueue.execute(true);
+  if (!readFromStdin)
+  {
+    std::cout << "([Space] to pause/resume, Q to quit)" << std::endl;
+  }
+  opQueue.execute();
   opQueue.waitForFinished();
-  auto t1 = std::chrono::high_resolution_clock::now();
-  auto time_span = std::chrono::duration_cast<std::chrono::duration<float>>(t1 - t0);
-  if (!opQueue.isCancelled())
+  if (cancelled)
   {
-    std::cout << "Total time: " << pwned::readableTime(time_span.count()) << std::endl
-              << std::endl;
+    std::cout << "Cancelled; the runs written so far are incomplete." << std::endl;
+    return EXIT_FAILURE;
+  }
+  const std::size_t failures = opQueue.failures();
+  if (failures > 0)
+  {
+    std::cerr << "ERROR: " << failures << " of " << filenames.size() << " files could not be converted." << std::endl;
   }
-  return EXIT_SUCCESS;
+  // the hot keys of the files converted are written even so; they're missing from their runs
+  if (hotKeys)
+  {
+    const std::vector<pwned::PasswordHashAndCount> &hotRun = hotKeys->drain();
+    if (!hotRun.empty())
+    {
+      fs::path dstFilePath = fs::path(dstDirectory) / ("hotkeys" + outputExt);
+      for (int n = 1; fs::exists(dstFilePath) && n < 10000; ++n)
+      {
+        dstFilePath = fs::path(dstDirectory) / ("hotkeys" + pwned::string_format("-%04x", n) + outputExt);
+      }
+      std::cout << "Writing " << hotRun.size() << " hot keys to " << dstFilePath.string() << " ..." << std::endl;
+      pwned::BlockWriter writer(dstFilePath.string());
+      for (const auto &phc : hotRun)
+      {
+        writer.write(phc);
+      }
+      if (!writer.close())
+      {
+        std::cerr << "ERROR: cannot write hot keys to " << dstFilePath.string() << "." << std::endl;
+        boost::system::error_code ec;
+        fs::remove(dstFilePath, ec);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto time_span = std::chrono::duration_cast<std::chrono::duration<float>>(t1 - t0);
+  std::cout << "Total time: " << pwned::readableTime(time_span.count()) << std::endl
+            << std::endl;
+  return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,557 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "blockio.hpp"
+#include "pagecache.hpp"
+
+namespace pwned
+{
+
+namespace
+{
+
+// sets `error` if reading stopped short of `size` for another reason than the end of the file
+std::size_t readFully(int fd, char *buf, std::size_t size, uint64_t offset, bool *error = nullptr)
+{
+  std::size_t total = 0;
+  while (total < size)
+  {
+    const ssize_t n = ::pread(fd, buf + total, size - total, off_t(offset + total));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && error != nullptr)
+    {
+      *error = true;
+    }
+    if (n <= 0)
+      break;
+    total += std::size_t(n);
+  }
+  return total;
+}
+
+bool writeFully(int fd, const char *buf, std::size_t size, uint64_t offset)
+{
+  std::size_t total = 0;
+  while (total < size)
+  {
+    const ssize_t n = ::pwrite(fd, buf + total, size - total, off_t(offset + total));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    total += std::size_t(n);
+  }
+  return true;
+}
+
+constexpr char PackedMagic[8] = {'P', 'W', 'N', 'D', 'P', 'A', 'K', '1'};
+// magic and record count
+constexpr std::size_t PackedHeaderSize = 16;
+// payload size and record count
+constexpr std::size_t FrameHeaderSize = 8;
+// one header byte, up to 16 bytes of hash difference and a varint count
+constexpr std::size_t MaxPackedRecordSize = 1 + 16 + 5;
+
+using u128 = unsigned __int128;
+
+inline unsigned int byteLength(u128 d)
+{
+  const uint64_t hi = uint64_t(d >> 64);
+  const uint64_t lo = uint64_t(d);
+  const unsigned int bits = hi != 0 ? 128U - unsigned(__builtin_clzll(hi)) : lo != 0 ? 64U - unsigned(__builtin_clzll(lo)) : 0U;
+  return (bits + 7) / 8;
+}
+
+/**
+ * Packs `n` serialized records into a frame. Each record starts with a
+ * byte holding the length of the difference to the previous hash (bits 3-7)
+ * and the count if it's between 1 and 7 (bits 0-2), followed by the
+ * difference in little-endian order and, if the count did not fit, the
+ * count as varint.
+ */
+void packFrame(const char *raw, std::size_t n, std::vector<char> &out)
+{
+  out.resize(FrameHeaderSize + n * MaxPackedRecordSize);
+  char *dst = out.data() + FrameHeaderSize;
+  u128 prev = 0;
+  PasswordHashAndCount phc;
+  for (std::size_t i = 0; i < n; ++i, raw += PasswordHashAndCount::size)
+  {
+    phc.deserialize(raw);
+    const u128 key = (u128(phc.hash.quad.upper) << 64) | phc.hash.quad.lower;
+    // wraps around for unsorted input, which still decodes correctly
+    u128 d = key - prev;
+    prev = key;
+    const unsigned int length = byteLength(d);
+    const unsigned int count = phc.count >= 1 && phc.count <= 7 ? phc.count : 0;
+    *dst++ = char((length << 3) | count);
+    for (unsigned int b = 0; b < length; ++b, d >>= 8)
+    {
+      *dst++ = char(uint8_t(d));
+    }
+    if (count == 0)
+    {
+      uint32_t c = phc.count;
+      while (c >= 0x80)
+      {
+        *dst++ = char(uint8_t(c | 0x80));
+        c >>= 7;
+      }
+      *dst++ = char(uint8_t(c));
+    }
+  }
+  const uint32_t payloadSize = uint32_t(dst - out.data() - FrameHeaderSize);
+  const uint32_t records = uint32_t(n);
+  std::memcpy(out.data(), &payloadSize, sizeof(payloadSize));
+  std::memcpy(out.data() + sizeof(payloadSize), &records, sizeof(records));
+  out.resize(FrameHeaderSize + payloadSize);
+}
+
+bool unpackFrame(const char *src, std::size_t size, std::size_t n, char *raw)
+{
+  const char *const end = src + size;
+  u128 key = 0;
+  PasswordHashAndCount phc;
+  for (std::size_t i = 0; i < n; ++i, raw += PasswordHashAndCount::size)
+  {
+    if (src >= end)
+      return false;
+    const uint8_t head = uint8_t(*src++);
+    const unsigned int length = head >> 3;
+    if (length > 16 || end - src < std::ptrdiff_t(length))
+      return false;
+    u128 d = 0;
+    for (unsigned int b = 0; b < length; ++b)
+    {
+      d |= u128(uint8_t(src[b])) << (8 * b);
+    }
+    src += length;
+    key += d;
+    uint32_t count = head & 7U;
+    if (count == 0)
+    {
+      for (unsigned int shift = 0;; shift += 7)
+      {
+        if (src >= end || shift > 28)
+          return false;
+        const uint8_t b = uint8_t(*src++);
+        count |= uint32_t(b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+          break;
+      }
+    }
+    phc.hash.quad.upper = uint64_t(key >> 64);
+    phc.hash.quad.lower = uint64_t(key);
+    phc.count = count;
+    phc.serialize(raw);
+  }
+  return src == end;
+}
+
+bool readPackedHeader(int fd, uint64_t &records)
+{
+  char header[PackedHeaderSize];
+  if (readFully(fd, header, sizeof(header), 0) != sizeof(header) || std::memcmp(header, PackedMagic, sizeof(PackedMagic)) != 0)
+    return false;
+  std::memcpy(&records, header + sizeof(PackedMagic), sizeof(records));
+  return true;
+}
+
+} // namespace
+
+bool BlockReader::isPacked(const std::string &filename)
+{
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  uint64_t records = 0;
+  const bool packed = readPackedHeader(fd, records);
+  ::close(fd);
+  return packed;
+}
+
+uint64_t BlockReader::recordCount(const std::string &filename)
+{
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return 0;
+  uint64_t records = 0;
+  if (!readPackedHeader(fd, records))
+  {
+    const off_t size = lseek(fd, 0, SEEK_END);
+    records = size > 0 ? uint64_t(size) / PasswordHashAndCount::size : 0;
+  }
+  ::close(fd);
+  return records;
+}
+
+BlockReader::BlockReader(const std::string &filename, std::size_t blockSize, std::size_t queueDepth)
+    : BlockReader(filename, 0, std::numeric_limits<uint64_t>::max(), blockSize, queueDepth)
+{
+}
+
+BlockReader::BlockReader(const std::string &filename, uint64_t offset, uint64_t length, std::size_t blockSize, std::size_t queueDepth)
+    : blockSize(std::max<std::size_t>(blockSize - blockSize % PasswordHashAndCount::size, PasswordHashAndCount::size))
+    , queueDepth(queueDepth)
+    , offset(offset)
+    , remaining(length)
+    , ranged(length != std::numeric_limits<uint64_t>::max())
+{
+  fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  uint64_t records = 0;
+  if (offset == 0 && length == std::numeric_limits<uint64_t>::max() && readPackedHeader(fd, records))
+  {
+    packed = true;
+    packedRecords = records;
+    this->offset = PackedHeaderSize;
+  }
+#if defined(POSIX_FADV_SEQUENTIAL)
+  // in cache-neutral mode read-ahead would make pages look cached before they are read
+  posix_fadvise(fd, off_t(offset), length == std::numeric_limits<uint64_t>::max() ? 0 : off_t(length), cacheNeutralIO() ? POSIX_FADV_RANDOM : POSIX_FADV_SEQUENTIAL);
+#endif
+  if (queueDepth > 0)
+  {
+    worker = std::thread(&BlockReader::produce, this);
+  }
+}
+
+BlockReader::~BlockReader()
+{
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopped = true;
+  }
+  consumed.notify_all();
+  if (worker.joinable())
+  {
+    worker.join();
+  }
+  if (fd >= 0)
+  {
+    ::close(fd);
+  }
+}
+
+bool BlockReader::isOpen() const
+{
+  return fd >= 0;
+}
+
+bool BlockReader::failed() const
+{
+  return error;
+}
+
+bool BlockReader::readBlock(std::vector<char> &block)
+{
+  if (packed)
+    return readFrame(block);
+  const std::size_t size = std::size_t(std::min<uint64_t>(blockSize, remaining));
+  block.resize(size);
+  const std::vector<unsigned char> &cachedBefore = cachedPages(fd, offset, size);
+  bool readError = false;
+  block.resize(readFully(fd, block.data(), size, offset, &readError));
+  dropReadPages(fd, offset, block.size(), cachedBefore);
+  offset += block.size();
+  remaining -= block.size();
+  // a range ends before the end of the file, so it must be there in full
+  if (readError || (ranged && block.size() < size))
+  {
+    error = true;
+  }
+  return block.size() == blockSize;
+}
+
+bool BlockReader::readFrame(std::vector<char> &block)
+{
+  block.clear();
+  char header[FrameHeaderSize];
+  bool readError = false;
+  const std::size_t headerSize = readFully(fd, header, sizeof(header), offset, &readError);
+  if (headerSize != sizeof(header))
+  {
+    // a file that ends between frames must have delivered all of its records
+    if (readError || headerSize > 0 || recordsUnpacked != packedRecords)
+    {
+      error = true;
+    }
+    return false;
+  }
+  uint32_t payloadSize = 0;
+  uint32_t records = 0;
+  std::memcpy(&payloadSize, header, sizeof(payloadSize));
+  std::memcpy(&records, header + sizeof(payloadSize), sizeof(records));
+  frame.resize(payloadSize);
+  const std::vector<unsigned char> &cachedBefore = cachedPages(fd, offset, sizeof(header) + payloadSize);
+  const bool complete = readFully(fd, frame.data(), payloadSize, offset + sizeof(header)) == payloadSize;
+  dropReadPages(fd, offset, sizeof(header) + payloadSize, cachedBefore);
+  offset += sizeof(header) + payloadSize;
+  block.resize(std::size_t(records) * PasswordHashAndCount::size);
+  if (!complete || !unpackFrame(frame.data(), frame.size(), records, block.data()))
+  {
+    // a damaged frame ends the file
+    block.clear();
+    error = true;
+    return false;
+  }
+  recordsUnpacked += records;
+  return true;
+}
+
+bool BlockReader::nextBlock()
+{
+  if (fd < 0)
+    return false;
+  if (queueDepth == 0)
+  {
+    if (done)
+      return false;
+    done = !readBlock(current);
+    pos = current.data();
+    end = pos + current.size() - current.size() % PasswordHashAndCount::size;
+    return pos + PasswordHashAndCount::size <= end;
+  }
+  std::unique_lock<std::mutex> lock(mtx);
+  if (!current.empty())
+  {
+    spare.push_back(std::move(current));
+    current.clear();
+    consumed.notify_one();
+  }
+  produced.wait(lock, [this] { return !full.empty() || done; });
+  if (full.empty())
+  {
+    pos = end = nullptr;
+    return false;
+  }
+  current = std::move(full.front());
+  full.pop_front();
+  pos = current.data();
+  // a truncated last record is ignored
+  end = pos + current.size() - current.size() % PasswordHashAndCount::size;
+  return pos + PasswordHashAndCount::size <= end;
+}
+
+void BlockReader::produce()
+{
+  for (;;)
+  {
+    std::vector<char> block;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      consumed.wait(lock, [this] { return full.size() < queueDepth || stopped; });
+      if (stopped)
+        break;
+      if (!spare.empty())
+      {
+        block = std::move(spare.back());
+        spare.pop_back();
+      }
+    }
+    const bool exhausted = !readBlock(block);
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!block.empty())
+    {
+      full.push_back(std::move(block));
+    }
+    if (exhausted)
+      break;
+    produced.notify_one();
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  done = true;
+  produced.notify_all();
+}
+
+BlockWriter::BlockWriter(const std::string &filename, std::size_t blockSize, std::size_t queueDepth, RecordFormat format)
+    : blockSize(std::max<std::size_t>(blockSize - blockSize % PasswordHashAndCount::size, PasswordHashAndCount::size))
+    , queueDepth(std::max<std::size_t>(queueDepth, 1))
+    , format(format)
+    , offset(format == RecordFormat::packed ? PackedHeaderSize : 0)
+{
+  fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  start();
+}
+
+BlockWriter::BlockWriter(int fd, uint64_t offset, std::size_t blockSize, std::size_t queueDepth)
+    : blockSize(std::max<std::size_t>(blockSize - blockSize % PasswordHashAndCount::size, PasswordHashAndCount::size))
+    , queueDepth(std::max<std::size_t>(queueDepth, 1))
+    , fd(fd)
+    , offset(offset)
+    , ownsFd(false)
+{
+  start();
+}
+
+BlockWriter::BlockWriter(const std::string &filename, RecordFormat format, uint64_t offset, uint64_t records, std::size_t blockSize, std::size_t queueDepth)
+    : blockSize(std::max<std::size_t>(blockSize - blockSize % PasswordHashAndCount::size, PasswordHashAndCount::size))
+    , queueDepth(std::max<std::size_t>(queueDepth, 1))
+    , format(format)
+    , offset(offset)
+    , recordsWritten(records)
+{
+  fd = ::open(filename.c_str(), O_WRONLY | O_CREAT, 0644);
+  if (fd >= 0 && ::ftruncate(fd, off_t(offset)) != 0)
+  {
+    ::close(fd);
+    fd = -1;
+  }
+  start();
+}
+
+void BlockWriter::start()
+{
+  if (fd < 0)
+    return;
+  current.resize(blockSize);
+  pos = current.data();
+  end = pos + current.size();
+  worker = std::thread(&BlockWriter::consume, this);
+}
+
+BlockWriter::~BlockWriter()
+{
+  close();
+}
+
+bool BlockWriter::isOpen() const
+{
+  return fd >= 0;
+}
+
+void BlockWriter::flushBlock()
+{
+  if (fd < 0)
+  {
+    // nothing gets written, but the records still need a place to go
+    current.resize(blockSize);
+    pos = current.data();
+    end = pos + current.size();
+    return;
+  }
+  current.resize(std::size_t(pos - current.data()));
+  std::unique_lock<std::mutex> lock(mtx);
+  consumed.wait(lock, [this] { return full.size() < queueDepth; });
+  if (!current.empty())
+  {
+    full.push_back(std::move(current));
+    ++pending;
+    produced.notify_one();
+  }
+  if (!spare.empty())
+  {
+    current = std::move(spare.back());
+    spare.pop_back();
+  }
+  lock.unlock();
+  current.resize(blockSize);
+  pos = current.data();
+  end = pos + current.size();
+}
+
+bool BlockWriter::sync()
+{
+  if (fd < 0)
+    return false;
+  flushBlock();
+  std::unique_lock<std::mutex> lock(mtx);
+  consumed.wait(lock, [this] { return pending == 0; });
+  return !failed && ::fdatasync(fd) == 0;
+}
+
+uint64_t BlockWriter::position() const
+{
+  return offset;
+}
+
+uint64_t BlockWriter::records() const
+{
+  return recordsWritten;
+}
+
+bool BlockWriter::close()
+{
+  if (fd < 0)
+    return false;
+  flushBlock();
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    finished = true;
+  }
+  produced.notify_all();
+  worker.join();
+  if (format == RecordFormat::packed && !failed)
+  {
+    // the record count is only known now
+    char header[PackedHeaderSize];
+    std::memcpy(header, PackedMagic, sizeof(PackedMagic));
+    std::memcpy(header + sizeof(PackedMagic), &recordsWritten, sizeof(recordsWritten));
+    failed = !writeFully(fd, header, sizeof(header), 0);
+  }
+  const bool ok = !failed && (!ownsFd || ::close(fd) == 0);
+  fd = -1;
+  return ok;
+}
+
+void BlockWriter::consume()
+{
+  std::vector<char> packedBlock;
+  for (;;)
+  {
+    std::vector<char> block;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      produced.wait(lock, [this] { return !full.empty() || finished; });
+      if (full.empty())
+        break;
+      block = std::move(full.front());
+      full.pop_front();
+    }
+    const std::vector<char> *data = &block;
+    const std::size_t n = block.size() / PasswordHashAndCount::size;
+    if (format == RecordFormat::packed)
+    {
+      packFrame(block.data(), n, packedBlock);
+      data = &packedBlock;
+    }
+    const bool ok = writeFully(fd, data->data(), data->size(), offset);
+    if (ok)
+    {
+      dropWrittenPages(fd, offset, data->size());
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    offset += data->size();
+    recordsWritten += n;
+    failed = failed || !ok;
+    --pending;
+    spare.push_back(std::move(block));
+    consumed.notify_one();
+  }
+}
+
+} // namespace pwned
@@ -0,0 +1,202 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __blockio_hpp__
+#define __blockio_hpp__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "passwordhashandcount.hpp"
+
+namespace pwned
+{
+
+/**
+ * `raw` files are plain arrays of PasswordHashAndCount records. `packed`
+ * files, meant for temporary runs, start with a 16 byte header and store the
+ * records in frames of one block each. Within a frame every hash is coded as
+ * its difference to the previous one, which saves the leading zero bytes
+ * of the gap, and small counts share a byte with the length of the gap.
+ * With uniformly distributed hashes that is about 14 to 15 instead of 20
+ * bytes per record.
+ */
+enum class RecordFormat
+{
+  raw,
+  packed
+};
+
+/**
+ * Reads a file of PasswordHashAndCount records sequentially. An I/O thread
+ * stays up to `queueDepth` blocks ahead of the consumer, so the disk only
+ * sees large sequential reads, hinted with POSIX_FADV_SEQUENTIAL.
+ * With a `queueDepth` of 0 blocks are read synchronously by the consumer.
+ * The second constructor restricts reading to `length` bytes from `offset` on.
+ * The first one also reads packed files, which are unpacked by the I/O thread.
+ * In cache-neutral mode (see pagecache.hpp) read blocks are dropped from
+ * the page cache.
+ */
+class BlockReader
+{
+public:
+  // a multiple of both the record size and the page size
+  static constexpr std::size_t DefaultBlockSize = 16 * 4096 * PasswordHashAndCount::size;
+  static constexpr std::size_t DefaultQueueDepth = 2;
+  explicit BlockReader(const std::string &filename,
+                       std::size_t blockSize = DefaultBlockSize,
+                       std::size_t queueDepth = DefaultQueueDepth);
+  BlockReader(const std::string &filename,
+              uint64_t offset,
+              uint64_t length,
+              std::size_t blockSize,
+              std::size_t queueDepth = DefaultQueueDepth);
+  ~BlockReader();
+  bool isOpen() const;
+  // true if reading ended early because of an I/O error, a range that
+  // reaches beyond the end of the file or a damaged or truncated packed file
+  bool failed() const;
+
+  static bool isPacked(const std::string &filename);
+  // number of records in a raw or packed file
+  static uint64_t recordCount(const std::string &filename);
+
+  inline bool read(PasswordHashAndCount &phc)
+  {
+    if (pos + PasswordHashAndCount::size > end && !nextBlock())
+      return false;
+    phc.deserialize(pos);
+    pos += PasswordHashAndCount::size;
+    return true;
+  }
+
+private:
+  const std::size_t blockSize;
+  const std::size_t queueDepth;
+  int fd{-1};
+  uint64_t offset;
+  uint64_t remaining;
+  const bool ranged;
+  std::atomic<bool> error{false};
+  std::thread worker;
+  std::mutex mtx;
+  std::condition_variable produced;
+  std::condition_variable consumed;
+  std::deque<std::vector<char>> full;
+  std::vector<std::vector<char>> spare;
+  std::vector<char> current;
+  const char *pos{nullptr};
+  const char *end{nullptr};
+  bool done{false};
+  bool stopped{false};
+  bool packed{false};
+  // records the header of a packed file announces and those unpacked so far
+  uint64_t packedRecords{0};
+  uint64_t recordsUnpacked{0};
+  std::vector<char> frame;
+
+  bool readBlock(std::vector<char> &block);
+  bool readFrame(std::vector<char> &block);
+  bool nextBlock();
+  void produce();
+};
+
+/**
+ * Writes PasswordHashAndCount records to a file. Filled blocks are handed
+ * to an I/O thread, so the producer only waits for the disk if more than
+ * `queueDepth` blocks are pending.
+ * The second constructor writes into an already opened file from `offset`
+ * on; the caller keeps ownership of `fd`.
+ * The third constructor continues a file that was synced at `offset` with
+ * `records` records; anything behind `offset` is discarded.
+ * In cache-neutral mode written blocks are flushed and dropped from the
+ * page cache by the I/O thread, which also packs the blocks of packed files.
+ */
+class BlockWriter
+{
+public:
+  static constexpr std::size_t DefaultBlockSize = BlockReader::DefaultBlockSize;
+  static constexpr std::size_t DefaultQueueDepth = 2;
+  explicit BlockWriter(const std::string &filename,
+                       std::size_t blockSize = DefaultBlockSize,
+                       std::size_t queueDepth = DefaultQueueDepth,
+                       RecordFormat format = RecordFormat::raw);
+  BlockWriter(int fd,
+              uint64_t offset,
+              std::size_t blockSize = DefaultBlockSize,
+              std::size_t queueDepth = DefaultQueueDepth);
+  BlockWriter(const std::string &filename,
+              RecordFormat format,
+              uint64_t offset,
+              uint64_t records,
+              std::size_t blockSize = DefaultBlockSize,
+              std::size_t queueDepth = DefaultQueueDepth);
+  ~BlockWriter();
+  bool isOpen() const;
+  bool close();
+  // writes all pending records and flushes them to the disk
+  bool sync();
+  // file position and number of records after the last sync()
+  uint64_t position() const;
+  uint64_t records() const;
+
+  inline void write(const PasswordHashAndCount &phc)
+  {
+    if (pos + PasswordHashAndCount::size > end)
+    {
+      flushBlock();
+    }
+    phc.serialize(pos);
+    pos += PasswordHashAndCount::size;
+  }
+
+private:
+  const std::size_t blockSize;
+  const std::size_t queueDepth;
+  const RecordFormat format{RecordFormat::raw};
+  int fd{-1};
+  uint64_t offset{0};
+  uint64_t recordsWritten{0};
+  std::size_t pending{0};
+  bool ownsFd{true};
+  std::thread worker;
+  std::mutex mtx;
+  std::condition_variable produced;
+  std::condition_variable consumed;
+  std::deque<std::vector<char>> full;
+  std::vector<std::vector<char>> spare;
+  std::vector<char> current;
+  char *pos{nullptr};
+  char *end{nullptr};
+  bool finished{false};
+  bool failed{false};
+
+  void start();
+  void flushBlock();
+  void consume();
+};
+
+} // namespace pwned
+
+#endif // __blockio_hpp__
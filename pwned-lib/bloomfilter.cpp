@@ -0,0 +1,117 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#include "bloomfilter.hpp"
+
+namespace pwned
+{
+
+namespace
+{
+
+constexpr char Magic[8] = {'P', 'W', 'N', 'D', 'B', 'L', 'M', '1'};
+
+} // namespace
+
+BloomFilter::BloomFilter(uint64_t numKeys, unsigned int bitsPerKey)
+{
+  bitsPerKey = std::max(1U, bitsPerKey);
+  numBits = std::max<uint64_t>(64, (numKeys * bitsPerKey + 63) & ~uint64_t(63));
+  numHashes = unsigned(std::clamp(std::lround(bitsPerKey * std::log(2.0)), 1L, 16L));
+  words.reset(new std::atomic<uint64_t>[numBits / 64]);
+  for (uint64_t i = 0; i < numBits / 64; ++i)
+  {
+    words[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void BloomFilter::add(const Hash &hash)
+{
+  for (unsigned int i = 0; i < numHashes; ++i)
+  {
+    const uint64_t bit = bitPosition(hash, i);
+    words[bit / 64].fetch_or(uint64_t(1) << (bit % 64), std::memory_order_relaxed);
+  }
+}
+
+bool BloomFilter::mayContain(const Hash &hash) const
+{
+  for (unsigned int i = 0; i < numHashes; ++i)
+  {
+    const uint64_t bit = bitPosition(hash, i);
+    if ((words[bit / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (bit % 64))) == 0)
+      return false;
+  }
+  return numBits > 0;
+}
+
+/**
+ * File layout: 8 bytes magic, the bit count as uint64, the hash count as
+ * uint32, 4 reserved bytes, then the bit array as uint64 words, all in
+ * host byte order.
+ */
+bool BloomFilter::save(const std::string &filename) const
+{
+  std::ofstream output(filename, std::ios::trunc | std::ios::binary);
+  const uint32_t hashes = numHashes;
+  const uint32_t reserved = 0;
+  output.write(Magic, sizeof(Magic));
+  output.write(reinterpret_cast<const char *>(&numBits), sizeof(numBits));
+  output.write(reinterpret_cast<const char *>(&hashes), sizeof(hashes));
+  output.write(reinterpret_cast<const char *>(&reserved), sizeof(reserved));
+  for (uint64_t i = 0; i < numBits / 64; ++i)
+  {
+    const uint64_t word = words[i].load(std::memory_order_relaxed);
+    output.write(reinterpret_cast<const char *>(&word), sizeof(word));
+  }
+  return output.good();
+}
+
+bool BloomFilter::load(const std::string &filename)
+{
+  std::ifstream input(filename, std::ios::binary);
+  char magic[sizeof(Magic)];
+  uint64_t bits = 0;
+  uint32_t hashes = 0;
+  uint32_t reserved = 0;
+  input.read(magic, sizeof(magic));
+  input.read(reinterpret_cast<char *>(&bits), sizeof(bits));
+  input.read(reinterpret_cast<char *>(&hashes), sizeof(hashes));
+  input.read(reinterpret_cast<char *>(&reserved), sizeof(reserved));
+  if (!input.good() || std::memcmp(magic, Magic, sizeof(Magic)) != 0 || bits == 0 || bits % 64 != 0 || hashes == 0)
+    return false;
+  std::unique_ptr<std::atomic<uint64_t>[]> loaded(new std::atomic<uint64_t>[bits / 64]);
+  for (uint64_t i = 0; i < bits / 64; ++i)
+  {
+    uint64_t word = 0;
+    input.read(reinterpret_cast<char *>(&word), sizeof(word));
+    loaded[i].store(word, std::memory_order_relaxed);
+  }
+  if (!input.good())
+    return false;
+  numBits = bits;
+  numHashes = hashes;
+  words = std::move(loaded);
+  return true;
+}
+
+} // namespace pwned
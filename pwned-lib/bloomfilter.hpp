@@ -0,0 +1,79 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __bloomfilter_hpp__
+#define __bloomfilter_hpp__
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#include "hash.hpp"
+
+namespace pwned
+{
+
+/**
+ * Membership filter for MD5 hashes. `mayContain()` never misses a hash that
+ * was added, and wrongly reports a hash with a probability that only depends
+ * on the number of bits per added hash (about 1 % with 10 bits per hash).
+ *
+ * MD5 hashes are uniformly distributed, so the bit positions are derived
+ * from the hash itself by double hashing instead of rehashing it.
+ * `add()` may be called concurrently.
+ */
+class BloomFilter
+{
+public:
+  static constexpr unsigned int DefaultBitsPerKey = 10;
+
+  BloomFilter() = default;
+  BloomFilter(uint64_t numKeys, unsigned int bitsPerKey = DefaultBitsPerKey);
+
+  void add(const Hash &hash);
+  bool mayContain(const Hash &hash) const;
+
+  inline uint64_t bitCount() const
+  {
+    return numBits;
+  }
+
+  inline unsigned int hashCount() const
+  {
+    return numHashes;
+  }
+
+  bool save(const std::string &filename) const;
+  bool load(const std::string &filename);
+
+private:
+  uint64_t numBits{0};
+  unsigned int numHashes{0};
+  std::unique_ptr<std::atomic<uint64_t>[]> words;
+
+  inline uint64_t bitPosition(const Hash &hash, unsigned int i) const
+  {
+    const uint64_t h = hash.quad.upper + i * (hash.quad.lower | 1U);
+    return uint64_t(((unsigned __int128)h * numBits) >> 64);
+  }
+};
+
+} // namespace pwned
+
+#endif // __bloomfilter_hpp__
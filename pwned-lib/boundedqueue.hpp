@@ -0,0 +1,116 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __boundedqueue_hpp__
+#define __boundedqueue_hpp__
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <cstddef>
+
+namespace pwned
+{
+
+/**
+ * A FIFO between two stages of an operation. `push()` blocks while
+ * `capacity` items are queued, which holds up a producer that is ahead of
+ * its consumer. After `close()` nothing more can be pushed, and `pop()`
+ * returns false as soon as the queue has run empty.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+  explicit BoundedQueue(std::size_t capacity)
+      : capacity(capacity > 0 ? capacity : 1)
+  {
+  }
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  bool push(T &&item)
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+    if (closed)
+      return false;
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+    return true;
+  }
+
+  bool pop(T &item)
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+    return take(item);
+  }
+
+  template <typename Rep, typename Period>
+  bool popFor(T &item, const std::chrono::duration<Rep, Period> &timeout)
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    notEmpty.wait_for(lock, timeout, [this] { return closed || !items.empty(); });
+    return take(item);
+  }
+
+  bool tryPop(T &item)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    return take(item);
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    closed = true;
+    notFull.notify_all();
+    notEmpty.notify_all();
+  }
+
+  // closed and empty
+  bool exhausted() const
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    return closed && items.empty();
+  }
+
+private:
+  const std::size_t capacity;
+  mutable std::mutex mtx;
+  std::condition_variable notFull;
+  std::condition_variable notEmpty;
+  std::deque<T> items;
+  bool closed{false};
+
+  // expects `mtx` to be locked
+  bool take(T &item)
+  {
+    if (items.empty())
+      return false;
+    item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+};
+
+} // namespace pwned
+
+#endif // __boundedqueue_hpp__
@@ -16,9 +16,7 @@
  */
 
 #include <string>
-#include <sstream>
 #include <iostream>
-#include <iomanip>
 
 #include "hash.hpp"
 #include "util.hpp"
@@ -36,50 +34,39 @@ Hash::Hash(uint64_t upper, uint64_t lower)
 {
 }
 
-Hash::Hash(const std::string &pwd)
+Hash::Hash(std::string_view pwd)
 {
-  MD5((const unsigned char *)pwd.c_str(), pwd.size(), data);
+  MD5((const unsigned char *)pwd.data(), pwd.size(), data);
   toHostByteOrder();
   isValid = true;
 }
 
 std::string Hash::toString(bool uppercase) const
 {
-  std::ostringstream ss;
-  if (uppercase)
-  {
-    ss << std::setw(16) << std::setfill('0') << std::hex << std::uppercase << quad.upper << std::setw(16) << std::setfill('0') << std::uppercase << quad.lower;
-  }
-  else
-  {
-    ss << std::setw(16) << std::setfill('0') << std::hex << quad.upper << std::setw(16) << std::setfill('0') << quad.lower;
-  }
-  return ss.str();
+  std::string hex(2 * Hash::size, '0');
+  toHex(&hex[0], uppercase);
+  return hex;
 }
 
-Hash Hash::fromHex(const std::string &seq)
+char *Hash::toHex(char *dst, bool uppercase) const
 {
-  Hash hash;
-  if (seq.size() == 2 * Hash::size)
+  const char *digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+  for (const uint64_t value : {quad.upper, quad.lower})
   {
-    size_t j = 0;
-    for (size_t i = 0; i < seq.size(); i += 2)
+    for (int shift = 60; shift >= 0; shift -= 4)
     {
-      const int hi = decodeHex(seq.at(i));
-      const int lo = decodeHex(seq.at(i + 1));
-      if (hi >= 0 && lo >= 0)
-      {
-        const int b = (hi << 4) + lo;
-        hash.data[j] = (uint8_t)b;
-        ++j;
-      }
-      else
-      {
-        break;
-      }
+      *dst++ = digits[(value >> shift) & 0xfU];
     }
-    hash.isValid = j == Hash::size;
   }
+  return dst;
+}
+
+Hash Hash::fromHex(std::string_view seq)
+{
+  Hash hash;
+  hash.isValid = seq.size() == 2 * Hash::size && hexToBytes(seq, hash.data);
+  if (!hash.isValid)
+    return Hash();
   hash.toHostByteOrder();
   return hash;
 }
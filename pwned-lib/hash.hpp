@@ -21,6 +21,7 @@
 #include <ostream>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include <cstdint>
 #include <openssl/md5.h>
 
@@ -56,7 +57,7 @@ struct Hash
   bool isValid{false};
   Hash() = default;
   Hash(const Hash &);
-  explicit Hash(const std::string &pwd);
+  explicit Hash(std::string_view pwd);
   Hash(uint64_t upper, uint64_t lower);
 
   inline void toHostByteOrder()
@@ -77,8 +78,10 @@ struct Hash
     return read(f);
   }
 
-  static Hash fromHex(const std::string &seq);
+  static Hash fromHex(std::string_view seq);
   std::string toString(bool uppercase = false) const;
+  // writes the 2 * size hex digits of the hash to `dst`; returns the end
+  char *toHex(char *dst, bool uppercase = false) const;
 
   inline Hash &operator=(const Hash &rhs)
   {
@@ -0,0 +1,159 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <cstring>
+
+#include "hashpipeline.hpp"
+
+namespace pwned
+{
+
+namespace
+{
+
+constexpr std::chrono::milliseconds HelpInterval(2);
+
+} // namespace
+
+HashPipeline::HashPipeline(UserPasswordReader &reader,
+                           HotKeyTable *hotKeys,
+                           std::size_t blockSize,
+                           std::size_t depth)
+    : reader(reader)
+    , hotKeys(hotKeys)
+    , blockSize(blockSize)
+    , depth(std::max<std::size_t>(1, depth))
+    , blocks(this->depth)
+    , hashed(this->depth)
+    , hashing(ThreadPool::instance(Lane::cpu))
+    , reading(ThreadPool::instance(Lane::io))
+{
+  // the reader blocks while the queue is full, so it's a job, not a task
+  reading.runJob([this] {
+    try
+    {
+      std::vector<char> block;
+      while (this->reader.readBlock(block, this->blockSize) && blocks.push(std::move(block)))
+      {
+        block = std::vector<char>();
+      }
+    }
+    catch (...)
+    {
+      blocks.close();
+      throw;
+    }
+    blocks.close();
+  });
+}
+
+HashPipeline::~HashPipeline()
+{
+  cancel();
+}
+
+void HashPipeline::cancel()
+{
+  blocks.close();
+}
+
+bool HashPipeline::next(std::vector<PasswordHashAndCount> &records, std::size_t maxEntries)
+{
+  while (records.size() < maxEntries)
+  {
+    if (carryPos < carry.size())
+    {
+      const std::size_t n = std::min(carry.size() - carryPos, maxEntries - records.size());
+      records.insert(records.end(), carry.begin() + std::ptrdiff_t(carryPos), carry.begin() + std::ptrdiff_t(carryPos + n));
+      carryPos += n;
+      continue;
+    }
+    // keep the CPU lane busy with as many blocks as there are
+    while (outstanding < depth)
+    {
+      std::vector<char> block;
+      // only wait for the disk if there is nothing else to wait for
+      if (!(outstanding == 0 ? blocks.pop(block) : blocks.tryPop(block)))
+        break;
+      ++outstanding;
+      hashing.run([this, block = std::move(block)] {
+        std::vector<PasswordHashAndCount> records;
+        try
+        {
+          records = hashBlock(block);
+        }
+        catch (...)
+        {
+          // `next()` counts on every block showing up in `hashed`
+          hashed.push(std::move(records));
+          throw;
+        }
+        hashed.push(std::move(records));
+      });
+    }
+    if (outstanding == 0)
+    {
+      // errors of the stages surface here
+      hashing.wait();
+      reading.wait();
+      return false;
+    }
+    // help with the hashing while waiting for it
+    while (!hashed.tryPop(carry))
+    {
+      if (!ThreadPool::instance(Lane::cpu).runPendingTask() && hashed.popFor(carry, HelpInterval))
+        break;
+    }
+    --outstanding;
+    carryPos = 0;
+  }
+  return true;
+}
+
+std::vector<PasswordHashAndCount> HashPipeline::hashBlock(const std::vector<char> &block) const
+{
+  std::vector<PasswordHashAndCount> records;
+  std::string scratch;
+  const char *p = block.data();
+  const char *const end = block.data() + block.size();
+  while (p < end)
+  {
+    const char *nl = static_cast<const char *>(std::memchr(p, '\n', std::size_t(end - p)));
+    if (nl == nullptr)
+    {
+      nl = end;
+    }
+    std::string_view line(p, std::size_t(nl - p));
+    if (!line.empty() && line.back() == '\r')
+    {
+      line.remove_suffix(1);
+    }
+    const Hash &hash = reader.lineHash(line, scratch);
+    if (hash.isValid && (hotKeys == nullptr || !hotKeys->absorb(hash)))
+    {
+      records.emplace_back(hash, 1U);
+    }
+    p = nl + 1;
+  }
+  return records;
+}
+
+} // namespace pwned
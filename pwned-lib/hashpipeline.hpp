@@ -0,0 +1,83 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __hashpipeline_hpp__
+#define __hashpipeline_hpp__
+
+#include <vector>
+#include <cstddef>
+
+#include "boundedqueue.hpp"
+#include "hotkeytable.hpp"
+#include "passwordhashandcount.hpp"
+#include "threadpool.hpp"
+#include "userpasswordreader.hpp"
+
+namespace pwned
+{
+
+/**
+ * Hashes the passwords of a UserPasswordReader in stages: a job on the I/O
+ * lane reads blocks of whole lines, tasks on the CPU lane hash them, and
+ * `next()` collects the resulting records. At most `depth` blocks are read
+ * ahead and at most `depth` are being hashed, so reading stalls while the
+ * consumer is busy. Hashes absorbed by `hotKeys` don't show up as records.
+ * The reader must not be used by anyone else while the pipeline exists.
+ * The reading job occupies a worker of the I/O lane for as long as the
+ * input lasts, so the lane needs one worker per pipeline running at the
+ * same time, plus those that are to write.
+ */
+class HashPipeline
+{
+public:
+  static constexpr std::size_t DefaultBlockSize = 1024 * 1024;
+  static constexpr std::size_t DefaultDepth = 4;
+
+  explicit HashPipeline(UserPasswordReader &reader,
+                        HotKeyTable *hotKeys = nullptr,
+                        std::size_t blockSize = DefaultBlockSize,
+                        std::size_t depth = DefaultDepth);
+  ~HashPipeline();
+
+  // appends the records of hashed blocks to `records` until it holds
+  // `maxEntries`; returns false once all records have been handed out
+  bool next(std::vector<PasswordHashAndCount> &records, std::size_t maxEntries);
+  // stops reading
+  void cancel();
+
+private:
+  UserPasswordReader &reader;
+  HotKeyTable *const hotKeys;
+  const std::size_t blockSize;
+  const std::size_t depth;
+  BoundedQueue<std::vector<char>> blocks;
+  BoundedQueue<std::vector<PasswordHashAndCount>> hashed;
+  // blocks being hashed or waiting in `hashed`
+  std::size_t outstanding{0};
+  // the rest of a hashed block that didn't fit into the records any more
+  std::vector<PasswordHashAndCount> carry;
+  std::size_t carryPos{0};
+  // declared last, so they wait for their tasks before anything is destroyed
+  TaskGroup hashing;
+  TaskGroup reading;
+
+  std::vector<PasswordHashAndCount> hashBlock(const std::vector<char> &block) const;
+};
+
+} // namespace pwned
+
+#endif // __hashpipeline_hpp__
@@ -0,0 +1,143 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <mutex>
+
+#include "hotkeytable.hpp"
+
+namespace pwned
+{
+
+HotKeyTable::HotKeyTable(std::size_t capacity, uint32_t threshold, unsigned int sketchWidthBits)
+    : capacityPerShard(capacity / (std::size_t(1) << ShardBits) + 1)
+    , threshold(std::max(1U, threshold))
+    , sketchWidth(std::size_t(1) << std::min(sketchWidthBits, 32U))
+    , sketchMask(uint32_t(sketchWidth - 1))
+    , sketch(new std::atomic<uint32_t>[SketchDepth * sketchWidth])
+{
+  for (std::size_t i = 0; i < SketchDepth * sketchWidth; ++i)
+  {
+    sketch[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+uint64_t HotKeyTable::memoryUsage(std::size_t capacity)
+{
+  // a rough estimate of an unordered_map node plus its bucket
+  static constexpr uint64_t BytesPerEntry = 64;
+  return uint64_t(SketchDepth * (std::size_t(1) << SketchWidthBits) * sizeof(uint32_t)) + BytesPerEntry * capacity;
+}
+
+bool HotKeyTable::updateSketch(const Hash &hash)
+{
+  // MD5 is uniformly distributed, so each 32-bit word of the digest
+  // serves as an independent row hash
+  uint32_t words[SketchDepth];
+  std::memcpy(words, hash.data, sizeof(words));
+  std::atomic<uint32_t> *cells[SketchDepth];
+  uint32_t values[SketchDepth];
+  uint32_t estimate = std::numeric_limits<uint32_t>::max();
+  for (unsigned int row = 0; row < SketchDepth; ++row)
+  {
+    cells[row] = &sketch[row * sketchWidth + (words[row] & sketchMask)];
+    values[row] = cells[row]->load(std::memory_order_relaxed);
+    estimate = std::min(estimate, values[row]);
+  }
+  for (unsigned int row = 0; row < SketchDepth; ++row)
+  {
+    if (values[row] == estimate)
+    {
+      cells[row]->fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  if ((sketchUpdates.fetch_add(1, std::memory_order_relaxed) + 1) % sketchWidth == 0)
+  {
+    ageSketch();
+  }
+  return estimate + 1 >= threshold;
+}
+
+void HotKeyTable::ageSketch()
+{
+  // increments racing with this are lost or halved, which a sketch can afford
+  for (std::size_t i = 0; i < SketchDepth * sketchWidth; ++i)
+  {
+    sketch[i].store(sketch[i].load(std::memory_order_relaxed) >> 1, std::memory_order_relaxed);
+  }
+}
+
+bool HotKeyTable::absorb(const Hash &hash)
+{
+  Shard &shard = shards[hash.quad.upper >> (64 - ShardBits)];
+  {
+    std::shared_lock<std::shared_mutex> lock(shard.mtx);
+    auto it = shard.counts.find(hash);
+    if (it != shard.counts.end())
+    {
+      it->second.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    // a full shard admits nothing, so there's no need to lock it exclusively
+    if (shard.counts.size() >= capacityPerShard)
+      return false;
+  }
+  if (!updateSketch(hash))
+    return false;
+  std::unique_lock<std::shared_mutex> lock(shard.mtx);
+  auto it = shard.counts.find(hash);
+  if (it == shard.counts.end())
+  {
+    if (shard.counts.size() >= capacityPerShard)
+      return false;
+    it = shard.counts.try_emplace(hash, 0U).first;
+  }
+  it->second.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+std::size_t HotKeyTable::size() const
+{
+  std::size_t n = 0;
+  for (const auto &shard : shards)
+  {
+    std::shared_lock<std::shared_mutex> lock(shard.mtx);
+    n += shard.counts.size();
+  }
+  return n;
+}
+
+std::vector<PasswordHashAndCount> HotKeyTable::drain()
+{
+  std::vector<PasswordHashAndCount> run;
+  run.reserve(size());
+  for (auto &shard : shards)
+  {
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    for (const auto &entry : shard.counts)
+    {
+      run.emplace_back(entry.first, entry.second.load(std::memory_order_relaxed));
+    }
+    shard.counts.clear();
+  }
+  std::sort(run.begin(), run.end(), PasswordHashAndCountLess());
+  return run;
+}
+
+} // namespace pwned
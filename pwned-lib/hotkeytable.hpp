@@ -0,0 +1,95 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __hotkeytable_hpp__
+#define __hotkeytable_hpp__
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+#include "passwordhashandcount.hpp"
+
+namespace pwned
+{
+
+/**
+ * Table of frequent hashes shared by all converter threads.
+ *
+ * Every hash first passes a count-min sketch (with conservative update).
+ * Once its estimated frequency reaches `threshold` it is admitted to the
+ * table, and all further occurrences are counted there instead of ending up
+ * as records in the run files. `drain()` returns the collected counts as one
+ * sorted run. Once the table holds `capacity` hashes, no more are admitted.
+ * The sketch is halved after as many updates as it is wide, so its cells
+ * don't fill up on long inputs and only hashes that recur at least about
+ * `threshold` / 2 times in as many updates get admitted.
+ */
+class HotKeyTable
+{
+public:
+  static constexpr unsigned int SketchDepth = 4;
+  static constexpr unsigned int SketchWidthBits = 20;
+  static constexpr unsigned int ShardBits = 6;
+  static constexpr uint32_t DefaultThreshold = 8;
+
+  HotKeyTable(std::size_t capacity, uint32_t threshold = DefaultThreshold, unsigned int sketchWidthBits = SketchWidthBits);
+  bool absorb(const Hash &hash);
+  std::size_t size() const;
+  std::vector<PasswordHashAndCount> drain();
+  static uint64_t memoryUsage(std::size_t capacity);
+
+private:
+  struct HashHasher
+  {
+    inline std::size_t operator()(const Hash &hash) const
+    {
+      return std::size_t(hash.quad.lower);
+    }
+  };
+  struct HashEqual
+  {
+    inline bool operator()(const Hash &lhs, const Hash &rhs) const
+    {
+      return lhs.quad.upper == rhs.quad.upper && lhs.quad.lower == rhs.quad.lower;
+    }
+  };
+  struct Shard
+  {
+    mutable std::shared_mutex mtx;
+    std::unordered_map<Hash, std::atomic<uint32_t>, HashHasher, HashEqual> counts;
+  };
+
+  const std::size_t capacityPerShard;
+  const uint32_t threshold;
+  const std::size_t sketchWidth;
+  const uint32_t sketchMask;
+  std::unique_ptr<std::atomic<uint32_t>[]> sketch;
+  std::atomic<uint64_t> sketchUpdates{0};
+  std::array<Shard, 1U << ShardBits> shards;
+
+  bool updateSketch(const Hash &hash);
+  void ageSketch();
+};
+
+} // namespace pwned
+
+#endif // __hotkeytable_hpp__
@@ -0,0 +1,393 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/lzma.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include "inputstream.hpp"
+#include "pagecache.hpp"
+
+extern char **environ;
+
+namespace pwned
+{
+
+namespace ba = boost::algorithm;
+namespace bio = boost::iostreams;
+namespace fs = boost::filesystem;
+
+class AsyncInputBuffer : public std::streambuf
+{
+public:
+  AsyncInputBuffer(const std::string &filename, std::size_t blockSize, std::size_t queueDepth)
+      : blockSize(blockSize)
+      , queueDepth(queueDepth)
+  {
+    if (filename == "-")
+    {
+      source = &std::cin;
+    }
+    else
+    {
+      const Compression compression = InputStream::compressionOf(filename);
+      switch (compression)
+      {
+      case Compression::zip:
+        if (!spawn({"unzip", "-p", filename}))
+          return;
+        break;
+      case Compression::sevenZip:
+        if (!spawn({"7z", "x", "-so", filename}))
+          return;
+        break;
+      default:
+        if (cacheNeutralIO())
+        {
+          // read through a descriptor of our own to know which pages were touched
+          cacheFd = ::open(filename.c_str(), O_RDONLY);
+          if (cacheFd < 0)
+            return;
+#if defined(POSIX_FADV_RANDOM)
+          // read-ahead would make pages look cached before they are read
+          posix_fadvise(cacheFd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+          fileSize = uint64_t(fs::file_size(filename));
+        }
+        else
+        {
+          file.open(filename, std::ios::binary);
+          if (!file.is_open())
+            return;
+        }
+        break;
+      }
+      switch (compression)
+      {
+      case Compression::gzip:
+        filter.push(bio::gzip_decompressor());
+        break;
+      case Compression::bzip2:
+        filter.push(bio::bzip2_decompressor());
+        break;
+      case Compression::xz:
+        filter.push(bio::lzma_decompressor());
+        break;
+      case Compression::zstd:
+        filter.push(bio::zstd_decompressor());
+        break;
+      default:
+        break;
+      }
+      if (compression == Compression::zip || compression == Compression::sevenZip)
+      {
+        filter.push(bio::file_descriptor_source(pipeFd, bio::close_handle));
+        source = &filter;
+      }
+      else if (cacheFd >= 0)
+      {
+        filter.push(bio::file_descriptor_source(cacheFd, bio::close_handle));
+        source = &filter;
+      }
+      else if (compression == Compression::none)
+      {
+        source = &file;
+      }
+      else
+      {
+        filter.push(file);
+        source = &filter;
+      }
+    }
+    opened = true;
+    worker = std::thread(&AsyncInputBuffer::produce, this);
+  }
+
+  ~AsyncInputBuffer() override
+  {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      stopped = true;
+      // not yet reaped by the worker, so the pid cannot have been reused
+      if (childPid > 0)
+      {
+        kill(childPid, SIGTERM);
+      }
+    }
+    consumed.notify_all();
+    if (worker.joinable())
+    {
+      worker.join();
+    }
+    if (childPid > 0)
+    {
+      waitpid(childPid, nullptr, 0);
+    }
+  }
+
+  inline bool isOpen() const
+  {
+    return opened;
+  }
+
+protected:
+  int_type underflow() override
+  {
+    if (gptr() < egptr())
+      return traits_type::to_int_type(*gptr());
+    std::unique_lock<std::mutex> lock(mtx);
+    if (!current.empty())
+    {
+      spare.push_back(std::move(current));
+      consumed.notify_one();
+    }
+    produced.wait(lock, [this] { return !full.empty() || done; });
+    if (full.empty())
+    {
+      setg(nullptr, nullptr, nullptr);
+      // the istream catches it and sets its badbit
+      if (failed)
+        throw std::ios_base::failure("reading the input failed");
+      return traits_type::eof();
+    }
+    current = std::move(full.front());
+    full.pop_front();
+    setg(current.data(), current.data(), current.data() + current.size());
+    return traits_type::to_int_type(*gptr());
+  }
+
+private:
+  const std::size_t blockSize;
+  const std::size_t queueDepth;
+  std::ifstream file;
+  bio::filtering_istream filter;
+  std::istream *source{nullptr};
+  int pipeFd{-1};
+  int cacheFd{-1};
+  uint64_t dropped{0};
+  uint64_t fileSize{0};
+  pid_t childPid{-1};
+  bool opened{false};
+  std::thread worker;
+  std::mutex mtx;
+  std::condition_variable produced;
+  std::condition_variable consumed;
+  std::deque<std::vector<char>> full;
+  std::vector<std::vector<char>> spare;
+  std::vector<char> current;
+  bool done{false};
+  bool stopped{false};
+  // the input ended early, e.g. because the archiver failed
+  bool failed{false};
+
+  bool spawn(const std::vector<std::string> &args)
+  {
+    int fds[2];
+    // children spawned later for other inputs must not inherit the pipe,
+    // or the reader would not see the end of the input before they exit
+#if defined(__linux__)
+    if (pipe2(fds, O_CLOEXEC) != 0)
+      return false;
+#else
+    if (pipe(fds) != 0)
+      return false;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    std::vector<char *> argv;
+    for (const auto &arg : args)
+    {
+      argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    const int rc = posix_spawnp(&childPid, argv.front(), &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (rc != 0)
+    {
+      close(fds[0]);
+      childPid = -1;
+      return false;
+    }
+    pipeFd = fds[0];
+    return true;
+  }
+
+  void produce()
+  {
+    for (;;)
+    {
+      std::vector<char> block;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        consumed.wait(lock, [this] { return full.size() < queueDepth || stopped; });
+        if (stopped)
+          break;
+        if (!spare.empty())
+        {
+          block = std::move(spare.back());
+          spare.pop_back();
+        }
+      }
+      block.resize(blockSize);
+      const std::vector<unsigned char> &cachedBefore = cachedPages(cacheFd, dropped, blockSize);
+      source->read(block.data(), std::streamsize(blockSize));
+      block.resize(std::size_t(source->gcount()));
+      const bool exhausted = !source->good();
+      const bool readFailed = source->bad();
+      if (cacheFd >= 0)
+      {
+        // position in the file itself, which differs from the bytes read if it's compressed
+        const std::streamoff filePos = exhausted ? std::streamoff(fileSize) : std::streamoff(lseek(cacheFd, 0, SEEK_CUR));
+        if (filePos > std::streamoff(dropped))
+        {
+          dropReadPages(cacheFd, dropped, uint64_t(filePos) - dropped, cachedBefore);
+          dropped = uint64_t(filePos);
+        }
+      }
+      const bool childFailed = exhausted && !reapChild();
+      std::lock_guard<std::mutex> lock(mtx);
+      if (!block.empty())
+      {
+        full.push_back(std::move(block));
+      }
+      if (exhausted)
+      {
+        failed = readFailed || childFailed;
+        break;
+      }
+      produced.notify_one();
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    done = true;
+    produced.notify_all();
+  }
+
+  // waits for the archiver to exit after it has closed its output; returns
+  // false if it failed or was killed, unless we killed it ourselves
+  bool reapChild()
+  {
+    if (childPid <= 0)
+      return true;
+    // without reaping it, so that the destructor can't signal a reused pid
+    siginfo_t info;
+    info.si_pid = 0;
+    while (waitid(P_PID, id_t(childPid), &info, WEXITED | WNOWAIT) != 0 && errno == EINTR)
+    {
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    int status = 0;
+    waitpid(childPid, &status, 0);
+    childPid = -1;
+    if (WIFEXITED(status))
+      return WEXITSTATUS(status) == 0;
+    return stopped && WIFSIGNALED(status) && WTERMSIG(status) == SIGTERM;
+  }
+};
+
+InputStream::InputStream(const std::string &filename, std::size_t blockSize, std::size_t queueDepth)
+    : std::istream(nullptr)
+    , buf(new AsyncInputBuffer(filename, blockSize, queueDepth))
+{
+  rdbuf(buf.get());
+  if (!buf->isOpen())
+  {
+    setstate(std::ios::badbit);
+  }
+}
+
+InputStream::~InputStream()
+{
+  rdbuf(nullptr);
+}
+
+bool InputStream::isOpen() const
+{
+  return buf->isOpen();
+}
+
+Compression InputStream::compressionOf(const std::string &filename)
+{
+  if (ba::iends_with(filename, ".gz"))
+    return Compression::gzip;
+  if (ba::iends_with(filename, ".bz2"))
+    return Compression::bzip2;
+  if (ba::iends_with(filename, ".xz"))
+    return Compression::xz;
+  if (ba::iends_with(filename, ".zst"))
+    return Compression::zstd;
+  if (ba::iends_with(filename, ".zip"))
+    return Compression::zip;
+  if (ba::iends_with(filename, ".7z"))
+    return Compression::sevenZip;
+  return Compression::none;
+}
+
+bool InputStream::isSupported(const std::string &filename)
+{
+  switch (compressionOf(filename))
+  {
+  case Compression::zip:
+    // fall-through
+  case Compression::sevenZip:
+    return true;
+  case Compression::none:
+    return ba::ends_with(filename, ".txt");
+  default:
+    return ba::ends_with(fs::path(filename).stem().string(), ".txt");
+  }
+}
+
+std::string InputStream::stem(const std::string &filename)
+{
+  if (filename == "-")
+    return "stdin";
+  fs::path p = fs::path(filename).filename();
+  if (compressionOf(filename) != Compression::none)
+  {
+    p = p.stem();
+  }
+  return p.stem().string();
+}
+
+} // namespace pwned
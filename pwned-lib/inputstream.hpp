@@ -0,0 +1,72 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __inputstream_hpp__
+#define __inputstream_hpp__
+
+#include <istream>
+#include <memory>
+#include <string>
+#include <cstddef>
+
+namespace pwned
+{
+
+enum class Compression
+{
+  none,
+  gzip,
+  bzip2,
+  xz,
+  zstd,
+  zip,
+  sevenZip
+};
+
+class AsyncInputBuffer;
+
+/**
+ * Sequential, read-only stream over a (possibly compressed) password file.
+ *
+ * `.gz`, `.bz2`, `.xz` and `.zst` files are decompressed with Boost.Iostreams,
+ * the contents of `.zip` and `.7z` archives are piped from `unzip -p` and
+ * `7z x -so` respectively. "-" denotes stdin. Reading and decompressing happen
+ * on a background thread that stays up to `queueDepth` blocks ahead of the
+ * consumer. The stream cannot seek.
+ */
+class InputStream : public std::istream
+{
+public:
+  static constexpr std::size_t DefaultBlockSize = 1024 * 1024;
+  static constexpr std::size_t DefaultQueueDepth = 4;
+  explicit InputStream(const std::string &filename,
+                       std::size_t blockSize = DefaultBlockSize,
+                       std::size_t queueDepth = DefaultQueueDepth);
+  ~InputStream() override;
+  bool isOpen() const;
+
+  static Compression compressionOf(const std::string &filename);
+  static bool isSupported(const std::string &filename);
+  static std::string stem(const std::string &filename);
+
+private:
+  std::unique_ptr<AsyncInputBuffer> buf;
+};
+
+} // namespace pwned
+
+#endif // __inputstream_hpp__
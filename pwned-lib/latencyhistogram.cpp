@@ -0,0 +1,98 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "latencyhistogram.hpp"
+
+namespace pwned
+{
+
+namespace
+{
+
+// there's only one writer, which needs no atomic read-modify-write
+inline void add(std::atomic<uint64_t> &counter, uint64_t n)
+{
+  counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+} // namespace
+
+constexpr unsigned int LatencyHistogram::SubBucketBits;
+constexpr unsigned int LatencyHistogram::SubBucketCount;
+constexpr unsigned int LatencyHistogram::MaxValueBits;
+constexpr unsigned int LatencyHistogram::BucketCount;
+
+void LatencyHistogram::record(std::chrono::nanoseconds duration)
+{
+  const uint64_t ns = duration.count() > 0 ? uint64_t(duration.count()) : 0;
+  add(buckets[bucketIndex(ns / 1000)], 1);
+  add(sumNs, ns);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+  for (unsigned int i = 0; i < BucketCount; ++i)
+  {
+    add(buckets[i], other.bucket(i));
+  }
+  add(sumNs, other.sumNs.load(std::memory_order_relaxed));
+}
+
+uint64_t LatencyHistogram::count() const
+{
+  uint64_t n = 0;
+  for (const auto &b : buckets)
+  {
+    n += b.load(std::memory_order_relaxed);
+  }
+  return n;
+}
+
+std::chrono::nanoseconds LatencyHistogram::sum() const
+{
+  return std::chrono::nanoseconds(sumNs.load(std::memory_order_relaxed));
+}
+
+uint64_t LatencyHistogram::bucket(unsigned int index) const
+{
+  return buckets[index].load(std::memory_order_relaxed);
+}
+
+unsigned int LatencyHistogram::bucketIndex(uint64_t micros)
+{
+  if (micros < SubBucketCount)
+    return unsigned(micros);
+  const unsigned int msb = 63U - unsigned(__builtin_clzll(micros));
+  if (msb >= MaxValueBits)
+    return BucketCount - 1;
+  // the position of the leading bit selects the power of two, the bits
+  // after it the sub-bucket
+  const unsigned int shift = msb - SubBucketBits;
+  return (shift + 1) * SubBucketCount + unsigned(micros >> shift) - SubBucketCount;
+}
+
+uint64_t LatencyHistogram::upperBound(unsigned int index)
+{
+  // the lower bound of the next bucket
+  ++index;
+  if (index < SubBucketCount)
+    return index;
+  const unsigned int shift = index / SubBucketCount - 1;
+  return uint64_t(index % SubBucketCount + SubBucketCount) << shift;
+}
+
+} // namespace pwned
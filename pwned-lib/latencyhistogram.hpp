@@ -0,0 +1,71 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __latencyhistogram_hpp__
+#define __latencyhistogram_hpp__
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace pwned
+{
+
+/**
+ * Counts durations in buckets that grow with the durations, like an HDR
+ * histogram does: below 4 µs the buckets are one microsecond wide, above
+ * that every power of two is split into four buckets, so no bucket is
+ * wider than a quarter of its lower bound. Durations of 2^27 µs (about two
+ * minutes) and more all land in the last bucket.
+ *
+ * Only one thread may record into a histogram, but any thread may read it
+ * at the same time. The counters are atomics that the recording thread
+ * updates without locks or read-modify-write operations.
+ */
+class LatencyHistogram
+{
+public:
+  static constexpr unsigned int SubBucketBits = 2;
+  static constexpr unsigned int SubBucketCount = 1U << SubBucketBits;
+  static constexpr unsigned int MaxValueBits = 27;
+  static constexpr unsigned int BucketCount = (MaxValueBits - SubBucketBits + 1) * SubBucketCount;
+
+  LatencyHistogram() = default;
+  LatencyHistogram(const LatencyHistogram &) = delete;
+  LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+  void record(std::chrono::nanoseconds duration);
+  // adds the counts of `other`, which may be recorded into meanwhile
+  void merge(const LatencyHistogram &other);
+
+  uint64_t count() const;
+  std::chrono::nanoseconds sum() const;
+  uint64_t bucket(unsigned int index) const;
+
+  static unsigned int bucketIndex(uint64_t micros);
+  // in microseconds, exclusive
+  static uint64_t upperBound(unsigned int index);
+
+private:
+  std::array<std::atomic<uint64_t>, BucketCount> buckets{};
+  std::atomic<uint64_t> sumNs{0};
+};
+
+} // namespace pwned
+
+#endif // __latencyhistogram_hpp__
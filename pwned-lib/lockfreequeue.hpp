@@ -0,0 +1,489 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __lockfreequeue_hpp__
+#define __lockfreequeue_hpp__
+
+#include <atomic>
+#include <condition_variable>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+namespace pwned
+{
+
+constexpr std::size_t CacheLineSize = 64;
+
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+/**
+ * Wait policy that never sleeps: a waiting thread spins for a while and
+ * then keeps yielding. For threads that have nothing else to do and must
+ * react within microseconds.
+ */
+class SpinWait
+{
+public:
+  template <typename Predicate>
+  void wait(Predicate ready)
+  {
+    for (unsigned int spins = 0; !ready(); ++spins)
+    {
+      if (spins < MaxSpins)
+      {
+        cpuRelax();
+      }
+      else
+      {
+        std::this_thread::yield();
+      }
+    }
+  }
+  void notify()
+  {
+  }
+
+private:
+  static constexpr unsigned int MaxSpins = 128;
+};
+
+/**
+ * Wait policy that spins briefly and then sleeps on a condition variable.
+ * `notify()` only takes the lock if somebody is asleep, so the queue stays
+ * lock-free as long as it is neither full nor empty.
+ */
+class BlockingWait
+{
+public:
+  template <typename Predicate>
+  void wait(Predicate ready)
+  {
+    for (unsigned int spins = 0; spins < MaxSpins; ++spins)
+    {
+      if (ready())
+        return;
+      cpuRelax();
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    ++waiters;
+    // pairs with the fence in notify(): either the waiter sees the change
+    // or the notifier sees the waiter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wakeUp.wait(lock, ready);
+    --waiters;
+  }
+  void notify()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_relaxed) == 0)
+      return;
+    std::lock_guard<std::mutex> lock(mtx);
+    wakeUp.notify_all();
+  }
+
+private:
+  static constexpr unsigned int MaxSpins = 64;
+  std::mutex mtx;
+  std::condition_variable wakeUp;
+  std::atomic<unsigned int> waiters{0};
+};
+
+namespace detail
+{
+
+inline std::size_t ringSize(std::size_t capacity)
+{
+  std::size_t size = 2;
+  while (size < capacity)
+  {
+    size <<= 1;
+  }
+  return size;
+}
+
+} // namespace detail
+
+/**
+ * A bounded multi-producer multi-consumer queue after Dmitry Vyukov.
+ *
+ * Each slot of the ring carries a sequence number that tells producers and
+ * consumers whether it's free or filled in the current round, so claiming a
+ * slot takes a single compare-and-swap on the head or the tail, and threads
+ * working on different slots don't interfere. Head and tail sit on cache
+ * lines of their own; the slots are not padded, which would waste a line
+ * per record.
+ *
+ * The capacity is rounded up to a power of two. `tryPush()` and `tryPop()`
+ * return false instead of waiting; `push()` and `pop()` wait according to
+ * `WaitPolicy`. The batch functions move several items at once and wake up
+ * waiting threads only once per batch. T must be default-constructible and
+ * move-assignable.
+ */
+template <typename T, typename WaitPolicy = BlockingWait>
+class MPMCQueue
+{
+public:
+  explicit MPMCQueue(std::size_t capacity)
+      : mask(detail::ringSize(capacity) - 1)
+      , cells(new Cell[mask + 1])
+  {
+    for (std::size_t i = 0; i <= mask; ++i)
+    {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  MPMCQueue(const MPMCQueue &) = delete;
+  MPMCQueue &operator=(const MPMCQueue &) = delete;
+
+  std::size_t capacity() const
+  {
+    return mask + 1;
+  }
+
+  // a snapshot that may be outdated by the time it's returned
+  std::size_t sizeApprox() const
+  {
+    const std::size_t tail = dequeuePos.load(std::memory_order_relaxed);
+    const std::size_t head = enqueuePos.load(std::memory_order_relaxed);
+    return head > tail ? head - tail : 0;
+  }
+
+  bool tryPush(T &&item)
+  {
+    if (!enqueue(item))
+      return false;
+    notEmpty.notify();
+    return true;
+  }
+
+  bool tryPop(T &item)
+  {
+    if (!dequeue(item))
+      return false;
+    notFull.notify();
+    return true;
+  }
+
+  void push(T &&item)
+  {
+    while (!enqueue(item))
+    {
+      notFull.wait([this] { return sizeApprox() < capacity(); });
+    }
+    notEmpty.notify();
+  }
+
+  void pop(T &item)
+  {
+    while (!dequeue(item))
+    {
+      notEmpty.wait([this] { return sizeApprox() > 0; });
+    }
+    notFull.notify();
+  }
+
+  // moves as many items from [first, last) as fit; returns their number
+  template <typename Iterator>
+  std::size_t tryPushBatch(Iterator first, Iterator last)
+  {
+    std::size_t n = 0;
+    for (; first != last && enqueue(*first); ++first)
+    {
+      ++n;
+    }
+    if (n > 0)
+    {
+      notEmpty.notify();
+    }
+    return n;
+  }
+
+  // moves all items from [first, last), waiting for room as needed
+  template <typename Iterator>
+  void pushBatch(Iterator first, Iterator last)
+  {
+    while (first != last)
+    {
+      const std::size_t n = tryPushBatch(first, last);
+      std::advance(first, n);
+      if (first != last)
+      {
+        notFull.wait([this] { return sizeApprox() < capacity(); });
+      }
+    }
+  }
+
+  // writes up to `maxItems` items to `out`; returns their number
+  template <typename OutputIterator>
+  std::size_t tryPopBatch(OutputIterator out, std::size_t maxItems)
+  {
+    std::size_t n = 0;
+    T item;
+    while (n < maxItems && dequeue(item))
+    {
+      *out++ = std::move(item);
+      ++n;
+    }
+    if (n > 0)
+    {
+      notFull.notify();
+    }
+    return n;
+  }
+
+  // waits for at least one item, then pops up to `maxItems`
+  template <typename OutputIterator>
+  std::size_t popBatch(OutputIterator out, std::size_t maxItems)
+  {
+    if (maxItems == 0)
+      return 0;
+    for (;;)
+    {
+      const std::size_t n = tryPopBatch(out, maxItems);
+      if (n > 0)
+        return n;
+      notEmpty.wait([this] { return sizeApprox() > 0; });
+    }
+  }
+
+private:
+  struct Cell
+  {
+    std::atomic<std::size_t> sequence;
+    T data;
+  };
+
+  const std::size_t mask;
+  const std::unique_ptr<Cell[]> cells;
+  alignas(CacheLineSize) std::atomic<std::size_t> enqueuePos{0};
+  alignas(CacheLineSize) std::atomic<std::size_t> dequeuePos{0};
+  alignas(CacheLineSize) WaitPolicy notEmpty;
+  WaitPolicy notFull;
+
+  bool enqueue(T &item)
+  {
+    std::size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      Cell &cell = cells[pos & mask];
+      const std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+      const std::intptr_t diff = std::intptr_t(seq) - std::intptr_t(pos);
+      if (diff == 0)
+      {
+        if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          cell.data = std::move(item);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0)
+      {
+        // the slot still holds an item of the previous round
+        return false;
+      }
+      else
+      {
+        pos = enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool dequeue(T &item)
+  {
+    std::size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      Cell &cell = cells[pos & mask];
+      const std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+      const std::intptr_t diff = std::intptr_t(seq) - std::intptr_t(pos + 1);
+      if (diff == 0)
+      {
+        if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          item = std::move(cell.data);
+          cell.sequence.store(pos + mask + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0)
+      {
+        // the slot hasn't been filled yet
+        return false;
+      }
+      else
+      {
+        pos = dequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+/**
+ * A bounded queue for exactly one producer and one consumer thread.
+ *
+ * Each side owns one index and keeps a copy of the other side's index,
+ * which it only reloads when the ring looks full or empty, so in the steady
+ * state neither side touches the other's cache line. Batches are published
+ * with a single store. Same interface and rules as MPMCQueue.
+ */
+template <typename T, typename WaitPolicy = BlockingWait>
+class SPSCQueue
+{
+public:
+  explicit SPSCQueue(std::size_t capacity)
+      : mask(detail::ringSize(capacity) - 1)
+      , slots(new T[mask + 1])
+  {
+  }
+  SPSCQueue(const SPSCQueue &) = delete;
+  SPSCQueue &operator=(const SPSCQueue &) = delete;
+
+  std::size_t capacity() const
+  {
+    return mask + 1;
+  }
+
+  std::size_t sizeApprox() const
+  {
+    const std::size_t tail = readPos.load(std::memory_order_acquire);
+    const std::size_t head = writePos.load(std::memory_order_acquire);
+    return head - tail;
+  }
+
+  bool tryPush(T &&item)
+  {
+    return tryPushBatch(&item, &item + 1) == 1;
+  }
+
+  bool tryPop(T &item)
+  {
+    return tryPopBatch(&item, 1) == 1;
+  }
+
+  void push(T &&item)
+  {
+    pushBatch(&item, &item + 1);
+  }
+
+  void pop(T &item)
+  {
+    popBatch(&item, 1);
+  }
+
+  template <typename Iterator>
+  std::size_t tryPushBatch(Iterator first, Iterator last)
+  {
+    const std::size_t head = writePos.load(std::memory_order_relaxed);
+    std::size_t room = capacity() - (head - cachedReadPos);
+    if (room == 0)
+    {
+      cachedReadPos = readPos.load(std::memory_order_acquire);
+      room = capacity() - (head - cachedReadPos);
+    }
+    std::size_t n = 0;
+    for (; n < room && first != last; ++first, ++n)
+    {
+      slots[(head + n) & mask] = std::move(*first);
+    }
+    if (n > 0)
+    {
+      writePos.store(head + n, std::memory_order_release);
+      notEmpty.notify();
+    }
+    return n;
+  }
+
+  template <typename Iterator>
+  void pushBatch(Iterator first, Iterator last)
+  {
+    while (first != last)
+    {
+      const std::size_t n = tryPushBatch(first, last);
+      std::advance(first, n);
+      if (first != last)
+      {
+        notFull.wait([this] { return sizeApprox() < capacity(); });
+      }
+    }
+  }
+
+  template <typename OutputIterator>
+  std::size_t tryPopBatch(OutputIterator out, std::size_t maxItems)
+  {
+    const std::size_t tail = readPos.load(std::memory_order_relaxed);
+    std::size_t available = cachedWritePos - tail;
+    if (available < maxItems)
+    {
+      cachedWritePos = writePos.load(std::memory_order_acquire);
+      available = cachedWritePos - tail;
+    }
+    const std::size_t n = available < maxItems ? available : maxItems;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      *out++ = std::move(slots[(tail + i) & mask]);
+    }
+    if (n > 0)
+    {
+      readPos.store(tail + n, std::memory_order_release);
+      notFull.notify();
+    }
+    return n;
+  }
+
+  template <typename OutputIterator>
+  std::size_t popBatch(OutputIterator out, std::size_t maxItems)
+  {
+    if (maxItems == 0)
+      return 0;
+    for (;;)
+    {
+      const std::size_t n = tryPopBatch(out, maxItems);
+      if (n > 0)
+        return n;
+      notEmpty.wait([this] { return sizeApprox() > 0; });
+    }
+  }
+
+private:
+  const std::size_t mask;
+  const std::unique_ptr<T[]> slots;
+  // written by the producer
+  alignas(CacheLineSize) std::atomic<std::size_t> writePos{0};
+  std::size_t cachedReadPos{0};
+  // written by the consumer
+  alignas(CacheLineSize) std::atomic<std::size_t> readPos{0};
+  std::size_t cachedWritePos{0};
+  alignas(CacheLineSize) WaitPolicy notEmpty;
+  WaitPolicy notFull;
+};
+
+} // namespace pwned
+
+#endif // __lockfreequeue_hpp__
@@ -0,0 +1,162 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __losertree_hpp__
+#define __losertree_hpp__
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "passwordhashandcount.hpp"
+
+namespace pwned
+{
+
+/**
+ * Tournament tree of losers for merging k sorted sources of
+ * PasswordHashAndCount records.
+ *
+ * `Source` must have a public member `phc` holding its current record and
+ * a method `bool read()` that advances to the next record and returns false
+ * once the source is exhausted. The sources passed to the constructor must
+ * already hold their first record (or be marked as exhausted in `valid`).
+ *
+ * Each step replays the path from the winner's leaf to the root, i.e. it
+ * needs ceil(log2 k) comparisons. The keys are cached in the tree as 128-bit
+ * integers, so a comparison is a branch-free `cmp`/`sbb` pair.
+ */
+template <typename Source>
+class LoserTree
+{
+public:
+  explicit LoserTree(const std::vector<Source *> &sources)
+      : LoserTree(sources, std::vector<bool>(sources.size(), true))
+  {
+  }
+
+  LoserTree(const std::vector<Source *> &sources, const std::vector<bool> &valid)
+      : k(1)
+  {
+    while (k < sources.size())
+    {
+      k <<= 1;
+    }
+    leaves.resize(k);
+    tree.resize(k);
+    for (std::size_t i = 0; i < k; ++i)
+    {
+      if (i < sources.size())
+      {
+        leaves[i].source = sources[i];
+        leaves[i].exhausted = !valid[i];
+        if (valid[i])
+        {
+          leaves[i].key = keyOf(sources[i]->phc);
+        }
+      }
+    }
+    // play the initial tournament bottom-up
+    std::vector<std::size_t> winners(2 * k);
+    for (std::size_t i = 0; i < k; ++i)
+    {
+      winners[k + i] = i;
+    }
+    for (std::size_t node = k - 1; node > 0; --node)
+    {
+      const std::size_t a = winners[2 * node];
+      const std::size_t b = winners[2 * node + 1];
+      const bool aWins = less(a, b);
+      winners[node] = aWins ? a : b;
+      tree[node] = aWins ? b : a;
+    }
+    tree[0] = winners[1];
+  }
+
+  /** True if all sources are exhausted. */
+  inline bool empty() const
+  {
+    return leaves[tree[0]].exhausted;
+  }
+
+  /** The source holding the smallest current record. */
+  inline Source *top() const
+  {
+    return leaves[tree[0]].source;
+  }
+
+  /**
+   * Advances the winning source and determines the new winner. Returns
+   * false if the winning source was exhausted by this call.
+   */
+  bool pop()
+  {
+    const std::size_t w = tree[0];
+    Leaf &leaf = leaves[w];
+    const bool more = leaf.source->read();
+    leaf.exhausted = !more;
+    if (more)
+    {
+      leaf.key = keyOf(leaf.source->phc);
+    }
+    replay(w);
+    return more;
+  }
+
+private:
+  typedef unsigned __int128 key_t;
+
+  struct Leaf
+  {
+    key_t key{0};
+    Source *source{nullptr};
+    bool exhausted{true};
+  };
+
+  std::size_t k;
+  std::vector<Leaf> leaves;
+  // tree[0] is the overall winner, tree[1 .. k-1] hold the loser of each match
+  std::vector<std::size_t> tree;
+
+  static inline key_t keyOf(const PasswordHashAndCount &phc)
+  {
+    return (key_t(phc.hash.quad.upper) << 64) | key_t(phc.hash.quad.lower);
+  }
+
+  inline bool less(std::size_t a, std::size_t b) const
+  {
+    const Leaf &la = leaves[a];
+    const Leaf &lb = leaves[b];
+    return (!la.exhausted) & (lb.exhausted | (la.key < lb.key));
+  }
+
+  inline void replay(std::size_t w)
+  {
+    for (std::size_t node = (w + k) >> 1; node > 0; node >>= 1)
+    {
+      const std::size_t loser = tree[node];
+      const bool swap = less(loser, w);
+      tree[node] = swap ? w : loser;
+      w = swap ? loser : w;
+    }
+    tree[0] = w;
+  }
+};
+
+} // namespace pwned
+
+#endif // __losertree_hpp__
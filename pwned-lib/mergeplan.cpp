@@ -0,0 +1,133 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include <sys/resource.h>
+
+#include "mergeplan.hpp"
+
+namespace pwned
+{
+
+namespace
+{
+
+// descriptors kept free for stdio, the output files and libraries
+constexpr uint64_t ReservedFiles = 16;
+
+} // namespace
+
+MergePlan::MergePlan(const std::vector<uint64_t> &sizes, std::size_t fanIn)
+    : mFanIn(std::max<std::size_t>(fanIn, 2))
+{
+  const std::size_t n = sizes.size();
+  if (n == 0)
+    return;
+  if (n <= mFanIn)
+  {
+    Step step{{}, n, 0};
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      step.inputs.push_back(i);
+      step.size += sizes[i];
+    }
+    mSteps.push_back(step);
+    return;
+  }
+  // (size, node) with the smallest size, then the lowest node on top;
+  // padding runs have no node number
+  using Run = std::pair<uint64_t, std::size_t>;
+  static constexpr std::size_t Padding = std::size_t(-1);
+  std::priority_queue<Run, std::vector<Run>, std::greater<Run>> runs;
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    runs.emplace(sizes[i], i);
+  }
+  const std::size_t numPadding = (mFanIn - 1 - (n - 1) % (mFanIn - 1)) % (mFanIn - 1);
+  for (std::size_t i = 0; i < numPadding; ++i)
+  {
+    runs.emplace(0, Padding);
+  }
+  std::size_t nextNode = n;
+  while (runs.size() > 1)
+  {
+    Step step{{}, nextNode++, 0};
+    for (std::size_t i = 0; i < mFanIn && !runs.empty(); ++i)
+    {
+      const Run run = runs.top();
+      runs.pop();
+      if (run.second != Padding)
+      {
+        step.inputs.push_back(run.second);
+        step.size += run.first;
+      }
+    }
+    runs.emplace(step.size, step.output);
+    mSteps.push_back(step);
+  }
+}
+
+uint64_t MergePlan::bytesRewritten() const
+{
+  uint64_t sum = 0;
+  for (std::size_t i = 0; i + 1 < mSteps.size(); ++i)
+  {
+    sum += mSteps[i].size;
+  }
+  return sum;
+}
+
+uint64_t MergePlan::bytesWritten() const
+{
+  return mSteps.empty() ? 0 : bytesRewritten() + mSteps.back().size;
+}
+
+std::size_t MergePlan::maxFanIn(uint64_t maxOpenFiles,
+                                uint64_t memory,
+                                unsigned int filesPerInput,
+                                uint64_t memoryPerInput,
+                                unsigned int concurrency)
+{
+  concurrency = std::max(1U, concurrency);
+  const uint64_t usableFiles = maxOpenFiles > ReservedFiles ? maxOpenFiles - ReservedFiles : 0;
+  const uint64_t byFiles = usableFiles / concurrency / std::max(1U, filesPerInput);
+  const uint64_t byMemory = memory / concurrency / std::max<uint64_t>(1, memoryPerInput);
+  return std::size_t(std::max<uint64_t>(2, std::min(byFiles, byMemory)));
+}
+
+uint64_t MergePlan::openFileLimit()
+{
+  rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+    return 256;
+  if (limit.rlim_cur != limit.rlim_max)
+  {
+    rlimit raised = limit;
+    raised.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &raised) == 0)
+    {
+      limit = raised;
+    }
+  }
+  return limit.rlim_cur == RLIM_INFINITY ? uint64_t(1) << 20 : uint64_t(limit.rlim_cur);
+}
+
+} // namespace pwned
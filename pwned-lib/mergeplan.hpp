@@ -0,0 +1,90 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __mergeplan_hpp__
+#define __mergeplan_hpp__
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace pwned
+{
+
+/**
+ * Plans how to merge runs of the given sizes if no more than `fanIn` runs
+ * can be merged at once.
+ *
+ * The plan is a k-ary Huffman tree: each step merges the smallest runs
+ * available, so the largest runs are rewritten the fewest times. The tree is
+ * padded with empty runs until (n - 1) % (fanIn - 1) == 0 so that only the
+ * first step merges fewer than `fanIn` runs.
+ *
+ * Runs are identified by node numbers: 0 … n-1 denote the given runs, n + i
+ * denotes the output of step i. Steps are ordered such that every step only
+ * depends on earlier ones; the last step produces the final result.
+ */
+class MergePlan
+{
+public:
+  struct Step
+  {
+    std::vector<std::size_t> inputs;
+    std::size_t output;
+    uint64_t size;
+  };
+
+  MergePlan(const std::vector<uint64_t> &sizes, std::size_t fanIn);
+
+  inline const std::vector<Step> &steps() const
+  {
+    return mSteps;
+  }
+
+  inline std::size_t fanIn() const
+  {
+    return mFanIn;
+  }
+
+  // bytes written into intermediate runs, i.e. written and read once more
+  uint64_t bytesRewritten() const;
+  // bytes written by all steps including the final one
+  uint64_t bytesWritten() const;
+
+  /**
+   * Returns the largest fan-in that allows `concurrency` merges at a time
+   * to stay within `maxOpenFiles` file descriptors and `memory` bytes if
+   * every input takes `filesPerInput` descriptors and `memoryPerInput`
+   * bytes. The result is at least 2.
+   */
+  static std::size_t maxFanIn(uint64_t maxOpenFiles,
+                              uint64_t memory,
+                              unsigned int filesPerInput,
+                              uint64_t memoryPerInput,
+                              unsigned int concurrency = 1);
+
+  // raises the soft limit of open files to the hard limit and returns it
+  static uint64_t openFileLimit();
+
+private:
+  std::size_t mFanIn;
+  std::vector<Step> mSteps;
+};
+
+} // namespace pwned
+
+#endif // __mergeplan_hpp__
@@ -0,0 +1,215 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fstream>
+#include <limits>
+
+#include <zlib.h>
+
+#include "util.hpp"
+#include "mergesink.hpp"
+
+namespace pwned
+{
+
+IndexSink::IndexSink(const std::string &filename, unsigned int bits)
+    : MergeSink(filename)
+    , shift((unsigned int)(sizeof(index_key_t) * 8 - bits))
+    , indexes(std::size_t(1) << bits, std::numeric_limits<index_key_t>::max())
+{
+}
+
+IndexSink::IndexSink(unsigned int shift)
+    : MergeSink(std::string())
+    , shift(shift)
+{
+}
+
+void IndexSink::consume(const PasswordHashAndCount &phc, uint64_t index)
+{
+  const index_key_t idx = index_key_t(phc.hash.quad.upper >> shift);
+  if (empty || idx > lastIdx)
+  {
+    if (indexes.empty())
+    {
+      starts.emplace_back(idx, index * PasswordHashAndCount::size);
+    }
+    else
+    {
+      indexes[idx] = index * PasswordHashAndCount::size;
+    }
+    lastIdx = idx;
+    empty = false;
+  }
+}
+
+std::unique_ptr<MergeSink> IndexSink::fork()
+{
+  return std::unique_ptr<MergeSink>(new IndexSink(shift));
+}
+
+void IndexSink::join(MergeSink &section)
+{
+  // a key may straddle two sections, it starts in the first one
+  for (const auto &start : static_cast<IndexSink &>(section).starts)
+  {
+    if (indexes[start.first] == std::numeric_limits<index_key_t>::max())
+    {
+      indexes[start.first] = start.second;
+    }
+  }
+}
+
+bool IndexSink::finish()
+{
+  std::ofstream output(filename(), std::ios::trunc | std::ios::binary);
+  output.write((const char *)indexes.data(), std::streamsize(indexes.size() * sizeof(index_key_t)));
+  return output.good();
+}
+
+std::string IndexSink::description() const
+{
+  return "index";
+}
+
+BloomFilterSink::BloomFilterSink(const std::string &filename, unsigned int bitsPerKey)
+    : MergeSink(filename)
+    , bitsPerKey(bitsPerKey)
+{
+}
+
+void BloomFilterSink::begin(uint64_t maxRecords)
+{
+  filter = std::make_shared<BloomFilter>(maxRecords, bitsPerKey);
+}
+
+void BloomFilterSink::consume(const PasswordHashAndCount &phc, uint64_t)
+{
+  filter->add(phc.hash);
+}
+
+std::unique_ptr<MergeSink> BloomFilterSink::fork()
+{
+  std::unique_ptr<BloomFilterSink> section(new BloomFilterSink(std::string(), bitsPerKey));
+  section->filter = filter;
+  return section;
+}
+
+void BloomFilterSink::join(MergeSink &)
+{
+}
+
+bool BloomFilterSink::finish()
+{
+  if (!filter)
+  {
+    begin(0);
+  }
+  return filter->save(filename());
+}
+
+std::string BloomFilterSink::description() const
+{
+  return "membership filter";
+}
+
+HistogramSink::HistogramSink(const std::string &filename)
+    : MergeSink(filename)
+{
+}
+
+void HistogramSink::consume(const PasswordHashAndCount &phc, uint64_t)
+{
+  Bucket &bucket = buckets[phc.count == 0 ? 0 : 32 - __builtin_clz(phc.count)];
+  ++bucket.hashes;
+  bucket.occurrences += phc.count;
+}
+
+std::unique_ptr<MergeSink> HistogramSink::fork()
+{
+  return std::unique_ptr<MergeSink>(new HistogramSink(std::string()));
+}
+
+void HistogramSink::join(MergeSink &section)
+{
+  const auto &other = static_cast<HistogramSink &>(section).buckets;
+  for (std::size_t i = 0; i < buckets.size(); ++i)
+  {
+    buckets[i].hashes += other[i].hashes;
+    buckets[i].occurrences += other[i].occurrences;
+  }
+}
+
+bool HistogramSink::finish()
+{
+  std::ofstream output(filename(), std::ios::trunc);
+  output << "# count from\tcount to\thashes\toccurrences" << std::endl;
+  for (std::size_t i = 1; i < buckets.size(); ++i)
+  {
+    if (buckets[i].hashes == 0)
+      continue;
+    const uint64_t lo = uint64_t(1) << (i - 1);
+    const uint64_t hi = (uint64_t(1) << i) - 1;
+    output << lo << '\t' << hi << '\t' << buckets[i].hashes << '\t' << buckets[i].occurrences << std::endl;
+  }
+  return output.good();
+}
+
+std::string HistogramSink::description() const
+{
+  return "count histogram";
+}
+
+ChecksumSink::ChecksumSink(const std::string &filename)
+    : MergeSink(filename)
+    , crc(uint32_t(crc32(0L, Z_NULL, 0)))
+{
+}
+
+void ChecksumSink::consume(const PasswordHashAndCount &phc, uint64_t)
+{
+  char record[PasswordHashAndCount::size];
+  phc.serialize(record);
+  crc = uint32_t(crc32(crc, reinterpret_cast<const Bytef *>(record), PasswordHashAndCount::size));
+  length += PasswordHashAndCount::size;
+}
+
+std::unique_ptr<MergeSink> ChecksumSink::fork()
+{
+  return std::unique_ptr<MergeSink>(new ChecksumSink(std::string()));
+}
+
+void ChecksumSink::join(MergeSink &section)
+{
+  const ChecksumSink &other = static_cast<ChecksumSink &>(section);
+  crc = uint32_t(crc32_combine(crc, other.crc, z_off_t(other.length)));
+  length += other.length;
+}
+
+bool ChecksumSink::finish()
+{
+  std::ofstream output(filename(), std::ios::trunc);
+  output << string_format("%08x", crc) << std::endl;
+  return output.good();
+}
+
+std::string ChecksumSink::description() const
+{
+  return "CRC-32 checksum";
+}
+
+} // namespace pwned
@@ -0,0 +1,169 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __mergesink_hpp__
+#define __mergesink_hpp__
+
+#include <array>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+#include "passwordhashandcount.hpp"
+#include "passwordinspector.hpp"
+#include "bloomfilter.hpp"
+
+namespace pwned
+{
+
+/**
+ * Receives the records of a merge in output order, so that data derived
+ * from the merged file can be collected in the same pass instead of
+ * scanning the finished file again.
+ *
+ * Merges that produce several sections of the output concurrently hand
+ * each section to a sink obtained by `fork()` and `join()` the sections
+ * back in output order afterwards.
+ */
+class MergeSink
+{
+public:
+  explicit MergeSink(const std::string &filename)
+      : mFilename(filename)
+  {
+  }
+  virtual ~MergeSink() = default;
+
+  // called once before the first record with an upper bound of the record count
+  virtual void begin(uint64_t maxRecords)
+  {
+    (void)maxRecords;
+  }
+  // `index` is the position of `phc` in the output file counted in records
+  virtual void consume(const PasswordHashAndCount &phc, uint64_t index) = 0;
+  virtual std::unique_ptr<MergeSink> fork() = 0;
+  virtual void join(MergeSink &section) = 0;
+  // writes the result to `filename()`
+  virtual bool finish() = 0;
+  virtual std::string description() const = 0;
+
+  inline const std::string &filename() const
+  {
+    return mFilename;
+  }
+
+private:
+  const std::string mFilename;
+};
+
+/**
+ * Collects the index of the merged file. The result is identical to what
+ * `pwned-index` produces from the finished file.
+ */
+class IndexSink : public MergeSink
+{
+public:
+  IndexSink(const std::string &filename, unsigned int bits);
+  void consume(const PasswordHashAndCount &phc, uint64_t index) override;
+  std::unique_ptr<MergeSink> fork() override;
+  void join(MergeSink &section) override;
+  bool finish() override;
+  std::string description() const override;
+
+private:
+  IndexSink(unsigned int shift);
+  const unsigned int shift;
+  std::vector<index_key_t> indexes;
+  // sections only remember where each key starts
+  std::vector<std::pair<index_key_t, uint64_t>> starts;
+  index_key_t lastIdx{0};
+  bool empty{true};
+};
+
+/**
+ * Builds a BloomFilter of the merged hashes.
+ */
+class BloomFilterSink : public MergeSink
+{
+public:
+  BloomFilterSink(const std::string &filename, unsigned int bitsPerKey = BloomFilter::DefaultBitsPerKey);
+  void begin(uint64_t maxRecords) override;
+  void consume(const PasswordHashAndCount &phc, uint64_t index) override;
+  std::unique_ptr<MergeSink> fork() override;
+  void join(MergeSink &section) override;
+  bool finish() override;
+  std::string description() const override;
+
+private:
+  const unsigned int bitsPerKey;
+  // shared by all sections, BloomFilter::add() is thread-safe
+  std::shared_ptr<BloomFilter> filter;
+};
+
+/**
+ * Counts hashes and occurrences in power-of-two buckets of the per-hash
+ * count and writes them as a table, one bucket per line.
+ */
+class HistogramSink : public MergeSink
+{
+public:
+  explicit HistogramSink(const std::string &filename);
+  void consume(const PasswordHashAndCount &phc, uint64_t index) override;
+  std::unique_ptr<MergeSink> fork() override;
+  void join(MergeSink &section) override;
+  bool finish() override;
+  std::string description() const override;
+
+private:
+  struct Bucket
+  {
+    uint64_t hashes{0};
+    uint64_t occurrences{0};
+  };
+  std::array<Bucket, 33> buckets;
+};
+
+/**
+ * Computes the CRC-32 of the merged file as it is written. CRCs of
+ * consecutive sections can be combined, which a cryptographic digest
+ * would not allow.
+ */
+class ChecksumSink : public MergeSink
+{
+public:
+  explicit ChecksumSink(const std::string &filename);
+  void consume(const PasswordHashAndCount &phc, uint64_t index) override;
+  std::unique_ptr<MergeSink> fork() override;
+  void join(MergeSink &section) override;
+  bool finish() override;
+  std::string description() const override;
+
+  inline uint32_t checksum() const
+  {
+    return crc;
+  }
+
+private:
+  uint32_t crc;
+  uint64_t length{0};
+};
+
+} // namespace pwned
+
+#endif // __mergesink_hpp__
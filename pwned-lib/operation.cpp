@@ -15,6 +15,10 @@
  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <exception>
+#include <iostream>
+
 #include "operationexception.hpp"
 #include "operation.hpp"
 #include "operationqueue.hpp"
@@ -35,6 +39,42 @@ void Operation::setQueue(OperationQueue<Operation> *queue) noexcept
   this->queue = queue;
 }
 
+void Operation::setMemoryDemand(uint64_t minimum, uint64_t wanted) noexcept
+{
+  memoryMinimum = minimum;
+  memoryWanted = std::max(minimum, wanted);
+}
+
+uint64_t Operation::minimumMemory() const noexcept
+{
+  return memoryMinimum;
+}
+
+uint64_t Operation::wantedMemory() const noexcept
+{
+  return memoryWanted;
+}
+
+uint64_t Operation::grantedMemory() const noexcept
+{
+  return memoryGranted;
+}
+
+void Operation::grantMemory(uint64_t bytes) noexcept
+{
+  memoryGranted = bytes;
+}
+
+uint64_t Operation::requestMemory(uint64_t wanted)
+{
+  if (queue == nullptr)
+  {
+    memoryGranted = wanted;
+    return wanted;
+  }
+  return queue->requestMemory(this, wanted);
+}
+
 /**
      * Method name: pause()
      * Description: Signals the operation to pause. It's up to the implementation of the Operation to take the necessary measures to pause execution.
@@ -46,6 +86,11 @@ void Operation::pause() noexcept
   isPaused = true;
 }
 
+void Operation::resume() noexcept
+{
+  isPaused = false;
+}
+
 void Operation::wait() noexcept(false)
 {
   if (queue != nullptr)
@@ -60,27 +105,41 @@ void Operation::wait() noexcept(false)
 
 void Operation::start() noexcept
 {
-  if (isCancelled)
-    return;
-  isRunning = true;
-  isPaused = false;
-  try
-  {
-    execute();
-  }
-  catch (OperationException &e)
+  if (!isCancelled)
   {
-    std::cerr << "Exception in Operation::execute(): " << e.what() << std::endl;
+    isRunning = true;
+    isPaused = false;
+    try
+    {
+      execute();
+    }
+    catch (OperationException &e)
+    {
+      std::cerr << "Exception in Operation::execute(): " << e.what() << std::endl;
+      isFailed = true;
+    }
+    catch (std::exception &e)
+    {
+      // e.g. rethrown from a sub-task
+      std::cerr << "Exception in Operation::execute(): " << e.what() << std::endl;
+      isFailed = true;
+    }
+    isRunning = false;
   }
-  isRunning = false;
+  std::lock_guard<std::mutex> lock(mtx);
   isFinished = true;
-  finishedCondition.notify_one();
+  finishedCondition.notify_all();
 }
 
 void Operation::waitForFinished()
 {
   std::unique_lock<std::mutex> lock(mtx);
-  finishedCondition.wait(lock);
+  finishedCondition.wait(lock, [this] { return isFinished.load(); });
+}
+
+bool Operation::failed() const noexcept
+{
+  return isFailed;
 }
 
 void Operation::cancel()
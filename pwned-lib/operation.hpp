@@ -20,6 +20,7 @@
 
 #include <atomic>
 #include <mutex>
+#include <cstdint>
 #include <condition_variable>
 #include <sys/resource.h>
 
@@ -40,12 +41,22 @@ protected:
   std::atomic<bool> isFinished{false};
   std::atomic<bool> isCancelled{false};
   std::atomic<bool> isPaused{false};
+  std::atomic<bool> isFailed{false};
   std::mutex mtx;
   std::condition_variable finishedCondition;
   OperationQueue<Operation> *queue{nullptr};
+  uint64_t memoryMinimum{0};
+  uint64_t memoryWanted{0};
+  std::atomic<uint64_t> memoryGranted{0};
   void wait() noexcept(false);
   void waitForFinished();
 
+  /**
+         * Description: Asks the queue to change the memory granted to the running operation to `wanted` bytes. Returns what was granted, which may be less than asked for.
+         * Parameters: wanted
+         */
+  uint64_t requestMemory(uint64_t wanted);
+
 public:
   UUID uuid;
   long long priority{0};
@@ -55,6 +66,16 @@ public:
 
   void setQueue(OperationQueue<Operation> *queue) noexcept;
 
+  /**
+         * Description: Declares the memory the operation can make use of and the least it needs to run. The OperationQueue starts the operation only when it can grant the minimum. Operations that declare nothing are not accounted for.
+         * Parameters: minimum, wanted
+         */
+  void setMemoryDemand(uint64_t minimum, uint64_t wanted) noexcept;
+  uint64_t minimumMemory() const noexcept;
+  uint64_t wantedMemory() const noexcept;
+  uint64_t grantedMemory() const noexcept;
+  void grantMemory(uint64_t bytes) noexcept;
+
   /**
          * Description: Signals the operation to pause by setting `isPaused` to `true`. It's up to the implementation of the Operation to take the necessary measures to pause execution.
          * Parameters: none
@@ -62,7 +83,13 @@ public:
   void pause() noexcept;
 
   /**
-         * Description: Starts the operation by calling the abstract method `execute()`.
+         * Description: Clears the pause signal of the operation. The OperationQueue does that before it wakes up its paused operations, so that sub-tasks of the operation can go on, too.
+         * Parameters: none
+         */
+  void resume() noexcept;
+
+  /**
+         * Description: Starts the operation by calling the abstract method `execute()`. An exception thrown by `execute()` marks the operation as failed.
          * Parameters: none
          */
   virtual void start() noexcept;
@@ -73,6 +100,12 @@ public:
          */
   void cancel();
 
+  /**
+         * Description: Tells if `execute()` ended with an exception.
+         * Parameters: none
+         */
+  bool failed() const noexcept;
+
   virtual void execute() noexcept(false) = 0;
 };
 
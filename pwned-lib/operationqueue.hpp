@@ -18,53 +18,168 @@
 #ifndef __operationqueue_hpp__
 #define __operationqueue_hpp__
 
-#include <thread>
-#include <pthread.h>
 #include <mutex>
+#include <condition_variable>
+#include <algorithm>
 #include <list>
 #include <queue>
+#include <vector>
 #include <cstring>
 #include <cstdint>
 
-#include "semaphore.hpp"
 #include "operation.hpp"
+#include "threadpool.hpp"
 
 namespace pwned
 {
 
-template <typename F, typename... Ts>
-inline std::thread runAsync(F &&f, int prio, Ts &&... params)
-{
-  std::thread th(std::forward<F>(f), std::forward<Ts>(params)...);
-  sched_param sch_params;
-  sch_params.sched_priority = prio;
-  pthread_setschedparam(th.native_handle(), SCHED_RR, &sch_params);
-  return th;
-}
-
 static const auto opGreaterPriority = [](Operation *lhs, Operation *rhs) {
   return lhs->priority < rhs->priority;
 };
 
+/**
+ * Runs operations as jobs on a ThreadPool, highest priority first and at
+ * most `maxConcurrentOps` at a time (by default as many as the pool has
+ * workers). Sub-tasks of the operations go to the same pool.
+ *
+ * With a memory budget an operation is only started if the memory it
+ * declared as its minimum is free. It gets what it wants, but no more than
+ * an even share of the free memory among the operations that could start
+ * along with it. Running operations may ask for more later on; they get
+ * what others have given back, as long as no operation is waiting for it.
+ * An operation that needs more than the whole budget runs on its own.
+ */
 template <class T>
 class OperationQueue
 {
   std::priority_queue<T*, std::vector<T*>, decltype(opGreaterPriority)> unscheduledOps{opGreaterPriority};
   std::list<T*> runningOps;
-  std::list<std::thread> opThreads;
-  std::thread exeThread;
+  ThreadPool &pool;
+  const std::size_t maxConcurrentOps;
+  // operations handed to the pool, but not yet finished
+  std::size_t scheduledOps{0};
+  // 0 means unlimited
+  uint64_t memoryBudget{0};
+  uint64_t memoryInUse{0};
+  // operations that ended with an exception, not cleared by reset()
+  std::size_t failedOps{0};
   mutable std::mutex mtx;
   std::mutex pauseMtx;
-  Semaphore guard{std::thread::hardware_concurrency()};
-  int threadPriority;
   bool _isRunning{false};
   bool _isCancelled{false};
+  // cancel() calls in progress; finished operations are kept until they're done
+  int cancelling{0};
   std::condition_variable pauseCondition;
+  std::condition_variable finishedCondition;
+
+  // expects `mtx` to be locked
+  void schedule()
+  {
+    while (!_isCancelled && !unscheduledOps.empty() && scheduledOps < maxConcurrentOps)
+    {
+      T *const op = unscheduledOps.top();
+      if (memoryBudget > 0)
+      {
+        const uint64_t available = memoryBudget - std::min(memoryBudget, memoryInUse);
+        const std::size_t slots = std::min(maxConcurrentOps - scheduledOps, unscheduledOps.size());
+        uint64_t grant = std::min(op->wantedMemory(), std::max(op->minimumMemory(), available / slots));
+        if (grant > available)
+        {
+          if (scheduledOps > 0)
+            break;
+          grant = op->minimumMemory();
+        }
+        op->grantMemory(grant);
+        memoryInUse += grant;
+      }
+      else
+      {
+        op->grantMemory(op->wantedMemory());
+      }
+      unscheduledOps.pop();
+      ++scheduledOps;
+      pool.submitJob([this, op] { run(op); });
+    }
+  }
+
+  void run(T *const op)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (_isCancelled)
+      {
+        releaseMemory(op);
+        delete op;
+        --scheduledOps;
+        finishedCondition.notify_all();
+        return;
+      }
+      runningOps.push_back(op);
+    }
+    op->start();
+    finished(op);
+  }
+
+  // expects `mtx` to be locked
+  void releaseMemory(Operation *const op)
+  {
+    if (memoryBudget > 0)
+    {
+      memoryInUse -= std::min(memoryInUse, op->grantedMemory());
+    }
+    op->grantMemory(0);
+  }
 
 public:
-  explicit OperationQueue(int threadPriority = 0)
-      : threadPriority(threadPriority)
+  explicit OperationQueue(std::size_t maxConcurrentOps = 0, ThreadPool &pool = ThreadPool::instance())
+      : pool(pool)
+      , maxConcurrentOps(maxConcurrentOps > 0 ? maxConcurrentOps : pool.size())
+  {
+  }
+
+  // must be set before execute()
+  void setMemoryBudget(uint64_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    memoryBudget = bytes;
+  }
+
+  uint64_t memoryUsage() const
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    return memoryInUse;
+  }
+
+  // changes the memory `op` holds to as much of `wanted` as can be spared
+  uint64_t requestMemory(Operation *const op, uint64_t wanted)
   {
+    std::lock_guard<std::mutex> lock(mtx);
+    const uint64_t granted = op->grantedMemory();
+    if (memoryBudget == 0)
+    {
+      op->grantMemory(wanted);
+      return wanted;
+    }
+    if (wanted <= granted)
+    {
+      op->grantMemory(wanted);
+      memoryInUse -= std::min(memoryInUse, granted - wanted);
+      // what was given back may let a waiting operation start
+      schedule();
+      return wanted;
+    }
+    const uint64_t available = memoryBudget - std::min(memoryBudget, memoryInUse);
+    uint64_t limit = granted + available;
+    if (!unscheduledOps.empty())
+    {
+      // leave waiting operations their share
+      const uint64_t share = memoryBudget / std::min(maxConcurrentOps, scheduledOps + unscheduledOps.size());
+      limit = std::max(granted, std::min(limit, share));
+    }
+    const uint64_t grant = std::min(wanted, limit);
+    op->grantMemory(grant);
+    memoryInUse += grant - granted;
+    return grant;
   }
 
   std::size_t size() const
@@ -73,10 +188,16 @@ public:
     return unscheduledOps.size() + runningOps.size();
   }
 
+  // number of operations that failed since the queue was created
+  std::size_t failures() const
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    return failedOps;
+  }
+
   void reset()
   {
     cancel();
-    opThreads.clear();
     _isRunning = false;
     _isCancelled = false;
   }
@@ -105,11 +226,11 @@ public:
       return;
     if (_isRunning)
     {
+      std::lock_guard<std::mutex> lock(mtx);
       for (Operation *op : runningOps)
       {
         op->pause();
       }
-      std::lock_guard<std::mutex> lock(mtx);
       _isRunning = false;
     }
   }
@@ -121,6 +242,13 @@ public:
     if (!_isRunning)
     {
       // std::cout << "OperationQueue::resume() notifying all ..." << std::endl;
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (Operation *op : runningOps)
+        {
+          op->resume();
+        }
+      }
       pauseCondition.notify_all();
       _isRunning = true;
     }
@@ -128,19 +256,27 @@ public:
 
   void cancel()
   {
-    std::lock_guard<std::mutex> lock(mtx);
-    _isCancelled = true;
-    for (Operation *op : runningOps)
+    std::vector<T*> ops;
     {
-      op->cancel();
+      std::lock_guard<std::mutex> lock(mtx);
+      _isCancelled = true;
+      ++cancelling;
+      ops.assign(runningOps.begin(), runningOps.end());
+      while (!unscheduledOps.empty())
+      {
+        delete unscheduledOps.top();
+        unscheduledOps.pop();
+      }
     }
-    while (!unscheduledOps.empty())
+    // without the lock, which the operations need to get on to their end,
+    // e.g. in requestMemory()
+    for (Operation *op : ops)
     {
-      Operation *op = unscheduledOps.top();
       op->cancel();
-      delete op;
-      unscheduledOps.pop();
     }
+    std::lock_guard<std::mutex> lock(mtx);
+    --cancelling;
+    finishedCondition.notify_all();
   }
 
   void add(T *const op)
@@ -152,54 +288,33 @@ public:
 
   void finished(T *const op)
   {
-    std::lock_guard<std::mutex> lock(mtx);
+    std::unique_lock<std::mutex> lock(mtx);
+    // cancel() may still be waiting for `op`
+    finishedCondition.wait(lock, [this] { return cancelling == 0; });
     runningOps.remove(op);
-    delete op;
-  }
-
-  void execute(bool _waitForScheduled = false)
-  {
-    sched_param param;
-    int policy;
-    int rc = pthread_getschedparam(pthread_self(), &policy, &param);
-    int parentPriority = (rc == 0) ? param.sched_priority : 0;
-    exeThread = runAsync([this] {
-      while (!unscheduledOps.empty())
-      {
-        if (_isCancelled)
-          break;
-        guard.wait();
-        mtx.lock();
-        T *const op = unscheduledOps.top();
-        unscheduledOps.pop();
-        runningOps.push_back(op);
-        opThreads.push_back(runAsync([op, this]() {
-          op->start();
-          finished(op);
-          guard.notify();
-        },
-                                     threadPriority));
-        mtx.unlock();
-      }
-    },
-                         parentPriority);
-    _isRunning = true;
-    if (_waitForScheduled)
+    if (op->failed())
     {
-      waitForScheduled();
+      ++failedOps;
     }
+    releaseMemory(op);
+    delete op;
+    --scheduledOps;
+    schedule();
+    finishedCondition.notify_all();
   }
 
-  void waitForScheduled()
+  void execute()
   {
-    exeThread.join();
+    std::lock_guard<std::mutex> lock(mtx);
+    _isRunning = true;
+    schedule();
   }
 
   void waitForFinished()
   {
-    for (auto &thread : opThreads)
     {
-      thread.join();
+      std::unique_lock<std::mutex> lock(mtx);
+      finishedCondition.wait(lock, [this] { return scheduledOps == 0 && (_isCancelled || unscheduledOps.empty()); });
     }
     reset();
   }
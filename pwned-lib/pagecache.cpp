@@ -0,0 +1,128 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "pagecache.hpp"
+
+namespace pwned
+{
+
+namespace
+{
+
+std::atomic<bool> cacheNeutral{false};
+
+} // namespace
+
+void setCacheNeutralIO(bool enabled)
+{
+  cacheNeutral = enabled;
+}
+
+bool cacheNeutralIO()
+{
+  return cacheNeutral;
+}
+
+std::vector<unsigned char> cachedPages(int fd, uint64_t offset, uint64_t length)
+{
+  std::vector<unsigned char> pages;
+#if defined(__linux__)
+  if (!cacheNeutral || fd < 0 || length == 0)
+    return pages;
+  const uint64_t pageSize = uint64_t(sysconf(_SC_PAGESIZE));
+  const uint64_t first = offset - offset % pageSize;
+  const uint64_t size = offset + length - first;
+  // mapping a file without touching it does not read anything
+  void *addr = mmap(nullptr, std::size_t(size), PROT_READ, MAP_SHARED, fd, off_t(first));
+  if (addr == MAP_FAILED)
+    return pages;
+  pages.resize(std::size_t((size + pageSize - 1) / pageSize));
+  if (mincore(addr, std::size_t(size), pages.data()) != 0)
+  {
+    pages.clear();
+  }
+  munmap(addr, std::size_t(size));
+#else
+  (void)fd;
+  (void)offset;
+  (void)length;
+#endif
+  return pages;
+}
+
+void dropReadPages(int fd, uint64_t offset, uint64_t length, const std::vector<unsigned char> &cachedBefore)
+{
+#if defined(POSIX_FADV_DONTNEED)
+  if (!cacheNeutral || fd < 0)
+    return;
+  if (cachedBefore.empty() || length == 0)
+  {
+    posix_fadvise(fd, off_t(offset), off_t(length), POSIX_FADV_DONTNEED);
+    return;
+  }
+  const uint64_t pageSize = uint64_t(sysconf(_SC_PAGESIZE));
+  const uint64_t first = offset - offset % pageSize;
+  const std::size_t numPages = std::size_t((offset + length - first + pageSize - 1) / pageSize);
+  // pages beyond the snapshot count as not cached
+  auto wasCached = [&cachedBefore](std::size_t page) {
+    return page < cachedBefore.size() && (cachedBefore[page] & 1) != 0;
+  };
+  // drop each run of previously uncached pages with a single call
+  std::size_t i = 0;
+  while (i < numPages)
+  {
+    if (wasCached(i))
+    {
+      ++i;
+      continue;
+    }
+    std::size_t j = i;
+    while (j < numPages && !wasCached(j))
+    {
+      ++j;
+    }
+    posix_fadvise(fd, off_t(first + i * pageSize), off_t((j - i) * pageSize), POSIX_FADV_DONTNEED);
+    i = j;
+  }
+#else
+  (void)fd;
+  (void)offset;
+  (void)length;
+  (void)cachedBefore;
+#endif
+}
+
+void dropWrittenPages(int fd, uint64_t offset, uint64_t length)
+{
+  if (!cacheNeutral || fd < 0)
+    return;
+  // dirty pages cannot be dropped, so they have to reach the disk first
+#if defined(SYNC_FILE_RANGE_WRITE)
+  sync_file_range(fd, off_t(offset), off_t(length), SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+  fdatasync(fd);
+#endif
+  dropReadPages(fd, offset, length);
+}
+
+} // namespace pwned
@@ -0,0 +1,52 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __pagecache_hpp__
+#define __pagecache_hpp__
+
+#include <vector>
+#include <cstdint>
+
+namespace pwned
+{
+
+/**
+ * In cache-neutral mode the bulk readers and writers drop the pages they
+ * have streamed through from the page cache, so that a batch job running
+ * next to `pwned-server` does not evict the pages of the served file.
+ * Pages that were already cached before a read stay cached, which matters
+ * if the served file itself is read, e.g. as the base of a delta merge.
+ * Disabled by default.
+ */
+void setCacheNeutralIO(bool enabled);
+bool cacheNeutralIO();
+
+// returns which pages of the range [offset, offset + length) of `fd` are cached,
+// one byte per page from the page containing `offset` on; empty if not in cache-neutral mode
+std::vector<unsigned char> cachedPages(int fd, uint64_t offset, uint64_t length);
+
+// drops the pages of the already read range [offset, offset + length) of `fd`
+// that were not cached according to `cachedBefore` (if given), a `length` of 0
+// means up to the end of the file
+void dropReadPages(int fd, uint64_t offset, uint64_t length, const std::vector<unsigned char> &cachedBefore = {});
+
+// writes back the range [offset, offset + length) of `fd` and drops it from the page cache
+void dropWrittenPages(int fd, uint64_t offset, uint64_t length);
+
+} // namespace pwned
+
+#endif // __pagecache_hpp__
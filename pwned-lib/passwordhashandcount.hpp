@@ -20,6 +20,7 @@
 
 #include <fstream>
 #include <cstdint>
+#include <cstring>
 
 #include "hash.hpp"
 
@@ -60,6 +61,18 @@ public:
     f.write((char *)hash.data, Hash::size);
     f.write((char *)&count, sizeof(count));
   }
+
+  inline void serialize(char *dst) const
+  {
+    std::memcpy(dst, hash.data, Hash::size);
+    std::memcpy(dst + Hash::size, &count, sizeof(count));
+  }
+
+  inline void deserialize(const char *src)
+  {
+    std::memcpy(hash.data, src, Hash::size);
+    std::memcpy(&count, src + Hash::size, sizeof(count));
+  }
 };
 
 inline bool operator==(const PasswordHashAndCount &lhs, const PasswordHashAndCount &rhs)
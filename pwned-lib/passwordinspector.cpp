@@ -77,32 +77,36 @@ bool PasswordInspector::isOpen() const
   return mInputFile.is_open();
 }
 
+void PasswordInspector::indexRange(const Hash &hash, std::streamoff &lo, std::streamoff &hi, int &nReads)
+{
+  if (!mIndexFile.is_open())
+    return;
+  const uint64_t hashMSB = hash.quad.upper >> mShift;
+  const std::streamoff idx = (std::streamoff)(hashMSB * sizeof(index_key_t));
+  std::streamoff loIdx = idx;
+  do {
+    mIndexFile.seekg(loIdx);
+    mIndexFile.read(reinterpret_cast<char*>(&lo), sizeof(index_key_t));
+    ++nReads;
+    loIdx -= sizeof(index_key_t);
+  }
+  while (lo == int64_t(std::numeric_limits<index_key_t>::max()));
+  std::streamoff hiIdx = idx + (std::streamoff)sizeof(index_key_t);
+  do {
+    mIndexFile.seekg(hiIdx);
+    mIndexFile.read(reinterpret_cast<char*>(&hi), sizeof(index_key_t));
+    ++nReads;
+    hiIdx += sizeof(index_key_t);
+  }
+  while (hi == int64_t(std::numeric_limits<index_key_t>::max()));
+}
+
 PasswordHashAndCount PasswordInspector::binsearch(const Hash &hash, int *readCount)
 {
   int nReads = 0;
   std::streamoff lo = 0;
   std::streamoff hi = mFileSize;
-  if (mIndexFile.is_open())
-  {
-    const uint64_t hashMSB = hash.quad.upper >> mShift;
-    const std::streamoff idx = (std::streamoff)(hashMSB * sizeof(index_key_t));
-    std::streamoff loIdx = idx;
-    do {
-      mIndexFile.seekg(loIdx);
-      mIndexFile.read(reinterpret_cast<char*>(&lo), sizeof(index_key_t));
-      ++nReads;
-      loIdx -= sizeof(index_key_t);
-    }
-    while (lo == int64_t(std::numeric_limits<index_key_t>::max()));
-    std::streamoff hiIdx = idx + (std::streamoff)sizeof(index_key_t);
-    do {
-      mIndexFile.seekg(hiIdx);
-      mIndexFile.read(reinterpret_cast<char*>(&hi), sizeof(index_key_t));
-      ++nReads;
-      hiIdx += sizeof(index_key_t);
-    }
-    while (hi == int64_t(std::numeric_limits<index_key_t>::max()));
-  }
+  indexRange(hash, lo, hi, nReads);
   PasswordHashAndCount phc;
   while (lo <= hi)
   {
@@ -169,6 +173,94 @@ PasswordHashAndCount PasswordInspector::smart_binsearch(const Hash &hash, int *r
   return phc;
 }
 
+std::vector<uint32_t> PasswordInspector::lookupBatch(const std::vector<Hash> &hashes, int *readCount)
+{
+  static constexpr std::streamoff RecordSize = (std::streamoff)PasswordHashAndCount::size;
+  std::vector<uint32_t> counts(hashes.size(), 0);
+  std::vector<std::size_t> order(hashes.size());
+  for (std::size_t i = 0; i < order.size(); ++i)
+  {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&hashes](std::size_t a, std::size_t b) {
+    return hashes[a] < hashes[b];
+  });
+  const std::streamoff numRecords = mFileSize / RecordSize;
+  int nReads = 0;
+  PasswordHashAndCount phc;
+  std::streamoff phcPos = -1;
+  auto readRecord = [this, &phc, &phcPos, &nReads](std::streamoff pos) {
+    if (pos != phcPos)
+    {
+      phc.read(mInputFile, pos * RecordSize);
+      phcPos = pos;
+      ++nReads;
+    }
+  };
+  // all records before `first` are less than the current hash
+  std::streamoff first = 0;
+  const Hash *prev = nullptr;
+  uint32_t prevCount = 0;
+  for (std::size_t i : order)
+  {
+    const Hash &hash = hashes[i];
+    if (!hash.isValid)
+      continue;
+    if (prev != nullptr && !(*prev < hash))
+    {
+      counts[i] = prevCount;
+      continue;
+    }
+    prev = &hash;
+    std::streamoff lo = 0;
+    std::streamoff hi = mFileSize;
+    indexRange(hash, lo, hi, nReads);
+    // lower bound of the hash in the records [a, b)
+    std::streamoff a = std::max(first, lo / RecordSize);
+    std::streamoff b = std::min(numRecords, hi / RecordSize + 1);
+    // gallop ahead from where the previous hash was found, which takes
+    // only a few reads if the hashes lie close together
+    for (std::streamoff step = 1; a < b; step *= 2)
+    {
+      const std::streamoff probe = std::min(a + step, b) - 1;
+      readRecord(probe);
+      if (!(phc.hash < hash))
+      {
+        b = probe;
+        break;
+      }
+      a = probe + 1;
+    }
+    while (a < b)
+    {
+      const std::streamoff mid = a + (b - a) / 2;
+      readRecord(mid);
+      if (phc.hash < hash)
+      {
+        a = mid + 1;
+      }
+      else
+      {
+        b = mid;
+      }
+    }
+    first = a;
+    prevCount = 0;
+    if (a < numRecords)
+    {
+      readRecord(a);
+      // not less, so it's a hit unless it's greater
+      if (!(hash < phc.hash))
+      {
+        prevCount = phc.count;
+      }
+    }
+    counts[i] = prevCount;
+  }
+  safe_assign(readCount, nReads);
+  return counts;
+}
+
 PasswordHashAndCount PasswordInspector::lookup(const std::string &pwd)
 {
   return binsearch(pwned::Hash(pwd));
@@ -20,6 +20,7 @@
 
 #include <fstream>
 #include <string>
+#include <vector>
 #include <cstdint>
 
 #include "passwordhashandcount.hpp"
@@ -36,6 +37,8 @@ private:
   unsigned int mShift{0};
   PasswordHashAndCount mPHC;
 
+  void indexRange(const Hash &hash, std::streamoff &lo, std::streamoff &hi, int &nReads);
+
 public:
   typedef uint64_t index_key_t;
   PasswordInspector(const std::string &inputFilename);
@@ -47,6 +50,9 @@ public:
   PasswordHashAndCount lookup(const std::string &pwd);
   PasswordHashAndCount binsearch(const Hash &hash, int *readCount = nullptr);
   PasswordHashAndCount smart_binsearch(const Hash &hash, int *readCount = nullptr);
+  // counts of `hashes`, in their order; the hashes are looked up in sorted
+  // order, so that each search starts where the previous one ended
+  std::vector<uint32_t> lookupBatch(const std::vector<Hash> &hashes, int *readCount = nullptr);
 };
 
 typedef PasswordInspector::index_key_t index_key_t;
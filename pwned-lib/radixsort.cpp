@@ -0,0 +1,150 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#include "radixsort.hpp"
+#include "threadpool.hpp"
+
+namespace pwned
+{
+
+namespace
+{
+
+constexpr unsigned int RadixBits = 12;
+constexpr std::size_t NumBuckets = std::size_t(1) << RadixBits;
+constexpr std::size_t MinRecordsPerThread = std::size_t(1) << 16;
+
+inline std::size_t bucketOf(const PasswordHashAndCount &phc)
+{
+  return std::size_t(phc.hash.quad.upper >> (64 - RadixBits));
+}
+
+// sorts [first, last) and collapses runs of equal hashes; returns the new end
+PasswordHashAndCount *sortAndMerge(PasswordHashAndCount *first, PasswordHashAndCount *last)
+{
+  if (first == last)
+    return last;
+  std::sort(first, last, PasswordHashAndCountLess());
+  PasswordHashAndCount *dst = first;
+  for (PasswordHashAndCount *src = first + 1; src != last; ++src)
+  {
+    if (src->hash.quad.upper == dst->hash.quad.upper && src->hash.quad.lower == dst->hash.quad.lower)
+    {
+      dst->count += src->count;
+    }
+    else
+    {
+      *++dst = *src;
+    }
+  }
+  return dst + 1;
+}
+
+// runs fn(0) .. fn(numTasks - 1) on the thread pool, fn(0) in the calling thread
+template <typename F>
+void parallelFor(unsigned int numTasks, F &&fn)
+{
+  TaskGroup tasks;
+  for (unsigned int t = 1; t < numTasks; ++t)
+  {
+    tasks.run([&fn, t] { fn(t); });
+  }
+  fn(0U);
+  tasks.wait();
+}
+
+} // namespace
+
+void radixSortAndMerge(std::vector<PasswordHashAndCount> &records, unsigned int numThreads)
+{
+  const std::size_t n = records.size();
+  if (n < MinRecordsPerThread)
+  {
+    records.resize(std::size_t(sortAndMerge(records.data(), records.data() + n) - records.data()));
+    return;
+  }
+  const unsigned int T = (unsigned int)std::max<std::size_t>(1, std::min<std::size_t>(numThreads, n / MinRecordsPerThread));
+  auto sliceBegin = [n, T](unsigned int t) { return n * t / T; };
+
+  // 1st pass: count records per bucket in every slice
+  std::vector<std::size_t> offsets(T * NumBuckets, 0);
+  parallelFor(T, [&](unsigned int t) {
+    std::size_t *const hist = offsets.data() + t * NumBuckets;
+    for (std::size_t i = sliceBegin(t); i < sliceBegin(t + 1); ++i)
+    {
+      ++hist[bucketOf(records[i])];
+    }
+  });
+
+  // turn counts into the positions where each slice writes its part of a bucket
+  std::vector<std::size_t> bucketBegin(NumBuckets + 1);
+  std::size_t pos = 0;
+  for (std::size_t b = 0; b < NumBuckets; ++b)
+  {
+    bucketBegin[b] = pos;
+    for (unsigned int t = 0; t < T; ++t)
+    {
+      const std::size_t count = offsets[t * NumBuckets + b];
+      offsets[t * NumBuckets + b] = pos;
+      pos += count;
+    }
+  }
+  bucketBegin[NumBuckets] = pos;
+
+  // 2nd pass: scatter
+  std::vector<PasswordHashAndCount> scratch(n);
+  parallelFor(T, [&](unsigned int t) {
+    std::size_t *const dst = offsets.data() + t * NumBuckets;
+    for (std::size_t i = sliceBegin(t); i < sliceBegin(t + 1); ++i)
+    {
+      scratch[dst[bucketOf(records[i])]++] = records[i];
+    }
+  });
+
+  // sort and merge the buckets, handing them out to the threads one by one
+  std::vector<std::size_t> bucketSize(NumBuckets);
+  std::atomic<std::size_t> nextBucket{0};
+  parallelFor(T, [&](unsigned int) {
+    for (std::size_t b = nextBucket++; b < NumBuckets; b = nextBucket++)
+    {
+      PasswordHashAndCount *const first = scratch.data() + bucketBegin[b];
+      bucketSize[b] = std::size_t(sortAndMerge(first, scratch.data() + bucketBegin[b + 1]) - first);
+    }
+  });
+
+  // compact the merged buckets back into `records`
+  std::vector<std::size_t> dstBegin(NumBuckets + 1);
+  dstBegin[0] = 0;
+  for (std::size_t b = 0; b < NumBuckets; ++b)
+  {
+    dstBegin[b + 1] = dstBegin[b] + bucketSize[b];
+  }
+  nextBucket = 0;
+  parallelFor(T, [&](unsigned int) {
+    for (std::size_t b = nextBucket++; b < NumBuckets; b = nextBucket++)
+    {
+      std::copy_n(scratch.data() + bucketBegin[b], bucketSize[b], records.data() + dstBegin[b]);
+    }
+  });
+  records.resize(dstBegin[NumBuckets]);
+}
+
+} // namespace pwned
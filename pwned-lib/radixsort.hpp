@@ -0,0 +1,42 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __radixsort_hpp__
+#define __radixsort_hpp__
+
+#include <vector>
+
+#include "passwordhashandcount.hpp"
+
+namespace pwned
+{
+
+/**
+ * Sorts `records` by hash and merges records with equal hashes into one by
+ * summing up their counts.
+ *
+ * The records are first scattered into 4096 buckets by the 12 most significant
+ * bits of `hash.quad.upper`, then each bucket is sorted on its own. Because MD5
+ * hashes are uniformly distributed the buckets are of about equal size, so both
+ * phases can be split evenly into `numThreads` tasks, which run on the
+ * shared ThreadPool.
+ */
+void radixSortAndMerge(std::vector<PasswordHashAndCount> &records, unsigned int numThreads = 1);
+
+} // namespace pwned
+
+#endif // __radixsort_hpp__
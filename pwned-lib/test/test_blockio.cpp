@@ -0,0 +1,344 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE test blockio
+#define BOOST_TEST_MODULE_BLOCKIO
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include "pwned-lib/blockio.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+std::vector<pwned::PasswordHashAndCount> makeRecords(std::size_t n)
+{
+  std::vector<pwned::PasswordHashAndCount> records;
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    records.emplace_back(pwned::Hash(uint64_t(i) * 0x9e3779b97f4a7c15ULL, ~uint64_t(i)), uint32_t(i));
+  }
+  return records;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(test_blockio)
+
+BOOST_AUTO_TEST_CASE(test_blockio_missing_file)
+{
+  pwned::BlockReader reader("/nonexistent/file.md5");
+  BOOST_TEST(reader.isOpen() == false);
+  pwned::PasswordHashAndCount phc;
+  BOOST_TEST(reader.read(phc) == false);
+  pwned::BlockWriter writer("/nonexistent/file.md5", 4 * pwned::PasswordHashAndCount::size);
+  BOOST_TEST(writer.isOpen() == false);
+  for (const auto &record : makeRecords(10))
+  {
+    writer.write(record);
+  }
+  BOOST_TEST(writer.close() == false);
+}
+
+BOOST_AUTO_TEST_CASE(test_blockio_roundtrip)
+{
+  const fs::path path = fs::temp_directory_path() / fs::unique_path("pwned-test-%%%%-%%%%.md5");
+  for (std::size_t n : {0, 1, 4, 5, 1000, 12345})
+  {
+    const std::vector<pwned::PasswordHashAndCount> &records = makeRecords(n);
+    {
+      // 100 bytes are rounded down to 5 records per block
+      pwned::BlockWriter writer(path.string(), 100, 1);
+      BOOST_TEST(writer.isOpen());
+      for (const auto &phc : records)
+      {
+        writer.write(phc);
+      }
+      BOOST_TEST(writer.close());
+    }
+    BOOST_TEST(fs::file_size(path) == n * pwned::PasswordHashAndCount::size);
+    for (std::size_t blockSize : {20, 100, 4096, 1 << 20})
+    {
+      pwned::BlockReader reader(path.string(), blockSize, blockSize % 3);
+      BOOST_TEST(reader.isOpen());
+      pwned::PasswordHashAndCount phc;
+      std::size_t i = 0;
+      while (reader.read(phc))
+      {
+        BOOST_TEST(phc.hash.quad.upper == records[i].hash.quad.upper);
+        BOOST_TEST(phc.hash.quad.lower == records[i].hash.quad.lower);
+        BOOST_TEST(phc.count == records[i].count);
+        ++i;
+      }
+      BOOST_TEST(i == n);
+    }
+  }
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(test_blockio_packed_roundtrip)
+{
+  const fs::path path = fs::temp_directory_path() / fs::unique_path("pwned-test-%%%%-%%%%.md5");
+  for (std::size_t n : {0, 1, 4, 5, 1000, 12345})
+  {
+    // unsorted hashes and counts of 0 and above 7 take the long ways
+    const std::vector<pwned::PasswordHashAndCount> &records = makeRecords(n);
+    {
+      pwned::BlockWriter writer(path.string(), 100, 1, pwned::RecordFormat::packed);
+      BOOST_TEST(writer.isOpen());
+      for (const auto &phc : records)
+      {
+        writer.write(phc);
+      }
+      BOOST_TEST(writer.close());
+    }
+    BOOST_TEST(pwned::BlockReader::isPacked(path.string()));
+    BOOST_TEST(pwned::BlockReader::recordCount(path.string()) == n);
+    for (std::size_t queueDepth : {0, 2})
+    {
+      pwned::BlockReader reader(path.string(), pwned::BlockReader::DefaultBlockSize, queueDepth);
+      pwned::PasswordHashAndCount phc;
+      std::size_t i = 0;
+      while (reader.read(phc))
+      {
+        BOOST_TEST(phc.hash.quad.upper == records[i].hash.quad.upper);
+        BOOST_TEST(phc.hash.quad.lower == records[i].hash.quad.lower);
+        BOOST_TEST(phc.count == records[i].count);
+        ++i;
+      }
+      BOOST_TEST(i == n);
+      BOOST_TEST(reader.failed() == false);
+    }
+  }
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(test_blockio_packed_sorted)
+{
+  const fs::path path = fs::temp_directory_path() / fs::unique_path("pwned-test-%%%%-%%%%.md5");
+  const std::size_t n = 100000;
+  std::vector<pwned::PasswordHashAndCount> records;
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    records.emplace_back(pwned::Hash(std::to_string(i)), 1U + uint32_t(i % 3));
+  }
+  std::sort(records.begin(), records.end(), [](const pwned::PasswordHashAndCount &a, const pwned::PasswordHashAndCount &b) {
+    return a.hash.quad.upper < b.hash.quad.upper || (a.hash.quad.upper == b.hash.quad.upper && a.hash.quad.lower < b.hash.quad.lower);
+  });
+  {
+    pwned::BlockWriter writer(path.string(), pwned::BlockWriter::DefaultBlockSize, 2, pwned::RecordFormat::packed);
+    for (const auto &phc : records)
+    {
+      writer.write(phc);
+    }
+    BOOST_TEST(writer.close());
+  }
+  // sorted hashes leave about 14 significant bytes of 16
+  BOOST_TEST(fs::file_size(path) < n * 16);
+  pwned::BlockReader reader(path.string());
+  pwned::PasswordHashAndCount phc;
+  std::size_t i = 0;
+  while (reader.read(phc) && i < n)
+  {
+    BOOST_TEST(phc.hash.quad.upper == records[i].hash.quad.upper);
+    BOOST_TEST(phc.hash.quad.lower == records[i].hash.quad.lower);
+    BOOST_TEST(phc.count == records[i].count);
+    ++i;
+  }
+  BOOST_TEST(i == n);
+  // raw files are reported by their size
+  {
+    pwned::BlockWriter writer(path.string());
+    writer.write(records.front());
+    BOOST_TEST(writer.close());
+  }
+  BOOST_TEST(pwned::BlockReader::isPacked(path.string()) == false);
+  BOOST_TEST(pwned::BlockReader::recordCount(path.string()) == 1U);
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(test_blockio_sync_and_resume)
+{
+  const fs::path path = fs::temp_directory_path() / fs::unique_path("pwned-test-%%%%-%%%%.md5");
+  const std::vector<pwned::PasswordHashAndCount> &records = makeRecords(1000);
+  for (pwned::RecordFormat format : {pwned::RecordFormat::raw, pwned::RecordFormat::packed})
+  {
+    uint64_t position = 0;
+    uint64_t synced = 0;
+    {
+      pwned::BlockWriter writer(path.string(), 100, 1, format);
+      for (std::size_t i = 0; i < 600; ++i)
+      {
+        writer.write(records[i]);
+        if (i == 432)
+        {
+          BOOST_TEST(writer.sync());
+          position = writer.position();
+          synced = writer.records();
+        }
+      }
+      // whatever follows the sync is discarded when resuming
+      BOOST_TEST(writer.close());
+    }
+    BOOST_TEST(synced == 433U);
+    {
+      pwned::BlockWriter writer(path.string(), format, position, synced, 100, 1);
+      BOOST_TEST(writer.isOpen());
+      for (std::size_t i = std::size_t(synced); i < records.size(); ++i)
+      {
+        writer.write(records[i]);
+      }
+      BOOST_TEST(writer.close());
+    }
+    BOOST_TEST(pwned::BlockReader::recordCount(path.string()) == records.size());
+    pwned::BlockReader reader(path.string());
+    pwned::PasswordHashAndCount phc;
+    std::size_t i = 0;
+    while (reader.read(phc) && i < records.size())
+    {
+      BOOST_TEST(phc.hash.quad.upper == records[i].hash.quad.upper);
+      BOOST_TEST(phc.count == records[i].count);
+      ++i;
+    }
+    BOOST_TEST(i == records.size());
+  }
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(test_blockio_ranges)
+{
+  const fs::path path = fs::temp_directory_path() / fs::unique_path("pwned-test-%%%%-%%%%.md5");
+  const std::vector<pwned::PasswordHashAndCount> &records = makeRecords(1000);
+  {
+    pwned::BlockWriter writer(path.string(), 4096);
+    for (std::size_t i = 0; i < 400; ++i)
+    {
+      writer.write(records[i]);
+    }
+    BOOST_TEST(writer.close());
+  }
+  {
+    // fill the rest of the file in two independent regions
+    const int fd = ::open(path.string().c_str(), O_WRONLY);
+    pwned::BlockWriter upper(fd, 700 * pwned::PasswordHashAndCount::size, 100);
+    pwned::BlockWriter middle(fd, 400 * pwned::PasswordHashAndCount::size, 100);
+    for (std::size_t i = 700; i < 1000; ++i)
+    {
+      upper.write(records[i]);
+    }
+    for (std::size_t i = 400; i < 700; ++i)
+    {
+      middle.write(records[i]);
+    }
+    BOOST_TEST(upper.close());
+    BOOST_TEST(middle.close());
+    ::close(fd);
+  }
+  for (std::size_t queueDepth : {0, 2})
+  {
+    pwned::BlockReader reader(path.string(), 123 * pwned::PasswordHashAndCount::size, 456 * pwned::PasswordHashAndCount::size, 4096, queueDepth);
+    pwned::PasswordHashAndCount phc;
+    std::size_t i = 123;
+    while (reader.read(phc))
+    {
+      BOOST_TEST(phc.hash.quad.upper == records[i].hash.quad.upper);
+      BOOST_TEST(phc.count == records[i].count);
+      ++i;
+    }
+    BOOST_TEST(i == 123 + 456);
+    BOOST_TEST(reader.failed() == false);
+  }
+  for (std::size_t queueDepth : {0, 2})
+  {
+    // the range reaches beyond the end of the file
+    pwned::BlockReader reader(path.string(), 900 * pwned::PasswordHashAndCount::size, 200 * pwned::PasswordHashAndCount::size, 4096, queueDepth);
+    pwned::PasswordHashAndCount phc;
+    std::size_t n = 0;
+    while (reader.read(phc))
+    {
+      ++n;
+    }
+    BOOST_TEST(n == 100U);
+    BOOST_TEST(reader.failed());
+  }
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(test_blockio_packed_truncated)
+{
+  const fs::path path = fs::temp_directory_path() / fs::unique_path("pwned-test-%%%%-%%%%.md5");
+  {
+    pwned::BlockWriter writer(path.string(), 100, 1, pwned::RecordFormat::packed);
+    for (const auto &phc : makeRecords(1000))
+    {
+      writer.write(phc);
+    }
+    BOOST_TEST(writer.close());
+  }
+  const uintmax_t size = fs::file_size(path);
+  // cut in the middle of a frame, and right behind the header of the file,
+  // which looks like a file that ends between frames
+  for (uintmax_t cut : {size - 7, uintmax_t(16)})
+  {
+    fs::resize_file(path, cut);
+    for (std::size_t queueDepth : {0, 2})
+    {
+      pwned::BlockReader reader(path.string(), pwned::BlockReader::DefaultBlockSize, queueDepth);
+      pwned::PasswordHashAndCount phc;
+      std::size_t n = 0;
+      while (reader.read(phc))
+      {
+        ++n;
+      }
+      BOOST_TEST(n < 1000U);
+      BOOST_TEST(reader.failed());
+    }
+  }
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(test_blockio_truncated_record)
+{
+  const fs::path path = fs::temp_directory_path() / fs::unique_path("pwned-test-%%%%-%%%%.md5");
+  {
+    std::ofstream f(path.string(), std::ios::binary);
+    for (const auto &phc : makeRecords(3))
+    {
+      phc.dump(f);
+    }
+    f.write("tail", 4);
+  }
+  pwned::BlockReader reader(path.string(), 40);
+  pwned::PasswordHashAndCount phc;
+  BOOST_TEST(reader.read(phc));
+  BOOST_TEST(reader.read(phc));
+  BOOST_TEST(reader.read(phc));
+  BOOST_TEST(reader.read(phc) == false);
+  // a truncated last record is ignored, not an error
+  BOOST_TEST(reader.failed() == false);
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
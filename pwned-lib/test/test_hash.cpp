@@ -100,6 +100,9 @@ BOOST_AUTO_TEST_CASE(test_hash_fromhex)
   BOOST_TEST(pwned::Hash::fromHex("ffeeddccbbaa99887766554433221100").isValid == true);
   BOOST_TEST(pwned::Hash::fromHex("ffeeddccbbaa99887766554433221100").quad.upper == 0xffeeddccbbaa9988ULL);
   BOOST_TEST(pwned::Hash::fromHex("ffeeddccbbaa99887766554433221100").quad.lower == 0x7766554433221100ULL);
+  BOOST_TEST(pwned::Hash::fromHex("FFEEDDCCBBAA99887766554433221100").quad.upper == 0xffeeddccbbaa9988ULL);
+  BOOST_TEST(pwned::Hash::fromHex("ffeeddccbbaa9988776655443322110g").isValid == false);
+  BOOST_TEST(pwned::Hash::fromHex("ffeeddccbbaa9988x766554433221100").isValid == false);
 }
 
 BOOST_AUTO_TEST_CASE(test_hash_outputop)
@@ -0,0 +1,169 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE test hotkeytable
+#define BOOST_TEST_MODULE_HOTKEYTABLE
+
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "pwned-lib/hotkeytable.hpp"
+
+namespace
+{
+
+// a well mixed, distinct hash per `i`
+pwned::Hash hashOf(uint64_t i)
+{
+  auto mix = [](uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  };
+  return pwned::Hash(mix(i * 0x9e3779b97f4a7c15ULL + 1), mix(i));
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(test_hotkeytable)
+
+BOOST_AUTO_TEST_CASE(test_hotkeytable_threshold)
+{
+  pwned::HotKeyTable table(100, 3);
+  const pwned::Hash hash("123456");
+  BOOST_TEST(table.absorb(hash) == false);
+  BOOST_TEST(table.absorb(hash) == false);
+  BOOST_TEST(table.absorb(hash) == true);
+  BOOST_TEST(table.absorb(hash) == true);
+  BOOST_TEST(table.size() == 1);
+  const std::vector<pwned::PasswordHashAndCount> &run = table.drain();
+  BOOST_TEST(run.size() == 1);
+  BOOST_TEST(run.front().count == 2);
+  BOOST_TEST(table.size() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_hotkeytable_counts_are_preserved)
+{
+  static constexpr unsigned int NumThreads = 4;
+  static constexpr int PerThread = 50000;
+  pwned::HotKeyTable table(1000);
+  std::vector<std::map<pwned::Hash, uint32_t, pwned::HashLess>> passedThrough(NumThreads);
+  std::vector<std::thread> threads;
+  for (unsigned int t = 0; t < NumThreads; ++t)
+  {
+    threads.emplace_back([&table, &passedThrough, t] {
+      std::mt19937 gen(t);
+      std::geometric_distribution<int> dist(0.001);
+      for (int i = 0; i < PerThread; ++i)
+      {
+        const pwned::Hash hash(std::to_string(dist(gen)));
+        if (!table.absorb(hash))
+        {
+          passedThrough[t][hash] += 1;
+        }
+      }
+    });
+  }
+  for (auto &th : threads)
+  {
+    th.join();
+  }
+  std::map<pwned::Hash, uint32_t, pwned::HashLess> total;
+  for (const auto &m : passedThrough)
+  {
+    for (const auto &entry : m)
+    {
+      total[entry.first] += entry.second;
+    }
+  }
+  uint64_t absorbed = 0;
+  const std::vector<pwned::PasswordHashAndCount> &run = table.drain();
+  BOOST_TEST(run.size() <= 1000 + (1U << pwned::HotKeyTable::ShardBits));
+  for (std::size_t i = 0; i < run.size(); ++i)
+  {
+    if (i > 0)
+    {
+      BOOST_TEST(run[i - 1].hash < run[i].hash);
+    }
+    total[run[i].hash] += run[i].count;
+    absorbed += run[i].count;
+  }
+  uint64_t sum = 0;
+  for (const auto &entry : total)
+  {
+    sum += entry.second;
+  }
+  BOOST_TEST(sum == uint64_t(NumThreads) * PerThread);
+  // the most frequent passwords of a skewed distribution must be caught
+  BOOST_TEST(absorbed > uint64_t(NumThreads) * PerThread / 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_hotkeytable_hot_keys_win_over_early_cold_ones)
+{
+  static constexpr uint64_t NumCold = 400000;
+  static constexpr uint64_t NumHot = 100;
+  static constexpr uint32_t Rounds = 100;
+  // a small sketch stands in for a multi-GB input
+  pwned::HotKeyTable table(4096, pwned::HotKeyTable::DefaultThreshold, 12);
+  // many more hashes than the sketch has cells, each of them seen once,
+  // used to fill the sketch up, so that all later hashes were admitted
+  for (uint64_t i = 0; i < NumCold; ++i)
+  {
+    table.absorb(hashOf(i));
+  }
+  for (uint32_t round = 0; round < Rounds; ++round)
+  {
+    for (uint64_t i = 0; i < NumHot; ++i)
+    {
+      table.absorb(hashOf(NumCold + i));
+      table.absorb(hashOf(NumCold + NumHot + round * NumHot + i));
+    }
+  }
+  std::size_t hot = 0;
+  std::size_t cold = 0;
+  std::map<pwned::Hash, uint32_t, pwned::HashLess> hotCounts;
+  for (uint64_t i = 0; i < NumHot; ++i)
+  {
+    hotCounts[hashOf(NumCold + i)] = 0;
+  }
+  for (const auto &phc : table.drain())
+  {
+    auto it = hotCounts.find(phc.hash);
+    if (it != hotCounts.end())
+    {
+      it->second = phc.count;
+      ++hot;
+    }
+    else
+    {
+      ++cold;
+    }
+  }
+  BOOST_TEST(hot == NumHot);
+  BOOST_TEST(cold == 0U);
+  for (const auto &entry : hotCounts)
+  {
+    // all but the occurrences needed for admission are counted; aging the
+    // sketch may take a few more of them
+    BOOST_TEST(entry.second >= Rounds - 2 * pwned::HotKeyTable::DefaultThreshold);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
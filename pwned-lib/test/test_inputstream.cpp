@@ -0,0 +1,164 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE test inputstream
+#define BOOST_TEST_MODULE_INPUTSTREAM
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/lzma.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+#include "pwned-lib/inputstream.hpp"
+#include "pwned-lib/userpasswordreader.hpp"
+
+namespace bio = boost::iostreams;
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+std::string makeContents()
+{
+  std::ostringstream contents;
+  for (int i = 0; i < 20000; ++i)
+  {
+    contents << "user" << i << "@example.com:password" << i << "\n";
+  }
+  return contents.str();
+}
+
+template <typename Compressor>
+fs::path writeCompressed(const std::string &contents, const std::string &ext, Compressor compressor)
+{
+  const fs::path path = fs::temp_directory_path() / fs::unique_path("pwned-test-%%%%-%%%%.txt" + ext);
+  std::ofstream file(path.string(), std::ios::binary);
+  bio::filtering_ostream out;
+  out.push(compressor);
+  out.push(file);
+  out << contents;
+  return path;
+}
+
+std::string slurp(std::istream &in)
+{
+  std::ostringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(test_inputstream)
+
+BOOST_AUTO_TEST_CASE(test_inputstream_filenames)
+{
+  BOOST_TEST(pwned::InputStream::isSupported("leak.txt"));
+  BOOST_TEST(pwned::InputStream::isSupported("leak.txt.gz"));
+  BOOST_TEST(pwned::InputStream::isSupported("leak.txt.zst"));
+  BOOST_TEST(pwned::InputStream::isSupported("leak.zip"));
+  BOOST_TEST(pwned::InputStream::isSupported("leak.7z"));
+  BOOST_TEST(!pwned::InputStream::isSupported("leak.md5"));
+  BOOST_TEST(!pwned::InputStream::isSupported("leak.tar.gz"));
+  BOOST_TEST(pwned::InputStream::stem("dir/leak.txt") == "leak");
+  BOOST_TEST(pwned::InputStream::stem("dir/leak.txt.bz2") == "leak");
+  BOOST_TEST(pwned::InputStream::stem("leak.zip") == "leak");
+  BOOST_TEST(pwned::InputStream::stem("-") == "stdin");
+}
+
+BOOST_AUTO_TEST_CASE(test_inputstream_missing_file)
+{
+  pwned::InputStream in("/nonexistent/leak.txt.gz");
+  BOOST_TEST(in.isOpen() == false);
+  BOOST_TEST(in.bad());
+}
+
+BOOST_AUTO_TEST_CASE(test_inputstream_decompress)
+{
+  const std::string contents = makeContents();
+  const std::vector<fs::path> paths{
+      writeCompressed(contents, "", bio::zlib_compressor()),
+      writeCompressed(contents, ".gz", bio::gzip_compressor()),
+      writeCompressed(contents, ".bz2", bio::bzip2_compressor()),
+      writeCompressed(contents, ".xz", bio::lzma_compressor()),
+      writeCompressed(contents, ".zst", bio::zstd_compressor())};
+  // the first file is plain text despite the compressor
+  {
+    std::ofstream plain(paths.front().string(), std::ios::binary | std::ios::trunc);
+    plain << contents;
+  }
+  for (const auto &path : paths)
+  {
+    {
+      pwned::InputStream in(path.string(), 4096, 2);
+      BOOST_TEST(in.isOpen());
+      BOOST_TEST(slurp(in) == contents, path.string());
+    }
+    {
+      pwned::InputStream in(path.string());
+      pwned::UserPasswordReader reader(in, {});
+      BOOST_TEST(reader.nextPassword() == "password0");
+      int n = 1;
+      while (!reader.eof())
+      {
+        reader.nextPasswordView();
+        ++n;
+      }
+      BOOST_TEST(n == 20000);
+    }
+    fs::remove(path);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_inputstream_early_close)
+{
+  const fs::path path = writeCompressed(makeContents(), ".gz", bio::gzip_compressor());
+  {
+    pwned::InputStream in(path.string(), 1024, 1);
+    char c;
+    in.get(c);
+    BOOST_TEST(c == 'u');
+  }
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(test_inputstream_failing_archiver)
+{
+  // unzip exits with an error, or isn't there at all
+  const fs::path path = fs::temp_directory_path() / fs::unique_path("pwned-test-%%%%-%%%%.zip");
+  {
+    std::ofstream file(path.string(), std::ios::binary);
+    file << makeContents();
+  }
+  {
+    pwned::InputStream in(path.string(), 1024, 1);
+    std::vector<char> buf(4096);
+    while (in.read(buf.data(), std::streamsize(buf.size())))
+    {
+    }
+    BOOST_TEST(in.bad());
+  }
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -24,6 +24,9 @@
 #include <sstream>
 #include <fstream>
 #include <cstring>
+#include <vector>
+#include <algorithm>
+#include <random>
 #include <boost/test/unit_test.hpp>
 #include <boost/filesystem.hpp>
 
@@ -76,4 +79,54 @@ BOOST_AUTO_TEST_CASE(test_nonexistent_default)
   BOOST_TEST(nNotFound == hashCount);
 }
 
+BOOST_AUTO_TEST_CASE(test_batch_default)
+{
+  const std::string inputFilename = "../../../../pwned-lib/test/testset-10000-existent-collection1+2+3+4+5.md5";
+  const std::string nonExistentInputFilename = "../../../../pwned-lib/test/testset-10000-nonexistent-collection1+2+3+4+5.md5";
+  std::vector<pwned::Hash> hashes;
+  std::vector<uint32_t> expected;
+  for (const std::string &filename : {inputFilename, nonExistentInputFilename})
+  {
+    std::ifstream testset(filename, std::ios::binary);
+    pwned::PHC phc;
+    while (phc.read(testset))
+    {
+      phc.hash.isValid = true;
+      hashes.push_back(phc.hash);
+      expected.push_back(filename == inputFilename ? phc.count : 0);
+    }
+  }
+  // duplicates and an invalid hash
+  hashes.push_back(hashes[42]);
+  expected.push_back(expected[42]);
+  hashes.push_back(pwned::Hash::fromHex("not a hash"));
+  expected.push_back(0);
+  std::vector<std::size_t> order(hashes.size());
+  for (std::size_t i = 0; i < order.size(); ++i)
+  {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), std::mt19937(4711));
+  std::vector<pwned::Hash> shuffledHashes;
+  std::vector<uint32_t> shuffledExpected;
+  for (std::size_t i : order)
+  {
+    shuffledHashes.push_back(hashes[i]);
+    shuffledExpected.push_back(expected[i]);
+  }
+  pwned::PasswordInspector inspector(inputFilename);
+  int readCount = 0;
+  const std::vector<uint32_t> &counts = inspector.lookupBatch(shuffledHashes, &readCount);
+  BOOST_TEST(counts == shuffledExpected, boost::test_tools::per_element());
+  int singleReadCount = 0;
+  for (const pwned::Hash &hash : shuffledHashes)
+  {
+    int n = 0;
+    inspector.binsearch(hash, &n);
+    singleReadCount += n;
+  }
+  BOOST_TEST(readCount < singleReadCount);
+  BOOST_TEST(inspector.lookupBatch({}).empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
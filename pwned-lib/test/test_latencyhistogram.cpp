@@ -0,0 +1,112 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE test latencyhistogram
+#define BOOST_TEST_MODULE_LATENCYHISTOGRAM
+
+#include <chrono>
+#include <thread>
+#include <boost/test/unit_test.hpp>
+#include "pwned-lib/latencyhistogram.hpp"
+
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_SUITE(test_latencyhistogram)
+
+BOOST_AUTO_TEST_CASE(test_latencyhistogram_buckets)
+{
+  using H = pwned::LatencyHistogram;
+  BOOST_TEST(H::BucketCount == 104U);
+  // one microsecond wide below 4 µs
+  BOOST_TEST(H::bucketIndex(0) == 0U);
+  BOOST_TEST(H::bucketIndex(3) == 3U);
+  BOOST_TEST(H::upperBound(0) == 1U);
+  BOOST_TEST(H::upperBound(3) == 4U);
+  // then four buckets per power of two
+  BOOST_TEST(H::bucketIndex(4) == 4U);
+  BOOST_TEST(H::bucketIndex(7) == 7U);
+  BOOST_TEST(H::bucketIndex(8) == 8U);
+  BOOST_TEST(H::bucketIndex(9) == 8U);
+  BOOST_TEST(H::bucketIndex(10) == 9U);
+  BOOST_TEST(H::upperBound(8) == 10U);
+  BOOST_TEST(H::bucketIndex(1000) == H::bucketIndex(1023));
+  BOOST_TEST(H::upperBound(H::bucketIndex(1023)) == 1024U);
+  BOOST_TEST(H::upperBound(H::BucketCount - 1) == uint64_t(1) << H::MaxValueBits);
+  BOOST_TEST(H::bucketIndex(uint64_t(1) << 40) == H::BucketCount - 1);
+  // every value lies in its bucket, which is at most a quarter of its lower bound wide
+  bool inBucket = true;
+  bool narrow = true;
+  for (uint64_t micros = 0; micros < (uint64_t(1) << 20); micros += 1 + micros / 64)
+  {
+    const unsigned int i = H::bucketIndex(micros);
+    const uint64_t lower = i > 0 ? H::upperBound(i - 1) : 0;
+    inBucket = inBucket && lower <= micros && micros < H::upperBound(i);
+    narrow = narrow && (lower < 4 || H::upperBound(i) - lower <= lower / 4);
+  }
+  BOOST_TEST(inBucket);
+  BOOST_TEST(narrow);
+}
+
+BOOST_AUTO_TEST_CASE(test_latencyhistogram_record)
+{
+  pwned::LatencyHistogram h;
+  h.record(500ns);
+  h.record(2us);
+  h.record(1500us);
+  h.record(1h);
+  h.record(-1ns);
+  BOOST_TEST(h.count() == 5U);
+  BOOST_TEST(h.bucket(0) == 2U);
+  BOOST_TEST(h.bucket(2) == 1U);
+  BOOST_TEST(h.bucket(pwned::LatencyHistogram::bucketIndex(1500)) == 1U);
+  BOOST_TEST(h.bucket(pwned::LatencyHistogram::BucketCount - 1) == 1U);
+  BOOST_TEST(h.sum().count() == (500ns + 2us + 1500us + 1h).count());
+}
+
+BOOST_AUTO_TEST_CASE(test_latencyhistogram_merge)
+{
+  // the recording threads keep their histograms to themselves
+  constexpr int N = 100000;
+  pwned::LatencyHistogram a;
+  pwned::LatencyHistogram b;
+  pwned::LatencyHistogram total;
+  std::thread ta([&a] {
+    for (int i = 0; i < N; ++i)
+    {
+      a.record(std::chrono::microseconds(i % 100));
+    }
+  });
+  std::thread tb([&b] {
+    for (int i = 0; i < N; ++i)
+    {
+      b.record(5ms);
+    }
+  });
+  // reading while they record sees part of the counts
+  pwned::LatencyHistogram partial;
+  partial.merge(a);
+  BOOST_TEST(partial.count() <= uint64_t(N));
+  ta.join();
+  tb.join();
+  total.merge(a);
+  total.merge(b);
+  BOOST_TEST(total.count() == 2U * N);
+  BOOST_TEST(total.bucket(pwned::LatencyHistogram::bucketIndex(5000)) == uint64_t(N));
+  BOOST_TEST(total.sum().count() == (a.sum() + b.sum()).count());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
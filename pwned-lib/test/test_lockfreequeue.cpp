@@ -0,0 +1,168 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE test lockfreequeue
+#define BOOST_TEST_MODULE_LOCKFREEQUEUE
+
+#include <atomic>
+#include <iterator>
+#include <thread>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "pwned-lib/lockfreequeue.hpp"
+
+namespace
+{
+
+constexpr int NumItems = 100000;
+
+// every producer pushes the numbers 1..NumItems; the consumers add them up
+template <typename Queue>
+void runProducersAndConsumers(Queue &queue, int numProducers, int numConsumers, std::size_t batchSize)
+{
+  std::atomic<long long> sum{0};
+  std::atomic<int> received{0};
+  const int total = numProducers * NumItems;
+  std::vector<std::thread> threads;
+  for (int p = 0; p < numProducers; ++p)
+  {
+    threads.emplace_back([&queue, batchSize] {
+      std::vector<int> batch;
+      for (int i = 1; i <= NumItems; ++i)
+      {
+        batch.push_back(i);
+        if (batch.size() == batchSize || i == NumItems)
+        {
+          queue.pushBatch(batch.begin(), batch.end());
+          batch.clear();
+        }
+      }
+    });
+  }
+  for (int c = 0; c < numConsumers; ++c)
+  {
+    threads.emplace_back([&queue, &sum, &received, total, batchSize] {
+      std::vector<int> batch(batchSize);
+      while (received < total)
+      {
+        const std::size_t n = queue.tryPopBatch(batch.begin(), batchSize);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+          sum += batch[i];
+        }
+        received += int(n);
+        if (n == 0)
+        {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto &thread : threads)
+  {
+    thread.join();
+  }
+  BOOST_TEST(received == total);
+  BOOST_TEST(sum == (long long)numProducers * NumItems * (NumItems + 1) / 2);
+  BOOST_TEST(queue.sizeApprox() == 0U);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(test_lockfreequeue)
+
+BOOST_AUTO_TEST_CASE(test_lockfreequeue_mpmc_fifo)
+{
+  pwned::MPMCQueue<int> queue(5);
+  // rounded up to a power of two
+  BOOST_TEST(queue.capacity() == 8U);
+  for (int i = 0; i < 8; ++i)
+  {
+    BOOST_TEST(queue.tryPush(int(i)));
+  }
+  BOOST_TEST(!queue.tryPush(8));
+  BOOST_TEST(queue.sizeApprox() == 8U);
+  int item = -1;
+  for (int i = 0; i < 8; ++i)
+  {
+    BOOST_TEST(queue.tryPop(item));
+    BOOST_TEST(item == i);
+  }
+  BOOST_TEST(!queue.tryPop(item));
+  // wraps around
+  std::vector<int> items{10, 11, 12, 13, 14, 15, 16, 17, 18, 19};
+  BOOST_TEST(queue.tryPushBatch(items.begin(), items.end()) == 8U);
+  std::vector<int> got;
+  BOOST_TEST(queue.tryPopBatch(std::back_inserter(got), 100) == 8U);
+  BOOST_TEST(got == std::vector<int>({10, 11, 12, 13, 14, 15, 16, 17}), boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(test_lockfreequeue_spsc_fifo)
+{
+  pwned::SPSCQueue<int> queue(4);
+  BOOST_TEST(queue.capacity() == 4U);
+  std::vector<int> items{1, 2, 3, 4, 5, 6};
+  BOOST_TEST(queue.tryPushBatch(items.begin(), items.end()) == 4U);
+  BOOST_TEST(!queue.tryPush(7));
+  std::vector<int> got;
+  BOOST_TEST(queue.tryPopBatch(std::back_inserter(got), 3) == 3U);
+  BOOST_TEST(queue.tryPushBatch(items.begin() + 4, items.end()) == 2U);
+  BOOST_TEST(queue.tryPopBatch(std::back_inserter(got), 10) == 3U);
+  BOOST_TEST(got == std::vector<int>({1, 2, 3, 4, 5, 6}), boost::test_tools::per_element());
+  int item = -1;
+  BOOST_TEST(!queue.tryPop(item));
+}
+
+BOOST_AUTO_TEST_CASE(test_lockfreequeue_mpmc_blocking)
+{
+  pwned::MPMCQueue<int, pwned::BlockingWait> queue(64);
+  runProducersAndConsumers(queue, 4, 4, 1);
+  runProducersAndConsumers(queue, 3, 2, 16);
+}
+
+BOOST_AUTO_TEST_CASE(test_lockfreequeue_mpmc_spinning)
+{
+  pwned::MPMCQueue<int, pwned::SpinWait> queue(64);
+  runProducersAndConsumers(queue, 2, 3, 8);
+}
+
+BOOST_AUTO_TEST_CASE(test_lockfreequeue_spsc_order)
+{
+  pwned::SPSCQueue<int> queue(16);
+  std::thread producer([&queue] {
+    for (int i = 0; i < NumItems; ++i)
+    {
+      queue.push(int(i));
+    }
+  });
+  bool inOrder = true;
+  int expected = 0;
+  std::vector<int> batch(7);
+  while (expected < NumItems)
+  {
+    const std::size_t n = queue.popBatch(batch.begin(), batch.size());
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      inOrder = inOrder && batch[i] == expected;
+      ++expected;
+    }
+  }
+  producer.join();
+  BOOST_TEST(inOrder);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
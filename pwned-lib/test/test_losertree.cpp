@@ -0,0 +1,112 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE test losertree
+#define BOOST_TEST_MODULE_LOSERTREE
+
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "pwned-lib/losertree.hpp"
+
+namespace
+{
+
+struct VectorSource
+{
+  pwned::PasswordHashAndCount phc;
+  std::vector<pwned::PasswordHashAndCount> records;
+  std::size_t pos{0};
+
+  bool read()
+  {
+    if (pos == records.size())
+      return false;
+    phc = records[pos++];
+    return true;
+  }
+};
+
+void checkMerge(std::size_t k, std::size_t maxRecords)
+{
+  std::mt19937_64 gen(k * 1000 + maxRecords);
+  std::uniform_int_distribution<std::size_t> sizeDist(0, maxRecords);
+  std::vector<VectorSource> sources(k);
+  std::vector<pwned::PasswordHashAndCount> expected;
+  for (auto &source : sources)
+  {
+    const std::size_t n = sizeDist(gen);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      // few distinct upper halves to exercise the comparison of the lower half
+      source.records.emplace_back(pwned::Hash(gen() & 0xf, gen()), uint32_t(i));
+    }
+    std::sort(source.records.begin(), source.records.end(), pwned::PasswordHashAndCountLess());
+    expected.insert(expected.end(), source.records.begin(), source.records.end());
+  }
+  std::sort(expected.begin(), expected.end(), pwned::PasswordHashAndCountLess());
+  std::vector<VectorSource *> pointers;
+  std::vector<bool> valid;
+  for (auto &source : sources)
+  {
+    pointers.push_back(&source);
+    valid.push_back(source.read());
+  }
+  pwned::LoserTree<VectorSource> tree(pointers, valid);
+  std::vector<pwned::PasswordHashAndCount> merged;
+  while (!tree.empty())
+  {
+    merged.push_back(tree.top()->phc);
+    tree.pop();
+  }
+  BOOST_TEST(merged.size() == expected.size());
+  for (std::size_t i = 0; i < merged.size() && i < expected.size(); ++i)
+  {
+    BOOST_TEST(merged[i].hash.quad.upper == expected[i].hash.quad.upper);
+    BOOST_TEST(merged[i].hash.quad.lower == expected[i].hash.quad.lower);
+  }
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(test_losertree)
+
+BOOST_AUTO_TEST_CASE(test_losertree_no_sources)
+{
+  pwned::LoserTree<VectorSource> tree(std::vector<VectorSource *>{});
+  BOOST_TEST(tree.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_losertree_single_source)
+{
+  checkMerge(1, 100);
+}
+
+BOOST_AUTO_TEST_CASE(test_losertree_odd_number_of_sources)
+{
+  checkMerge(3, 100);
+  checkMerge(17, 500);
+}
+
+BOOST_AUTO_TEST_CASE(test_losertree_many_sources)
+{
+  checkMerge(64, 1000);
+  checkMerge(200, 50);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,110 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE test mergeplan
+#define BOOST_TEST_MODULE_MERGEPLAN
+
+#include <algorithm>
+#include <set>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "pwned-lib/mergeplan.hpp"
+
+namespace
+{
+
+// checks that every run is consumed exactly once, only after it was
+// produced, and that no step exceeds the fan-in
+void checkTree(const pwned::MergePlan &plan, std::size_t n)
+{
+  std::set<std::size_t> available;
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    available.insert(i);
+  }
+  for (const auto &step : plan.steps())
+  {
+    BOOST_TEST(!step.inputs.empty());
+    BOOST_TEST(step.inputs.size() <= plan.fanIn());
+    for (std::size_t input : step.inputs)
+    {
+      BOOST_TEST(available.erase(input) == 1U);
+    }
+    available.insert(step.output);
+  }
+  BOOST_TEST(available.size() == 1U);
+  BOOST_TEST(*available.begin() == plan.steps().back().output);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(test_mergeplan)
+
+BOOST_AUTO_TEST_CASE(test_mergeplan_empty)
+{
+  pwned::MergePlan plan({}, 4);
+  BOOST_TEST(plan.steps().empty());
+  BOOST_TEST(plan.bytesWritten() == 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_mergeplan_single_pass)
+{
+  pwned::MergePlan plan({10, 20, 30}, 4);
+  BOOST_TEST(plan.steps().size() == 1U);
+  BOOST_TEST(plan.steps().front().size == 60U);
+  BOOST_TEST(plan.bytesRewritten() == 0U);
+  BOOST_TEST(plan.bytesWritten() == 60U);
+  checkTree(plan, 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_mergeplan_padding)
+{
+  // 6 runs with fan-in 3 need one padding run, so the first step
+  // merges the two smallest runs only
+  pwned::MergePlan plan({6, 5, 4, 3, 2, 1}, 3);
+  BOOST_TEST(plan.steps().size() == 3U);
+  BOOST_TEST(plan.steps()[0].inputs.size() == 2U);
+  BOOST_TEST(plan.steps()[0].size == 3U);
+  BOOST_TEST(plan.steps()[1].size == 3U + 3U + 4U);
+  BOOST_TEST(plan.bytesRewritten() == 13U);
+  BOOST_TEST(plan.bytesWritten() == 34U);
+  checkTree(plan, 6);
+}
+
+BOOST_AUTO_TEST_CASE(test_mergeplan_large_runs_last)
+{
+  std::vector<uint64_t> sizes(100, 1);
+  sizes[42] = 1000000;
+  pwned::MergePlan plan(sizes, 10);
+  checkTree(plan, sizes.size());
+  // the huge run is only read by the final step
+  const auto &last = plan.steps().back().inputs;
+  BOOST_TEST((std::find(last.begin(), last.end(), 42U) != last.end()));
+  // and every small run is rewritten at most twice
+  BOOST_TEST(plan.bytesRewritten() <= 2U * 99U);
+}
+
+BOOST_AUTO_TEST_CASE(test_mergeplan_max_fan_in)
+{
+  BOOST_TEST(pwned::MergePlan::maxFanIn(1024, 1ULL << 40, 1, 1, 1) == 1008U);
+  BOOST_TEST(pwned::MergePlan::maxFanIn(1024, 1ULL << 40, 4, 1, 2) == 126U);
+  BOOST_TEST(pwned::MergePlan::maxFanIn(1024, 100, 1, 10, 1) == 10U);
+  BOOST_TEST(pwned::MergePlan::maxFanIn(8, 0, 1, 10, 1) == 2U);
+  BOOST_TEST(pwned::MergePlan::openFileLimit() > 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
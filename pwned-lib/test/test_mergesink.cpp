@@ -0,0 +1,162 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE test mergesink
+#define BOOST_TEST_MODULE_MERGESINK
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include "pwned-lib/mergesink.hpp"
+#include "pwned-lib/radixsort.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+std::vector<pwned::PasswordHashAndCount> sortedRecords(std::size_t n)
+{
+  std::vector<pwned::PasswordHashAndCount> records;
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    records.emplace_back(pwned::Hash(std::to_string(i)), uint32_t(1 + i % 1000));
+  }
+  pwned::radixSortAndMerge(records);
+  return records;
+}
+
+std::string readFile(const fs::path &path)
+{
+  std::ifstream f(path.string(), std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+// feeds `records` to `whole` in one piece and to `split` in `numSections` forked sections
+void feed(pwned::MergeSink &whole, pwned::MergeSink &split, const std::vector<pwned::PasswordHashAndCount> &records, std::size_t numSections)
+{
+  whole.begin(records.size());
+  split.begin(records.size());
+  for (std::size_t i = 0; i < records.size(); ++i)
+  {
+    whole.consume(records[i], i);
+  }
+  std::vector<std::unique_ptr<pwned::MergeSink>> sections;
+  for (std::size_t s = 0; s < numSections; ++s)
+  {
+    sections.push_back(split.fork());
+  }
+  // fill the sections in reverse order to make sure only join() order matters
+  for (std::size_t s = numSections; s-- > 0;)
+  {
+    const std::size_t first = records.size() * s / numSections;
+    const std::size_t last = records.size() * (s + 1) / numSections;
+    for (std::size_t i = first; i < last; ++i)
+    {
+      sections[s]->consume(records[i], i);
+    }
+  }
+  for (auto &section : sections)
+  {
+    split.join(*section);
+  }
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(test_mergesink)
+
+BOOST_AUTO_TEST_CASE(test_mergesink_sections_equal_whole)
+{
+  const fs::path dir = fs::temp_directory_path() / fs::unique_path();
+  fs::create_directories(dir);
+  const std::vector<pwned::PasswordHashAndCount> &records = sortedRecords(20000);
+  std::vector<std::unique_ptr<pwned::MergeSink>> whole;
+  std::vector<std::unique_ptr<pwned::MergeSink>> split;
+  for (const std::string suffix : {"-whole", "-split"})
+  {
+    auto &sinks = suffix == std::string("-whole") ? whole : split;
+    sinks.emplace_back(new pwned::IndexSink((dir / ("index" + suffix)).string(), 12));
+    sinks.emplace_back(new pwned::BloomFilterSink((dir / ("bloom" + suffix)).string()));
+    sinks.emplace_back(new pwned::HistogramSink((dir / ("histogram" + suffix)).string()));
+    sinks.emplace_back(new pwned::ChecksumSink((dir / ("checksum" + suffix)).string()));
+  }
+  for (std::size_t i = 0; i < whole.size(); ++i)
+  {
+    feed(*whole[i], *split[i], records, 7);
+    BOOST_TEST(whole[i]->finish());
+    BOOST_TEST(split[i]->finish());
+    BOOST_TEST(readFile(whole[i]->filename()) == readFile(split[i]->filename()));
+  }
+  fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(test_mergesink_checksum)
+{
+  const std::vector<pwned::PasswordHashAndCount> &records = sortedRecords(1000);
+  std::string data(records.size() * pwned::PasswordHashAndCount::size, '\0');
+  pwned::ChecksumSink sink("unused");
+  for (std::size_t i = 0; i < records.size(); ++i)
+  {
+    records[i].serialize(&data[i * pwned::PasswordHashAndCount::size]);
+    sink.consume(records[i], i);
+  }
+  // CRC-32 as computed by zlib, gzip and others
+  uint32_t crc = 0xffffffffU;
+  for (unsigned char c : data)
+  {
+    crc ^= c;
+    for (int k = 0; k < 8; ++k)
+    {
+      crc = (crc >> 1) ^ (0xedb88320U & (0U - (crc & 1U)));
+    }
+  }
+  BOOST_TEST(sink.checksum() == (crc ^ 0xffffffffU));
+}
+
+BOOST_AUTO_TEST_CASE(test_mergesink_bloom_filter)
+{
+  const fs::path filename = fs::temp_directory_path() / fs::unique_path();
+  pwned::BloomFilter filter(10000);
+  for (int i = 0; i < 10000; ++i)
+  {
+    filter.add(pwned::Hash(std::to_string(i)));
+  }
+  BOOST_TEST(filter.save(filename.string()));
+  pwned::BloomFilter loaded;
+  BOOST_TEST(loaded.load(filename.string()));
+  BOOST_TEST(loaded.bitCount() == filter.bitCount());
+  BOOST_TEST(loaded.hashCount() == filter.hashCount());
+  int falsePositives = 0;
+  for (int i = 0; i < 10000; ++i)
+  {
+    BOOST_TEST(loaded.mayContain(pwned::Hash(std::to_string(i))));
+    if (loaded.mayContain(pwned::Hash("x" + std::to_string(i))))
+    {
+      ++falsePositives;
+    }
+  }
+  // about 1 % expected with 10 bits per hash
+  BOOST_TEST(falsePositives < 300);
+  fs::remove(filename);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,250 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE test operationqueue
+#define BOOST_TEST_MODULE_OPERATIONQUEUE
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+#include <boost/test/unit_test.hpp>
+#include "pwned-lib/threadpool.hpp"
+#include "pwned-lib/operation.hpp"
+#include "pwned-lib/operationqueue.hpp"
+#include "pwned-lib/operationexception.hpp"
+
+namespace
+{
+
+// keeps track of how many operations run at the same time
+struct Stats
+{
+  std::atomic<int> running{0};
+  std::atomic<int> maxRunning{0};
+  std::atomic<int> finished{0};
+};
+
+class MemoryOperation : public pwned::Operation
+{
+public:
+  MemoryOperation(Stats &stats, long long priority, uint64_t minimum, uint64_t wanted)
+      : stats(stats)
+  {
+    this->priority = priority;
+    setMemoryDemand(minimum, wanted);
+  }
+  void execute() override
+  {
+    granted = grantedMemory();
+    const int n = ++stats.running;
+    int max = stats.maxRunning;
+    while (n > max && !stats.maxRunning.compare_exchange_weak(max, n))
+    {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    --stats.running;
+    ++stats.finished;
+  }
+  uint64_t granted{0};
+
+private:
+  Stats &stats;
+};
+
+// asks for more memory once the other operations are done and have given
+// back theirs
+class GrowingOperation : public pwned::Operation
+{
+public:
+  GrowingOperation(Stats &stats, int others, uint64_t *grants)
+      : stats(stats)
+      , others(others)
+      , grants(grants)
+  {
+    priority = 10;
+    setMemoryDemand(10, 1000);
+  }
+  void execute() override
+  {
+    grants[0] = grantedMemory();
+    while (stats.finished < others || queue->memoryUsage() > grants[0])
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    grants[1] = requestMemory(wantedMemory());
+    grants[2] = requestMemory(20);
+  }
+
+private:
+  Stats &stats;
+  const int others;
+  uint64_t *grants;
+};
+
+// asks the queue for memory over and over, like the converters do for
+// every chunk, until it's cancelled
+class ChunkedOperation : public pwned::Operation
+{
+public:
+  ChunkedOperation(std::atomic<int> &requests)
+      : requests(requests)
+  {
+    setMemoryDemand(10, 20);
+  }
+  void execute() override
+  {
+    while (!isCancelled)
+    {
+      requestMemory(10 + uint64_t(requests++ % 2) * 10);
+    }
+  }
+
+private:
+  std::atomic<int> &requests;
+};
+
+// fails the way a sub-task or the operation itself may
+class FailingOperation : public pwned::Operation
+{
+public:
+  explicit FailingOperation(int how)
+      : how(how)
+  {
+  }
+  void execute() override
+  {
+    if (how == 1)
+      throw pwned::OperationException("failed", 1);
+    if (how == 2)
+      throw std::bad_alloc();
+  }
+
+private:
+  const int how;
+};
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(test_operationqueue)
+
+BOOST_AUTO_TEST_CASE(test_operationqueue_admits_within_budget)
+{
+  // every operation needs more than half of the budget
+  pwned::ThreadPool pool(4);
+  Stats stats;
+  pwned::OperationQueue<MemoryOperation> opQueue(4, pool);
+  opQueue.setMemoryBudget(100);
+  for (int i = 0; i < 6; ++i)
+  {
+    opQueue.add(new MemoryOperation(stats, i, 60, 60));
+  }
+  opQueue.execute();
+  opQueue.waitForFinished();
+  BOOST_TEST(stats.finished == 6);
+  BOOST_TEST(stats.maxRunning == 1);
+  BOOST_TEST(opQueue.memoryUsage() == 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_operationqueue_runs_oversized_operation_alone)
+{
+  pwned::ThreadPool pool(2);
+  Stats stats;
+  pwned::OperationQueue<MemoryOperation> opQueue(2, pool);
+  opQueue.setMemoryBudget(100);
+  opQueue.add(new MemoryOperation(stats, 2, 200, 300));
+  opQueue.add(new MemoryOperation(stats, 1, 10, 10));
+  opQueue.execute();
+  opQueue.waitForFinished();
+  BOOST_TEST(stats.finished == 2);
+  BOOST_TEST(stats.maxRunning == 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_operationqueue_redistributes_memory)
+{
+  pwned::ThreadPool pool(4);
+  Stats stats;
+  uint64_t grants[3] = {0, 0, 0};
+  pwned::OperationQueue<pwned::Operation> opQueue(2, pool);
+  opQueue.setMemoryBudget(100);
+  // the big operation starts with an even share, the small ones take what
+  // they want, one after the other
+  opQueue.add(new GrowingOperation(stats, 3, grants));
+  for (int i = 0; i < 3; ++i)
+  {
+    opQueue.add(new MemoryOperation(stats, i, 5, 5));
+  }
+  opQueue.execute();
+  opQueue.waitForFinished();
+  BOOST_TEST(stats.finished == 3);
+  BOOST_TEST(grants[0] == 50U);
+  // the others are done, so it gets all of the budget
+  BOOST_TEST(grants[1] == 100U);
+  BOOST_TEST(grants[2] == 20U);
+  BOOST_TEST(opQueue.memoryUsage() == 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_operationqueue_without_budget)
+{
+  pwned::ThreadPool pool(2);
+  Stats stats;
+  pwned::OperationQueue<MemoryOperation> opQueue(2, pool);
+  MemoryOperation *op = new MemoryOperation(stats, 1, 1000, 5000);
+  opQueue.add(op);
+  opQueue.execute();
+  opQueue.waitForFinished();
+  BOOST_TEST(stats.finished == 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_operationqueue_cancel_while_requesting_memory)
+{
+  pwned::ThreadPool pool(4);
+  std::atomic<int> requests{0};
+  pwned::OperationQueue<ChunkedOperation> opQueue(3, pool);
+  opQueue.setMemoryBudget(100);
+  for (int i = 0; i < 5; ++i)
+  {
+    opQueue.add(new ChunkedOperation(requests));
+  }
+  opQueue.execute();
+  while (requests < 1000)
+  {
+    std::this_thread::yield();
+  }
+  // used to hang: the queue was locked while it waited for the operations
+  opQueue.cancel();
+  opQueue.waitForFinished();
+  BOOST_TEST(opQueue.size() == 0U);
+  BOOST_TEST(opQueue.memoryUsage() == 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_operationqueue_counts_failures)
+{
+  pwned::ThreadPool pool(2);
+  pwned::OperationQueue<FailingOperation> opQueue(2, pool);
+  for (int how = 0; how < 3; ++how)
+  {
+    opQueue.add(new FailingOperation(how));
+  }
+  opQueue.execute();
+  // used to terminate on the std::bad_alloc
+  opQueue.waitForFinished();
+  BOOST_TEST(opQueue.failures() == 2U);
+  BOOST_TEST(opQueue.size() == 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
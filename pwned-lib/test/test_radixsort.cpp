@@ -0,0 +1,80 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE test radixsort
+#define BOOST_TEST_MODULE_RADIXSORT
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "pwned-lib/radixsort.hpp"
+
+namespace
+{
+
+void checkAgainstMap(std::size_t n, unsigned int numThreads)
+{
+  std::vector<pwned::PasswordHashAndCount> records;
+  std::map<pwned::Hash, uint32_t, pwned::HashLess> expected;
+  std::mt19937 gen(4711U + uint32_t(n));
+  std::uniform_int_distribution<std::size_t> dist(0, n / 3 + 1);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    const pwned::Hash hash(std::to_string(dist(gen)));
+    records.emplace_back(hash, 1U);
+    expected[hash] += 1U;
+  }
+  pwned::radixSortAndMerge(records, numThreads);
+  BOOST_TEST(records.size() == expected.size());
+  auto it = expected.begin();
+  for (std::size_t i = 0; i < records.size() && it != expected.end(); ++i, ++it)
+  {
+    BOOST_TEST(records[i].hash.quad.upper == it->first.quad.upper);
+    BOOST_TEST(records[i].hash.quad.lower == it->first.quad.lower);
+    BOOST_TEST(records[i].count == it->second);
+  }
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(test_radixsort)
+
+BOOST_AUTO_TEST_CASE(test_radixsort_empty)
+{
+  std::vector<pwned::PasswordHashAndCount> records;
+  pwned::radixSortAndMerge(records, 4);
+  BOOST_TEST(records.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_radixsort_small)
+{
+  checkAgainstMap(1000, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_radixsort_single_thread)
+{
+  checkAgainstMap(300000, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_radixsort_multi_thread)
+{
+  checkAgainstMap(300000, 4);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
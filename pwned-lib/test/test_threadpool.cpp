@@ -0,0 +1,246 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE test threadpool
+#define BOOST_TEST_MODULE_THREADPOOL
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <boost/test/unit_test.hpp>
+#include "pwned-lib/threadpool.hpp"
+#include "pwned-lib/boundedqueue.hpp"
+#include "pwned-lib/operation.hpp"
+#include "pwned-lib/operationqueue.hpp"
+
+namespace
+{
+
+class CountingOperation : public pwned::Operation
+{
+public:
+  CountingOperation(std::atomic<int> &count, long long priority, std::vector<long long> *order = nullptr, std::mutex *orderMtx = nullptr)
+      : count(count)
+      , order(order)
+      , orderMtx(orderMtx)
+  {
+    this->priority = priority;
+  }
+  void execute() override
+  {
+    if (order != nullptr)
+    {
+      std::lock_guard<std::mutex> lock(*orderMtx);
+      order->push_back(priority);
+    }
+    // sub-tasks of an operation run on the same pool
+    pwned::TaskGroup tasks;
+    for (int i = 0; i < 10; ++i)
+    {
+      tasks.run([this] { ++count; });
+    }
+    tasks.wait();
+  }
+
+private:
+  std::atomic<int> &count;
+  std::vector<long long> *order;
+  std::mutex *orderMtx;
+};
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(test_threadpool)
+
+BOOST_AUTO_TEST_CASE(test_threadpool_runs_all_tasks)
+{
+  pwned::ThreadPool pool(4);
+  std::atomic<int> count{0};
+  pwned::TaskGroup tasks(pool);
+  for (int i = 0; i < 10000; ++i)
+  {
+    tasks.run([&count] { ++count; });
+  }
+  tasks.wait();
+  BOOST_TEST(count == 10000);
+}
+
+BOOST_AUTO_TEST_CASE(test_threadpool_nested_groups_single_worker)
+{
+  // tasks waiting for tasks of their own must not starve a small pool
+  pwned::ThreadPool pool(1);
+  std::atomic<int> count{0};
+  pwned::TaskGroup outer(pool);
+  for (int i = 0; i < 8; ++i)
+  {
+    outer.run([&pool, &count] {
+      pwned::TaskGroup inner(pool);
+      for (int j = 0; j < 8; ++j)
+      {
+        inner.run([&count] { ++count; });
+      }
+      inner.wait();
+    });
+  }
+  outer.wait();
+  BOOST_TEST(count == 64);
+}
+
+BOOST_AUTO_TEST_CASE(test_threadpool_steals_uneven_work)
+{
+  // all tasks are spawned by one worker; the others have to steal them
+  pwned::ThreadPool pool(4);
+  std::mutex mtx;
+  std::set<std::thread::id> threads;
+  pwned::TaskGroup outer(pool);
+  outer.run([&pool, &mtx, &threads] {
+    pwned::TaskGroup inner(pool);
+    for (int i = 0; i < 64; ++i)
+    {
+      inner.run([&mtx, &threads] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        std::lock_guard<std::mutex> lock(mtx);
+        threads.insert(std::this_thread::get_id());
+      });
+    }
+    inner.wait();
+  });
+  outer.wait();
+  BOOST_TEST(threads.size() > 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_threadpool_rethrows)
+{
+  pwned::ThreadPool pool(2);
+  std::atomic<int> count{0};
+  pwned::TaskGroup tasks(pool);
+  for (int i = 0; i < 100; ++i)
+  {
+    tasks.run([&count, i] {
+      ++count;
+      if (i == 50)
+        throw std::runtime_error("task failed");
+    });
+  }
+  BOOST_CHECK_THROW(tasks.wait(), std::runtime_error);
+  BOOST_TEST(count == 100);
+  // the error is reported once
+  tasks.wait();
+}
+
+BOOST_AUTO_TEST_CASE(test_threadpool_wait_for)
+{
+  pwned::ThreadPool pool(1);
+  std::atomic<bool> started{false};
+  std::atomic<bool> release{false};
+  pwned::TaskGroup tasks(pool);
+  tasks.run([&started, &release] {
+    started = true;
+    while (!release)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  // otherwise waitFor() might pick up the task itself
+  while (!started)
+  {
+    std::this_thread::yield();
+  }
+  BOOST_TEST(!tasks.waitFor(std::chrono::milliseconds(20)));
+  release = true;
+  tasks.wait();
+  BOOST_TEST(tasks.waitFor(std::chrono::milliseconds(0)));
+}
+
+BOOST_AUTO_TEST_CASE(test_threadpool_operation_queue)
+{
+  pwned::ThreadPool pool(2);
+  std::atomic<int> count{0};
+  std::vector<long long> order;
+  std::mutex orderMtx;
+  // one operation at a time, so they start in the order of their priorities
+  pwned::OperationQueue<CountingOperation> opQueue(1, pool);
+  for (long long priority : {3, 7, 1, 5})
+  {
+    opQueue.add(new CountingOperation(count, priority, &order, &orderMtx));
+  }
+  opQueue.execute();
+  opQueue.waitForFinished();
+  BOOST_TEST(count == 40);
+  BOOST_TEST(order == std::vector<long long>({7, 5, 3, 1}), boost::test_tools::per_element());
+  BOOST_TEST(opQueue.size() == 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_threadpool_bounded_queue)
+{
+  pwned::BoundedQueue<int> queue(4);
+  std::atomic<int> pushed{0};
+  std::thread producer([&queue, &pushed] {
+    for (int i = 0; i < 100; ++i)
+    {
+      BOOST_TEST(queue.push(int(i)));
+      ++pushed;
+    }
+    queue.close();
+  });
+  // the producer is held up by the capacity
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  BOOST_TEST(pushed <= 4);
+  int item = -1;
+  for (int i = 0; i < 100; ++i)
+  {
+    BOOST_TEST(queue.pop(item));
+    BOOST_TEST(item == i);
+  }
+  BOOST_TEST(!queue.pop(item));
+  BOOST_TEST(queue.exhausted());
+  BOOST_TEST(!queue.push(100));
+  BOOST_TEST(!queue.popFor(item, std::chrono::milliseconds(1)));
+  producer.join();
+}
+
+BOOST_AUTO_TEST_CASE(test_threadpool_lanes)
+{
+  pwned::ThreadPool &cpu = pwned::ThreadPool::instance(pwned::Lane::cpu);
+  pwned::ThreadPool &io = pwned::ThreadPool::instance(pwned::Lane::io);
+  BOOST_TEST(&cpu != &io);
+  BOOST_TEST(&cpu == &pwned::ThreadPool::instance());
+  BOOST_TEST(io.size() == pwned::ThreadPool::DefaultIoThreads);
+  // a job blocked on the I/O lane doesn't hold up the CPU lane
+  pwned::BoundedQueue<int> queue(1);
+  pwned::TaskGroup reading(io);
+  reading.runJob([&queue] {
+    int item;
+    while (queue.pop(item))
+      ;
+  });
+  std::atomic<int> count{0};
+  pwned::TaskGroup computing(cpu);
+  for (int i = 0; i < 100; ++i)
+  {
+    computing.run([&count] { ++count; });
+  }
+  computing.wait();
+  BOOST_TEST(count == 100);
+  queue.close();
+  reading.wait();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -22,10 +22,12 @@
 #include <sstream>
 #include <string>
 #include <vector>
+#include <algorithm>
 
 #include <boost/test/unit_test.hpp>
 
 #include <pwned-lib/userpasswordreader.hpp>
+#include <pwned-lib/hashpipeline.hpp>
 
 BOOST_AUTO_TEST_SUITE(test_userpasswordreader)
 
@@ -404,4 +406,152 @@ BOOST_AUTO_TEST_CASE(test_userpasswordreader_mail_and_hex_auto)
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_userpasswordreader_small_buffer)
+{
+  std::stringstream input;
+  std::vector<std::string> passwords;
+  for (int i = 0; i < 1000; ++i)
+  {
+    passwords.push_back("password" + std::to_string(i * 7919));
+    input << "user" << i << "@example.com:" << passwords.back() << "\r\n";
+    if (i == 500)
+    {
+      input << "overlong@example.com:" << std::string(1000, 'x') << "\n";
+    }
+  }
+  input << "last@example.com:no-trailing-newline";
+  passwords.push_back("no-trailing-newline");
+  pwned::UserPasswordReader reader(input, std::vector<pwned::UserPasswordReaderOptions>{}, 256);
+  std::vector<std::string> got;
+  while (!reader.eof())
+  {
+    const std::string_view pwd = reader.nextPasswordView();
+    if (!pwd.empty())
+    {
+      got.emplace_back(pwd);
+    }
+  }
+  BOOST_TEST(got == passwords);
+}
+
+namespace
+{
+
+std::string makeLeak(int numLines)
+{
+  std::ostringstream os;
+  for (int i = 0; i < numLines; ++i)
+  {
+    os << "user" << i << "@example.com:password" << (i * 7919 % 1000) << (i % 3 == 0 ? "\r\n" : "\n");
+    if (i == 777)
+    {
+      os << "overlong@example.com:" << std::string(1000, 'x') << "\n";
+    }
+  }
+  os << "last@example.com:no-trailing-newline";
+  return os.str();
+}
+
+std::vector<pwned::Hash> readHashes(const std::string &leak)
+{
+  std::stringstream input(leak);
+  pwned::UserPasswordReader reader(input, std::vector<pwned::UserPasswordReaderOptions>{}, 256);
+  std::vector<pwned::Hash> hashes;
+  while (!reader.eof())
+  {
+    const pwned::Hash &hash = reader.nextPasswordHash();
+    if (hash.isValid)
+    {
+      hashes.push_back(hash);
+    }
+  }
+  return hashes;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_userpasswordreader_read_block)
+{
+  const std::string &leak = makeLeak(5000);
+  std::stringstream input(leak);
+  pwned::UserPasswordReader reader(input, std::vector<pwned::UserPasswordReaderOptions>{}, 256);
+  std::vector<pwned::Hash> hashes;
+  std::vector<char> block;
+  std::string scratch;
+  while (reader.readBlock(block, 300))
+  {
+    // whole lines only
+    BOOST_TEST(!block.empty());
+    std::size_t begin = 0;
+    while (begin < block.size())
+    {
+      std::size_t end = begin;
+      while (end < block.size() && block[end] != '\n')
+      {
+        ++end;
+      }
+      std::string_view line(block.data() + begin, end - begin);
+      if (!line.empty() && line.back() == '\r')
+      {
+        line.remove_suffix(1);
+      }
+      const pwned::Hash &hash = reader.lineHash(line, scratch);
+      if (hash.isValid)
+      {
+        hashes.push_back(hash);
+      }
+      begin = end + 1;
+    }
+  }
+  const std::vector<pwned::Hash> &expected = readHashes(leak);
+  BOOST_TEST(hashes.size() == expected.size());
+  BOOST_TEST((hashes == expected));
+}
+
+BOOST_AUTO_TEST_CASE(test_userpasswordreader_hash_pipeline)
+{
+  const std::string &leak = makeLeak(20000);
+  std::stringstream input(leak);
+  pwned::UserPasswordReader reader(input, std::vector<pwned::UserPasswordReaderOptions>{}, 256);
+  std::vector<pwned::Hash> hashes;
+  {
+    // small blocks and chunks, so that blocks get split across chunks
+    pwned::HashPipeline pipeline(reader, nullptr, 4096, 3);
+    std::vector<pwned::PasswordHashAndCount> records;
+    bool more = true;
+    while (more)
+    {
+      records.clear();
+      more = pipeline.next(records, 1000);
+      BOOST_TEST(records.size() <= 1000U);
+      for (const auto &record : records)
+      {
+        hashes.push_back(record.hash);
+      }
+    }
+  }
+  // blocks are hashed in parallel and may come out in any order
+  std::vector<pwned::Hash> expected = readHashes(leak);
+  std::sort(hashes.begin(), hashes.end());
+  std::sort(expected.begin(), expected.end());
+  BOOST_TEST(hashes.size() == expected.size());
+  BOOST_TEST((hashes == expected));
+}
+
+BOOST_AUTO_TEST_CASE(test_userpasswordreader_hash_pipeline_cancel)
+{
+  const std::string &leak = makeLeak(20000);
+  std::stringstream input(leak);
+  pwned::UserPasswordReader reader(input, std::vector<pwned::UserPasswordReaderOptions>{}, 256);
+  pwned::HashPipeline pipeline(reader, nullptr, 1024, 2);
+  std::vector<pwned::PasswordHashAndCount> records;
+  BOOST_TEST(pipeline.next(records, 10));
+  BOOST_TEST(records.size() == 10U);
+  // the reader job stops and the pipeline drains what it has in flight
+  pipeline.cancel();
+  while (pipeline.next(records, records.size() + 1000))
+    ;
+  BOOST_TEST(records.size() < readHashes(leak).size());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -118,6 +118,43 @@ BOOST_AUTO_TEST_CASE(test_hextocharseq)
   BOOST_TEST(result == "ٱلْعَرَبِيَّة");
 }
 
+BOOST_AUTO_TEST_CASE(test_hextobytes)
+{
+  const std::string hex = "00112233445566778899aabbccddeeffFFEEDDCCBBAA99887766554433221100";
+  uint8_t result[32];
+  BOOST_TEST(pwned::hexToBytes(hex, result) == true);
+  for (std::size_t i = 0; i < 16; ++i)
+  {
+    BOOST_TEST(result[i] == uint8_t(i * 0x11));
+    BOOST_TEST(result[31 - i] == uint8_t(i * 0x11));
+  }
+  BOOST_TEST(pwned::hexToBytes("abc", result) == false);
+  for (std::size_t i = 0; i < hex.size(); ++i)
+  {
+    for (char c : {'g', 'G', ' ', '/', ':', '@', '`', '\xe0'})
+    {
+      std::string broken = hex;
+      broken[i] = c;
+      BOOST_TEST(pwned::hexToBytes(broken, result) == false);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_decodehexpassword)
+{
+  std::string result;
+  BOOST_TEST(pwned::decodeHexPassword("$HEX[3132333435]", result) == true);
+  BOOST_TEST(result == "12345");
+  BOOST_TEST(pwned::decodeHexPassword("$HEX[c3a4c3b6c3bcc39f]", result) == true);
+  BOOST_TEST(result == "äöüß");
+  BOOST_TEST(pwned::decodeHexPassword("$HEX[]", result) == false);
+  BOOST_TEST(pwned::decodeHexPassword("$HEX[313]", result) == false);
+  BOOST_TEST(pwned::decodeHexPassword("$HEX[31zz]", result) == false);
+  BOOST_TEST(pwned::decodeHexPassword("$HEX[3132", result) == false);
+  BOOST_TEST(pwned::decodeHexPassword("$hex[3132]", result) == false);
+  BOOST_TEST(pwned::decodeHexPassword("3132", result) == false);
+}
+
 BOOST_AUTO_TEST_CASE(test_readabletime)
 {
   BOOST_TEST(pwned::readableTime(0.00001) == "0.0000s");
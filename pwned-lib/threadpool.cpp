@@ -0,0 +1,302 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "threadpool.hpp"
+
+namespace pwned
+{
+
+namespace
+{
+
+// the pool and the index of the worker running in this thread
+thread_local const ThreadPool *workerPool = nullptr;
+thread_local unsigned int workerIndex = 0;
+// where threads outside the pool start looking for tasks to steal
+thread_local unsigned int stealStart = 0;
+
+constexpr std::chrono::milliseconds HelpInterval(2);
+
+std::atomic<unsigned int> cpuLaneSize{std::thread::hardware_concurrency()};
+std::atomic<unsigned int> ioLaneSize{ThreadPool::DefaultIoThreads};
+
+} // namespace
+
+ThreadPool::ThreadPool(unsigned int numThreads)
+{
+  numThreads = std::max(1U, numThreads);
+  for (unsigned int i = 0; i < numThreads; ++i)
+  {
+    workers.emplace_back(new Worker);
+  }
+  // all deques exist before the first worker looks into them
+  for (unsigned int i = 0; i < numThreads; ++i)
+  {
+    workers[i]->thread = std::thread(&ThreadPool::work, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  wakeUp.notify_all();
+  for (auto &worker : workers)
+  {
+    worker->thread.join();
+  }
+}
+
+ThreadPool &ThreadPool::instance(Lane lane)
+{
+  if (lane == Lane::io)
+  {
+    static ThreadPool ioPool(ioLaneSize);
+    return ioPool;
+  }
+  static ThreadPool cpuPool(cpuLaneSize);
+  return cpuPool;
+}
+
+void ThreadPool::setLaneSize(Lane lane, unsigned int numThreads)
+{
+  (lane == Lane::io ? ioLaneSize : cpuLaneSize) = numThreads;
+}
+
+unsigned int ThreadPool::size() const
+{
+  return unsigned(workers.size());
+}
+
+int ThreadPool::currentWorker() const
+{
+  return workerPool == this ? int(workerIndex) : -1;
+}
+
+void ThreadPool::submit(Task task)
+{
+  const int self = currentWorker();
+  {
+    // counted before it can be taken, and under the lock the workers sleep
+    // on, so that none of them misses it
+    std::lock_guard<std::mutex> lock(mtx);
+    ++queued;
+    if (self < 0)
+    {
+      shared.push_back(std::move(task));
+    }
+  }
+  if (self >= 0)
+  {
+    Worker &worker = *workers[std::size_t(self)];
+    std::lock_guard<std::mutex> lock(worker.mtx);
+    worker.tasks.push_back(std::move(task));
+  }
+  wakeUp.notify_one();
+}
+
+void ThreadPool::submitJob(Task job)
+{
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    jobs.push_back(std::move(job));
+    ++queued;
+  }
+  wakeUp.notify_one();
+}
+
+bool ThreadPool::runPendingTask()
+{
+  Task task;
+  if (!takeTask(task, false))
+    return false;
+  task();
+  return true;
+}
+
+bool ThreadPool::takeTask(Task &task, bool includeJobs)
+{
+  const int self = currentWorker();
+  if (self >= 0)
+  {
+    Worker &worker = *workers[std::size_t(self)];
+    std::lock_guard<std::mutex> lock(worker.mtx);
+    if (!worker.tasks.empty())
+    {
+      task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+      --queued;
+      return true;
+    }
+  }
+  const std::size_t n = workers.size();
+  const std::size_t start = self >= 0 ? std::size_t(self) + 1 : stealStart++;
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    const std::size_t victim = (start + i) % n;
+    if (int(victim) == self)
+      continue;
+    Worker &worker = *workers[victim];
+    std::lock_guard<std::mutex> lock(worker.mtx);
+    if (!worker.tasks.empty())
+    {
+      task = std::move(worker.tasks.front());
+      worker.tasks.pop_front();
+      --queued;
+      return true;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  if (!shared.empty())
+  {
+    task = std::move(shared.front());
+    shared.pop_front();
+    --queued;
+    return true;
+  }
+  if (includeJobs && !jobs.empty())
+  {
+    task = std::move(jobs.front());
+    jobs.pop_front();
+    --queued;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::work(unsigned int index)
+{
+  workerPool = this;
+  workerIndex = index;
+  for (;;)
+  {
+    Task task;
+    if (takeTask(task, true))
+    {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    if (queued > 0)
+    {
+      // a task is about to be pushed to the deque of its worker
+      lock.unlock();
+      std::this_thread::yield();
+      continue;
+    }
+    if (stopping)
+      break;
+    wakeUp.wait(lock, [this] { return queued > 0 || stopping; });
+  }
+}
+
+TaskGroup::TaskGroup(ThreadPool &pool)
+    : pool(pool)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+  // the tasks refer to this group
+  waitUntil(std::chrono::steady_clock::time_point::max());
+}
+
+void TaskGroup::run(std::function<void()> task)
+{
+  pool.submit(track(std::move(task)));
+}
+
+void TaskGroup::runJob(std::function<void()> job)
+{
+  pool.submitJob(track(std::move(job)));
+}
+
+ThreadPool::Task TaskGroup::track(std::function<void()> task)
+{
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    ++pending;
+  }
+  return [this, task = std::move(task)] {
+    std::exception_ptr e;
+    try
+    {
+      task();
+    }
+    catch (...)
+    {
+      e = std::current_exception();
+    }
+    // notified under the lock: the group may be gone as soon as it's released
+    std::lock_guard<std::mutex> lock(mtx);
+    if (e && !error)
+    {
+      error = e;
+    }
+    if (--pending == 0)
+    {
+      done.notify_all();
+    }
+  };
+}
+
+void TaskGroup::wait()
+{
+  waitUntil(std::chrono::steady_clock::time_point::max());
+  std::exception_ptr e;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    std::swap(e, error);
+  }
+  if (e)
+  {
+    std::rethrow_exception(e);
+  }
+}
+
+bool TaskGroup::waitFor(std::chrono::milliseconds timeout)
+{
+  if (!waitUntil(std::chrono::steady_clock::now() + timeout))
+    return false;
+  wait();
+  return true;
+}
+
+bool TaskGroup::waitUntil(std::chrono::steady_clock::time_point deadline)
+{
+  for (;;)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      if (pending == 0)
+        return true;
+    }
+    if (std::chrono::steady_clock::now() >= deadline)
+      return false;
+    if (pool.runPendingTask())
+      continue;
+    // the remaining tasks are running elsewhere, but they may spawn more
+    std::unique_lock<std::mutex> lock(mtx);
+    done.wait_for(lock, HelpInterval, [this] { return pending == 0; });
+  }
+}
+
+} // namespace pwned
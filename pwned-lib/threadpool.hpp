@@ -0,0 +1,140 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __threadpool_hpp__
+#define __threadpool_hpp__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pwned
+{
+
+/**
+ * The pools of the process: `cpu` for computing, with a worker per core,
+ * and `io` for reading and writing files, with a few workers that mostly
+ * wait for the disks.
+ */
+enum class Lane
+{
+  cpu,
+  io
+};
+
+/**
+ * A fixed set of worker threads with a deque of tasks each.
+ *
+ * Tasks submitted by a worker are pushed to the back of its own deque and
+ * taken from there, newest first, while their data is still in the cache.
+ * Idle workers steal the oldest tasks from the front of the other deques,
+ * so the work spreads out no matter which worker produced it. Tasks from
+ * threads outside the pool go to a shared queue.
+ *
+ * Jobs are long-running tasks such as whole Operations. They are started in
+ * the order of their submission, only by idle workers and only if no task is
+ * pending, so that a thread waiting for a TaskGroup never gets stuck in one.
+ *
+ * Tasks and jobs must not throw; TaskGroup takes care of that for its tasks.
+ */
+class ThreadPool
+{
+public:
+  using Task = std::function<void()>;
+
+  explicit ThreadPool(unsigned int numThreads = std::thread::hardware_concurrency());
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  static constexpr unsigned int DefaultIoThreads = 2;
+
+  // the pool of a lane, shared by all operations and their tasks
+  static ThreadPool &instance(Lane lane = Lane::cpu);
+  // only has an effect before the lane is first used
+  static void setLaneSize(Lane lane, unsigned int numThreads);
+
+  unsigned int size() const;
+  void submit(Task task);
+  void submitJob(Task job);
+  // runs a pending task (not a job) in the calling thread, if there is one
+  bool runPendingTask();
+
+private:
+  struct Worker
+  {
+    std::mutex mtx;
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::mutex mtx;
+  std::condition_variable wakeUp;
+  std::deque<Task> shared;
+  std::deque<Task> jobs;
+  // tasks and jobs waiting to be run
+  std::atomic<std::size_t> queued{0};
+  bool stopping{false};
+
+  int currentWorker() const;
+  bool takeTask(Task &task, bool includeJobs);
+  void work(unsigned int index);
+};
+
+/**
+ * Runs tasks on a ThreadPool and waits for them. While waiting, the calling
+ * thread runs pending tasks itself, so tasks can wait for groups of their
+ * own without tying up the pool. The first exception thrown by a task is
+ * rethrown by `wait()`.
+ */
+class TaskGroup
+{
+public:
+  explicit TaskGroup(ThreadPool &pool = ThreadPool::instance());
+  ~TaskGroup();
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  void run(std::function<void()> task);
+  // runs a long task as a job of the pool; see ThreadPool
+  void runJob(std::function<void()> job);
+  void wait();
+  // like wait(), but returns false if tasks are still running after `timeout`;
+  // a task the calling thread helps with in the meantime may take longer
+  bool waitFor(std::chrono::milliseconds timeout);
+
+private:
+  ThreadPool &pool;
+  std::mutex mtx;
+  std::condition_variable done;
+  std::size_t pending{0};
+  std::exception_ptr error;
+
+  ThreadPool::Task track(std::function<void()> task);
+  bool waitUntil(std::chrono::steady_clock::time_point deadline);
+};
+
+} // namespace pwned
+
+#endif // __threadpool_hpp__
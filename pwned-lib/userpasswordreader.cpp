@@ -16,11 +16,10 @@
  */
 
 #include <iostream>
-#include <regex>
-#include <fstream>
 #include <map>
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 
 #include "userpasswordreader.hpp"
 #include "util.hpp"
@@ -28,8 +27,25 @@
 namespace pwned
 {
 
-UserPasswordReader::UserPasswordReader(std::istream &inputStream, const std::vector<UserPasswordReaderOptions> &options)
+namespace
+{
+
+inline std::string_view chompCR(std::string_view line)
+{
+  if (!line.empty() && line.back() == '\r')
+  {
+    line.remove_suffix(1);
+  }
+  return line;
+}
+
+} // namespace
+
+UserPasswordReader::UserPasswordReader(std::istream &inputStream,
+                                       const std::vector<UserPasswordReaderOptions> &options,
+                                       std::size_t bufferSize)
     : input(inputStream)
+    , buffer(std::max<std::size_t>(bufferSize, 2 * MaxLineLength))
 {
   forceEvaluateMD5Hashes = std::find(options.begin(), options.end(), UserPasswordReaderOptions::forceEvaluateMD5Hashes) != options.end();
   forceEvaluateHexEncodedPasswords = std::find(options.begin(), options.end(), UserPasswordReaderOptions::forceEvaluateHexEncodedPasswords) != options.end();
@@ -40,7 +56,7 @@ UserPasswordReader::UserPasswordReader(std::istream &inputStream, const std::vec
 
 bool UserPasswordReader::eof() const
 {
-  return input.eof();
+  return inputExhausted && head >= tail;
 }
 
 bool UserPasswordReader::bad() const
@@ -48,18 +64,102 @@ bool UserPasswordReader::bad() const
   return input.bad();
 }
 
-char UserPasswordReader::guessSeparator()
+/**
+ * Moves the unconsumed bytes to the front of the buffer and appends as much
+ * data from the input stream as fits. Returns `false` if nothing could be read.
+ */
+bool UserPasswordReader::fill()
+{
+  if (inputExhausted)
+    return false;
+  if (head > 0)
+  {
+    std::memmove(buffer.data(), buffer.data() + head, tail - head);
+    tail -= head;
+    head = 0;
+  }
+  input.read(buffer.data() + tail, std::streamsize(buffer.size() - tail));
+  const std::size_t n = std::size_t(input.gcount());
+  tail += n;
+  if (!input)
+  {
+    inputExhausted = true;
+  }
+  return n > 0;
+}
+
+/**
+ * Finds the next line in the buffer with `memchr()` and returns it without the
+ * line terminator. Lines that do not fit into the buffer are skipped and
+ * reported as empty lines.
+ */
+bool UserPasswordReader::nextLine(std::string_view &line)
+{
+  for (;;)
+  {
+    const char *const begin = buffer.data() + head;
+    const char *const nl = static_cast<const char *>(std::memchr(begin, '\n', tail - head));
+    if (nl != nullptr)
+    {
+      head += std::size_t(nl - begin) + 1;
+      if (skipUntilNewline)
+      {
+        skipUntilNewline = false;
+        line = std::string_view();
+      }
+      else
+      {
+        line = chompCR(std::string_view(begin, std::size_t(nl - begin)));
+      }
+      return true;
+    }
+    if (inputExhausted)
+    {
+      if (head == tail)
+        return false;
+      line = skipUntilNewline
+                 ? std::string_view()
+                 : chompCR(std::string_view(begin, tail - head));
+      skipUntilNewline = false;
+      head = tail;
+      return true;
+    }
+    if (head == 0 && tail == buffer.size())
+    {
+      head = tail;
+      skipUntilNewline = true;
+    }
+    fill();
+  }
+}
+
+std::vector<std::string_view> UserPasswordReader::sampleLines() const
+{
+  std::vector<std::string_view> sample;
+  const char *p = buffer.data() + head;
+  const char *const end = buffer.data() + tail;
+  while (p < end && sample.size() < std::size_t(nTries))
+  {
+    const char *nl = static_cast<const char *>(std::memchr(p, '\n', std::size_t(end - p)));
+    if (nl == nullptr)
+    {
+      nl = end;
+    }
+    sample.push_back(chompCR(std::string_view(p, std::size_t(nl - p))));
+    p = nl + 1;
+  }
+  return sample;
+}
+
+char UserPasswordReader::guessSeparator(const std::vector<std::string_view> &sample)
 {
   std::map<char, int> successfulSplits;
   static const std::vector<char> possibleSeparators{':', ';', '\t', ' '};
-  std::string line;
-  for (int i = 0; i < nTries && !eof(); ++i)
+  for (const std::string_view &line : sample)
   {
-    std::getline(input, line);
-    line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
     for (char sep : possibleSeparators)
     {
-      if (line.find(sep) != std::string::npos)
+      if (line.find(sep) != std::string_view::npos)
       {
         successfulSplits[sep] += 1;
       }
@@ -78,23 +178,18 @@ char UserPasswordReader::guessSeparator()
       guessedSeparator = maxSep->first;
     }
   }
-  input.clear();
-  input.seekg(0, std::ios::beg);
   return guessedSeparator;
 }
 
-bool UserPasswordReader::checkForMD5Hashes()
+bool UserPasswordReader::checkForMD5Hashes(const std::vector<std::string_view> &sample)
 {
   if (!forceEvaluateMD5Hashes && autoEvaluateMD5Hashes)
   {
-    std::string line;
-    for (int i = 0; i < nTries && !eof(); ++i)
+    for (const std::string_view &line : sample)
     {
-      std::getline(input, line);
-      line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
-      if (line.find(guessedSeparator) != std::string::npos)
+      if (line.find(guessedSeparator) != std::string_view::npos)
       {
-        if (std::regex_search(line, MD5Regex))
+        if (Hash::fromHex(extractPassword(line)).isValid)
         {
           forceEvaluateMD5Hashes = true;
           break;
@@ -102,24 +197,20 @@ bool UserPasswordReader::checkForMD5Hashes()
       }
     }
   }
-  input.clear();
-  input.seekg(0, std::ios::beg);
   return forceEvaluateMD5Hashes;
 }
 
-bool UserPasswordReader::checkForHexEncodedPasswords()
+bool UserPasswordReader::checkForHexEncodedPasswords(const std::vector<std::string_view> &sample)
 {
   if (forceEvaluateHexEncodedPasswords)
     return true;
   if (autoEvaluateHexEncodedPasswords)
   {
-    std::string line;
-    for (int i = 0; i < nTries && !eof(); ++i)
+    for (const std::string_view &line : sample)
     {
-      std::getline(input, line);
-      if (line.find(guessedSeparator) != std::string::npos)
+      if (line.find(guessedSeparator) != std::string_view::npos)
       {
-        if (std::regex_search(line, HexRegex))
+        if (decodeHexPassword(extractPassword(line), dehexed))
         {
           forceEvaluateHexEncodedPasswords = true;
           break;
@@ -127,79 +218,135 @@ bool UserPasswordReader::checkForHexEncodedPasswords()
       }
     }
   }
-  input.clear();
-  input.seekg(0, std::ios::beg);
   return forceEvaluateHexEncodedPasswords;
 }
 
+/**
+ * Sniffs the first lines of the input without consuming them, so the input
+ * stream never has to be rewound.
+ */
 void UserPasswordReader::evaluateContents()
 {
-  this->guessSeparator();
-  this->checkForHexEncodedPasswords();
-  this->checkForMD5Hashes();
+  fill();
+  const std::vector<std::string_view> &sample = sampleLines();
+  this->guessSeparator(sample);
+  this->checkForHexEncodedPasswords(sample);
+  this->checkForMD5Hashes(sample);
 }
 
-std::string UserPasswordReader::extractPassword(const std::string &_line)
+std::string_view UserPasswordReader::extractPassword(std::string_view line) const
 {
-  std::string line = _line;
-  line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+  line = chompCR(line);
   if (guessedSeparator != '\0')
   {
     const size_t pos = line.find(guessedSeparator);
-    return (pos == std::string::npos)
-              ? line
-              : line.substr(pos + 1);
+    if (pos != std::string_view::npos)
+    {
+      line.remove_prefix(pos + 1);
+    }
   }
   return line;
 }
 
-std::string UserPasswordReader::nextPassword()
+std::string_view UserPasswordReader::nextPasswordView()
 {
-  if (input.eof() || input.bad())
-    return std::string();
-  std::getline(input, currentLine);
+  std::string_view line;
+  if (input.bad() || !nextLine(line))
+    return std::string_view();
   ++lineNo;
-  if (currentLine.size() > 200 || currentLine.size() < 1) // assume no user:pass line is longer than 200 characters
-    return std::string();
-  return extractPassword(currentLine);
+  if (line.size() > MaxLineLength || line.size() < 1) // assume no user:pass line is longer than 200 characters
+    return std::string_view();
+  return extractPassword(line);
+}
+
+std::string UserPasswordReader::nextPassword()
+{
+  return std::string(nextPasswordView());
 }
 
 Hash UserPasswordReader::nextPasswordHash()
 {
-  const std::string &pwd = nextPassword();
+  std::string_view line;
+  if (input.bad() || !nextLine(line))
+    return Hash();
+  ++lineNo;
+  const Hash &hash = lineHash(line, dehexed);
+  if (hash.isValid)
+  {
+    ++validEntries;
+  }
+  return hash;
+}
+
+/**
+ * Hashes the password in `line`, with `scratch` as buffer for decoding hex
+ * encoded passwords.
+ */
+Hash UserPasswordReader::lineHash(std::string_view line, std::string &scratch) const
+{
+  if (line.size() > MaxLineLength || line.size() < 1) // assume no user:pass line is longer than 200 characters
+    return Hash();
+  const std::string_view pwd = extractPassword(line);
   if (pwd.empty())
     return Hash();
   Hash hash;
-  if (forceEvaluateMD5Hashes)
+  if (forceEvaluateMD5Hashes && pwd.size() == 2 * Hash::size)
   {
-    std::smatch match;
-    if (std::regex_match(pwd, match, MD5Regex))
-    {
-      hash = pwned::Hash::fromHex(match[0]);
-    }
+    hash = Hash::fromHex(pwd);
   }
   if (!hash.isValid)
   {
-    if (forceEvaluateHexEncodedPasswords)
+    if (forceEvaluateHexEncodedPasswords && pwd.front() == '$' && decodeHexPassword(pwd, scratch))
     {
-      std::smatch match;
-      if (std::regex_match(pwd, match, HexRegex))
-      {
-        std::string dehexed;
-        hexToCharSeq(match[1], dehexed);
-        hash = Hash(dehexed);
-      }
+      hash = Hash(scratch);
     }
-    if (!hash.isValid)
+    else
     {
       hash = Hash(pwd);
     }
   }
-  if (hash.isValid)
+  return hash;
+}
+
+/**
+ * Copies the buffered lines to `block` and refills the buffer until `block`
+ * holds `size` bytes. A line that is cut off stays in the buffer for the next
+ * block; a line that does not fit into the buffer is skipped. Returns `false`
+ * if there was nothing left to read.
+ */
+bool UserPasswordReader::readBlock(std::vector<char> &block, std::size_t size)
+{
+  block.clear();
+  while (block.size() < size)
   {
-    ++validEntries;
+    if (skipUntilNewline)
+    {
+      const char *const nl = static_cast<const char *>(std::memchr(buffer.data() + head, '\n', tail - head));
+      skipUntilNewline = nl == nullptr;
+      head = nl == nullptr ? tail : std::size_t(nl - buffer.data()) + 1;
+    }
+    if (!skipUntilNewline && head < tail)
+    {
+      const char *const begin = buffer.data() + head;
+      std::size_t n = tail - head;
+      if (!inputExhausted)
+      {
+        const char *const nl = static_cast<const char *>(::memrchr(begin, '\n', n));
+        n = nl == nullptr ? 0 : std::size_t(nl - begin) + 1;
+      }
+      block.insert(block.end(), begin, begin + n);
+      head += n;
+      if (n == 0 && head == 0 && tail == buffer.size())
+      {
+        head = tail;
+        skipUntilNewline = true;
+      }
+    }
+    if (inputExhausted && head >= tail)
+      break;
+    fill();
   }
-  return hash;
+  return !block.empty();
 }
 
 } // namespace pwned
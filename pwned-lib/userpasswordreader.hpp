@@ -20,7 +20,9 @@
 
 #include <iostream>
 #include <vector>
-#include <regex>
+#include <string>
+#include <string_view>
+#include <cstddef>
 
 #include "hash.hpp"
 
@@ -36,36 +38,58 @@ enum UserPasswordReaderOptions
 };
 
 
+/**
+ * Reads user:pass lines in large blocks from `inputStream` and hands out
+ * passwords as views into its internal buffer. A view returned by
+ * `nextPasswordView()` or `extractPassword()` is only valid until the
+ * next call to one of the `next...()` methods.
+ * `readBlock()` hands out whole lines instead, to be hashed elsewhere with
+ * `lineHash()`, which can be called from several threads at once.
+ */
 class UserPasswordReader
 {
 public:
-  UserPasswordReader(std::istream &inputStream, const std::vector<UserPasswordReaderOptions> &options);
-  std::string extractPassword(const std::string &line);
+  static constexpr std::size_t DefaultBufferSize = 4 * 1024 * 1024;
+  UserPasswordReader(std::istream &inputStream,
+                     const std::vector<UserPasswordReaderOptions> &options,
+                     std::size_t bufferSize = DefaultBufferSize);
+  std::string_view extractPassword(std::string_view line) const;
+  std::string_view nextPasswordView();
   std::string nextPassword();
   Hash nextPasswordHash();
+  // moves at least `size` bytes of whole lines, unless the input ends, to `block`
+  bool readBlock(std::vector<char> &block, std::size_t size);
+  Hash lineHash(std::string_view line, std::string &scratch) const;
   bool eof() const;
   bool bad() const;
 
 protected:
   void evaluateContents();
-  char guessSeparator();
-  bool checkForMD5Hashes();
-  bool checkForHexEncodedPasswords();
+  std::vector<std::string_view> sampleLines() const;
+  char guessSeparator(const std::vector<std::string_view> &sample);
+  bool checkForMD5Hashes(const std::vector<std::string_view> &sample);
+  bool checkForHexEncodedPasswords(const std::vector<std::string_view> &sample);
+  bool fill();
+  bool nextLine(std::string_view &line);
 
 private:
   static const int nTries{500};
+  static constexpr std::size_t MaxLineLength{200};
   uint64_t validEntries{0};
   uint64_t lineNo{0};
   char guessedSeparator{'\0'};
   float approxBytesPerEntry{30};
-  const std::regex HexRegex{"\\$HEX\\[((?:[a-zA-Z0-9][a-zA-Z0-9])+?)\\]"};
-  const std::regex MD5Regex{"[a-zA-Z0-9]{32}"};
   bool forceEvaluateHexEncodedPasswords{false};
   bool forceEvaluateMD5Hashes{false};
   bool autoEvaluateHexEncodedPasswords{false};
   bool autoEvaluateMD5Hashes{false};
   std::istream &input;
-  std::string currentLine;
+  std::vector<char> buffer;
+  std::string dehexed;
+  std::size_t head{0};
+  std::size_t tail{0};
+  bool inputExhausted{false};
+  bool skipUntilNewline{false};
 };
 
 } // namespace pwned
@@ -44,6 +44,10 @@
 #include <popcntintrin.h>
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #if defined(__linux__)
 #include <map>
 #include <regex>
@@ -241,29 +245,98 @@ int decodeHex(const char c)
   return -1;
 }
 
-bool hexToCharSeq(const std::string &seq, std::string &result)
+namespace
+{
+
+// maps every character to its nibble value, or to 0xff if it isn't a hex digit
+const struct HexTable
 {
-  result.clear();
-  if (seq.size() % 2 == 0)
+  uint8_t value[256];
+  HexTable()
   {
-    for (size_t i = 0; i < seq.size(); i += 2)
+    std::memset(value, 0xff, sizeof(value));
+    for (int c = '0'; c <= '9'; ++c)
     {
-      const int hi = decodeHex(seq.at(i));
-      const int lo = decodeHex(seq.at(i + 1));
-      if (lo >= 0 && hi >= 0)
-      {
-        const int b = hi * 16 + lo;
-        result.push_back(char(b));
-      }
-      else
-      {
-        return false;
-      }
+      value[c] = uint8_t(c - '0');
     }
+    for (int c = 'a'; c <= 'f'; ++c)
+    {
+      value[c] = uint8_t(c - 'a' + 10);
+      value[c - 'a' + 'A'] = uint8_t(c - 'a' + 10);
+    }
+  }
+} HexValue;
+
+#if defined(__SSE2__)
+// decodes 16 hex digits into 8 bytes; returns false if a non-hex character is found
+inline bool hexToBytes16(const char *src, uint8_t *dst)
+{
+  const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+  const __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                        _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+  const __m128i lc = _mm_or_si128(c, _mm_set1_epi8(0x20));
+  const __m128i isAlpha = _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+                                        _mm_cmplt_epi8(lc, _mm_set1_epi8('f' + 1)));
+  if (_mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)) != 0xffff)
+    return false;
+  const __m128i nibbles = _mm_or_si128(_mm_and_si128(isDigit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+                                       _mm_andnot_si128(isDigit, _mm_sub_epi8(lc, _mm_set1_epi8('a' - 10))));
+  // every 16 bit lane now holds the high nibble in its low byte and the low nibble in its high byte
+  const __m128i bytes = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00ff)), 4),
+                                     _mm_srli_epi16(nibbles, 8));
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(dst), _mm_packus_epi16(bytes, bytes));
+  return true;
+}
+#endif
+
+} // namespace
+
+bool hexToBytes(std::string_view seq, uint8_t *result)
+{
+  if (seq.size() % 2 != 0)
+    return false;
+  const char *src = seq.data();
+  const char *const end = src + seq.size();
+#if defined(__SSE2__)
+  for (; end - src >= 16; src += 16, result += 8)
+  {
+    if (!hexToBytes16(src, result))
+      return false;
+  }
+#endif
+  uint8_t invalid = 0;
+  for (; src < end; src += 2, ++result)
+  {
+    const uint8_t hi = HexValue.value[uint8_t(src[0])];
+    const uint8_t lo = HexValue.value[uint8_t(src[1])];
+    invalid |= hi | lo;
+    *result = uint8_t((hi << 4) | (lo & 0x0f));
+  }
+  return (invalid & 0xf0) == 0;
+}
+
+bool hexToCharSeq(std::string_view seq, std::string &result)
+{
+  result.resize(seq.size() / 2);
+  if (!hexToBytes(seq, reinterpret_cast<uint8_t *>(result.data())))
+  {
+    result.clear();
+    return false;
   }
   return true;
 }
 
+/**
+ * Decodes passwords given in the form `$HEX[...]`, e.g. `$HEX[3132333435]` yields `12345`.
+ */
+bool decodeHexPassword(std::string_view pwd, std::string &result)
+{
+  static constexpr std::string_view Prefix{"$HEX["};
+  if (pwd.size() < Prefix.size() + 3 || pwd.back() != ']' || pwd.compare(0, Prefix.size(), Prefix) != 0)
+    return false;
+  return hexToCharSeq(pwd.substr(Prefix.size(), pwd.size() - Prefix.size() - 1), result);
+}
+
 unsigned int popcnt64(uint64_t x)
 {
 #ifndef NO_POPCNT
@@ -19,6 +19,7 @@
 #define __util_hpp__
 
 #include <string>
+#include <string_view>
 #include <cstdint>
 #include <random>
 #include <termios.h>
@@ -49,7 +50,9 @@ std::string string_format(const std::string fmt_str, ...);
 std::string readableSize(uint64_t size);
 std::string readableTime(double t);
 int decodeHex(const char c);
-bool hexToCharSeq(const std::string &seq, std::string &result);
+bool hexToBytes(std::string_view seq, uint8_t *result);
+bool hexToCharSeq(std::string_view seq, std::string &result);
+bool decodeHexPassword(std::string_view pwd, std::string &result);
 unsigned int popcnt64(uint64_t);
 void setStdinEcho(bool enable);
 
@@ -0,0 +1,282 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "checkpoint.hpp"
+
+namespace fs = boost::filesystem;
+namespace pt = boost::property_tree;
+
+namespace merger
+{
+
+namespace
+{
+
+constexpr int CheckpointVersion = 1;
+
+template <typename T>
+pt::ptree toArray(const std::vector<T> &values)
+{
+  pt::ptree array;
+  for (const auto &value : values)
+  {
+    pt::ptree element;
+    element.put_value(value);
+    array.push_back(std::make_pair("", element));
+  }
+  return array;
+}
+
+template <typename T>
+std::vector<T> fromArray(const pt::ptree &array)
+{
+  std::vector<T> values;
+  for (const auto &element : array)
+  {
+    values.push_back(element.second.get_value<T>());
+  }
+  return values;
+}
+
+bool writeDurably(const std::string &filename, const std::string &contents)
+{
+  const std::string tmpFilename = filename + ".tmp";
+  const int fd = ::open(tmpFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+  std::size_t written = 0;
+  while (written < contents.size())
+  {
+    const ssize_t n = ::write(fd, contents.data() + written, contents.size() - written);
+    if (n <= 0)
+      break;
+    written += std::size_t(n);
+  }
+  const bool ok = written == contents.size() && ::fsync(fd) == 0;
+  if (::close(fd) != 0 || !ok || std::rename(tmpFilename.c_str(), filename.c_str()) != 0)
+    return false;
+  // make the rename itself durable
+  const fs::path dir = fs::path(filename).parent_path();
+  const int dirFd = ::open(dir.empty() ? "." : dir.string().c_str(), O_RDONLY);
+  if (dirFd >= 0)
+  {
+    ::fsync(dirFd);
+    ::close(dirFd);
+  }
+  return true;
+}
+
+} // namespace
+
+Checkpoint::Checkpoint(const std::string &filename, unsigned int intervalSeconds)
+    : checkpointFilename(filename)
+    , intervalSeconds(intervalSeconds)
+{
+}
+
+const std::string &Checkpoint::filename() const
+{
+  return checkpointFilename;
+}
+
+unsigned int Checkpoint::interval() const
+{
+  return intervalSeconds;
+}
+
+bool Checkpoint::load()
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  pt::ptree root;
+  try
+  {
+    pt::read_json(checkpointFilename, root);
+    if (root.get<int>("version") != CheckpointVersion)
+      return false;
+    Plan plan;
+    const pt::ptree &planTree = root.get_child("plan");
+    plan.dstFile = planTree.get<std::string>("dst");
+    plan.baseFile = planTree.get<std::string>("base");
+    plan.fanIn = planTree.get<std::size_t>("fanIn");
+    plan.compressTemp = planTree.get<bool>("compressTemp");
+    for (const auto &input : planTree.get_child("inputs"))
+    {
+      plan.inputs.push_back(input.second.get<std::string>("path"));
+      plan.inputSizes.push_back(input.second.get<uint64_t>("size"));
+    }
+    plan.outputs = fromArray<std::string>(planTree.get_child("outputs"));
+    completed.assign(plan.outputs.size(), false);
+    for (std::size_t step : fromArray<std::size_t>(root.get_child("completed")))
+    {
+      if (step < completed.size())
+      {
+        completed[step] = true;
+      }
+    }
+    running.clear();
+    for (const auto &stepTree : root.get_child("running"))
+    {
+      std::vector<MergeState> ranges;
+      for (const auto &rangeTree : stepTree.second.get_child("ranges"))
+      {
+        MergeState state;
+        state.uniqueEntries = rangeTree.second.get<uint64_t>("uniqueEntries");
+        state.recordsWritten = rangeTree.second.get<uint64_t>("recordsWritten");
+        state.outputBytes = rangeTree.second.get<uint64_t>("outputBytes");
+        state.lastHash = rangeTree.second.get<std::string>("lastHash");
+        state.inputRecords = fromArray<uint64_t>(rangeTree.second.get_child("inputRecords"));
+        ranges.push_back(state);
+      }
+      running[stepTree.second.get<std::size_t>("step")] = ranges;
+    }
+    currentPlan = plan;
+  }
+  catch (const pt::ptree_error &)
+  {
+    return false;
+  }
+  return true;
+}
+
+bool Checkpoint::start(const Plan &plan)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  currentPlan = plan;
+  completed.assign(plan.outputs.size(), false);
+  running.clear();
+  return save();
+}
+
+void Checkpoint::remove()
+{
+  boost::system::error_code ec;
+  fs::remove(checkpointFilename, ec);
+}
+
+const Checkpoint::Plan &Checkpoint::plan() const
+{
+  return currentPlan;
+}
+
+bool Checkpoint::isCompleted(std::size_t step) const
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  return step < completed.size() && completed[step];
+}
+
+bool Checkpoint::complete(std::size_t step)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  if (step >= completed.size())
+    return false;
+  completed[step] = true;
+  running.erase(step);
+  return save();
+}
+
+std::vector<MergeState> Checkpoint::progress(std::size_t step) const
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  const auto &it = running.find(step);
+  if (it == running.end())
+    return {};
+  // a key range that never reported means the step has to start over
+  for (const auto &state : it->second)
+  {
+    if (state.inputRecords.empty())
+      return {};
+  }
+  return it->second;
+}
+
+bool Checkpoint::update(std::size_t step, std::size_t range, std::size_t numRanges, const MergeState &state)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  std::vector<MergeState> &ranges = running[step];
+  ranges.resize(numRanges);
+  if (range < numRanges)
+  {
+    ranges[range] = state;
+  }
+  return save();
+}
+
+bool Checkpoint::save() const
+{
+  pt::ptree planTree;
+  planTree.put("dst", currentPlan.dstFile);
+  planTree.put("base", currentPlan.baseFile);
+  planTree.put("fanIn", currentPlan.fanIn);
+  planTree.put("compressTemp", currentPlan.compressTemp);
+  pt::ptree inputs;
+  for (std::size_t i = 0; i < currentPlan.inputs.size(); ++i)
+  {
+    pt::ptree input;
+    input.put("path", currentPlan.inputs[i]);
+    input.put("size", currentPlan.inputSizes[i]);
+    inputs.push_back(std::make_pair("", input));
+  }
+  planTree.put_child("inputs", inputs);
+  planTree.put_child("outputs", toArray(currentPlan.outputs));
+  std::vector<std::size_t> completedSteps;
+  for (std::size_t step = 0; step < completed.size(); ++step)
+  {
+    if (completed[step])
+    {
+      completedSteps.push_back(step);
+    }
+  }
+  pt::ptree runningSteps;
+  for (const auto &step : running)
+  {
+    pt::ptree ranges;
+    for (const auto &state : step.second)
+    {
+      pt::ptree range;
+      range.put("uniqueEntries", state.uniqueEntries);
+      range.put("recordsWritten", state.recordsWritten);
+      range.put("outputBytes", state.outputBytes);
+      range.put("lastHash", state.lastHash);
+      range.put_child("inputRecords", toArray(state.inputRecords));
+      ranges.push_back(std::make_pair("", range));
+    }
+    pt::ptree stepTree;
+    stepTree.put("step", step.first);
+    stepTree.put_child("ranges", ranges);
+    runningSteps.push_back(std::make_pair("", stepTree));
+  }
+  pt::ptree root;
+  root.put("version", CheckpointVersion);
+  root.put_child("plan", planTree);
+  root.put_child("completed", toArray(completedSteps));
+  root.put_child("running", runningSteps);
+  std::ostringstream os;
+  pt::write_json(os, root, true);
+  return writeDurably(checkpointFilename, os.str());
+}
+
+} // namespace merger
@@ -0,0 +1,97 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __checkpoint_hpp__
+#define __checkpoint_hpp__
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+namespace merger
+{
+
+/**
+ * State of a merge into one output, or of one of its key ranges, taken
+ * right after a record was written: the output is on disk up to
+ * `outputBytes`, ending with `lastHash`, and `inputRecords` holds the index
+ * of the next record to read from each input.
+ */
+struct MergeState
+{
+  // records of the key range in the output (partitioned merges only)
+  uint64_t uniqueEntries{0};
+  uint64_t recordsWritten{0};
+  uint64_t outputBytes{0};
+  std::string lastHash;
+  std::vector<uint64_t> inputRecords;
+};
+
+/**
+ * Keeps the progress of a merger run as JSON in the working directory:
+ * the inputs, the merge plan with the names of its intermediate files,
+ * the completed steps and the state of each running step as of its last
+ * checkpoint. Every change is written to a temporary file, flushed and
+ * renamed, so that a crash leaves either the old or the new state behind.
+ */
+class Checkpoint
+{
+public:
+  struct Plan
+  {
+    std::vector<std::string> inputs;
+    std::vector<uint64_t> inputSizes;
+    std::string dstFile;
+    std::string baseFile;
+    std::size_t fanIn{0};
+    bool compressTemp{false};
+    // files written by the merge steps
+    std::vector<std::string> outputs;
+  };
+
+  Checkpoint(const std::string &filename, unsigned int intervalSeconds);
+  const std::string &filename() const;
+  // seconds between two checkpoints of a running merge
+  unsigned int interval() const;
+
+  bool load();
+  bool start(const Plan &plan);
+  void remove();
+  const Plan &plan() const;
+
+  bool isCompleted(std::size_t step) const;
+  bool complete(std::size_t step);
+  // states of the key ranges of `step`, empty if it has to start over
+  std::vector<MergeState> progress(std::size_t step) const;
+  bool update(std::size_t step, std::size_t range, std::size_t numRanges, const MergeState &state);
+
+private:
+  const std::string checkpointFilename;
+  const unsigned int intervalSeconds;
+  mutable std::mutex mtx;
+  Plan currentPlan;
+  std::vector<bool> completed;
+  std::map<std::size_t, std::vector<MergeState>> running;
+
+  bool save() const;
+};
+
+} // namespace merger
+
+#endif // __checkpoint_hpp__
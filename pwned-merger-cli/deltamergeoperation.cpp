@@ -0,0 +1,389 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include <pwned-lib/util.hpp>
+#include <pwned-lib/passwordhashandcount.hpp>
+#include <pwned-lib/blockio.hpp>
+#include <pwned-lib/pagecache.hpp>
+#include <pwned-lib/operationexception.hpp>
+
+#include "deltamergeoperation.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace merger
+{
+
+namespace
+{
+
+enum DeltaMergerError
+{
+  cannotReadFile = 1,
+  cannotWriteToFile,
+  packedBase,
+  dstIsInput
+};
+
+constexpr uint64_t RecordSize = pwned::PasswordHashAndCount::size;
+// spans shorter than this are cheaper to copy through the write buffer
+constexpr uint64_t MinCopyRecords = 4096;
+constexpr std::size_t BufferRecords = 16 * 4096;
+
+inline bool hashLess(const pwned::Hash &a, const pwned::Hash &b)
+{
+  return a.quad.upper < b.quad.upper || (a.quad.upper == b.quad.upper && a.quad.lower < b.quad.lower);
+}
+
+inline bool hashEqual(const pwned::Hash &a, const pwned::Hash &b)
+{
+  return a.quad.upper == b.quad.upper && a.quad.lower == b.quad.lower;
+}
+
+/**
+ * Copies `length` bytes between two files, in the kernel if possible.
+ */
+bool copyRange(int fdIn, uint64_t offsetIn, int fdOut, uint64_t offsetOut, uint64_t length)
+{
+#if defined(__linux__)
+  while (length > 0)
+  {
+    loff_t in = loff_t(offsetIn);
+    loff_t out = loff_t(offsetOut);
+    const ssize_t n = copy_file_range(fdIn, &in, fdOut, &out, std::size_t(length), 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    offsetIn += uint64_t(n);
+    offsetOut += uint64_t(n);
+    length -= uint64_t(n);
+  }
+#endif
+  // not supported for this pair of files, or not on Linux at all
+  std::vector<char> buf(std::size_t(std::min<uint64_t>(length, BufferRecords * RecordSize)));
+  while (length > 0)
+  {
+    const ssize_t n = ::pread(fdIn, buf.data(), std::size_t(std::min<uint64_t>(length, buf.size())), off_t(offsetIn));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    ssize_t written = 0;
+    while (written < n)
+    {
+      const ssize_t w = ::pwrite(fdOut, buf.data() + written, std::size_t(n - written), off_t(offsetOut + uint64_t(written)));
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w <= 0)
+        return false;
+      written += w;
+    }
+    offsetIn += uint64_t(n);
+    offsetOut += uint64_t(n);
+    length -= uint64_t(n);
+  }
+  return true;
+}
+
+} // namespace
+
+class DeltaMergeOperationPrivate
+{
+public:
+  const fs::path basePath;
+  const fs::path deltaPath;
+  const fs::path dstFilePath;
+  ProgressCallback *progressed;
+  const std::vector<pwned::MergeSink *> sinks;
+  int baseFd{-1};
+  int dstFd{-1};
+  uint64_t baseRecords{0};
+  uint64_t deltaRecords{0};
+  // output position and pending records not yet written
+  uint64_t dstOffset{0};
+  uint64_t recordsOut{0};
+  std::vector<char> buffer;
+  std::size_t buffered{0};
+  uint64_t bytesCopied{0};
+  // writing resp. reading the base file failed
+  bool failed{false};
+  bool readFailed{false};
+
+  DeltaMergeOperationPrivate(const std::string &baseFile,
+                             const std::string &deltaFile,
+                             const std::string &dstFile,
+                             ProgressCallback *progressCallback,
+                             const std::vector<pwned::MergeSink *> &sinks)
+      : basePath(baseFile)
+      , deltaPath(deltaFile)
+      , dstFilePath(dstFile)
+      , progressed(progressCallback)
+      , sinks(sinks)
+      , buffer(BufferRecords * RecordSize)
+  {
+  }
+
+  ~DeltaMergeOperationPrivate()
+  {
+    if (baseFd >= 0)
+    {
+      ::close(baseFd);
+    }
+    if (dstFd >= 0)
+    {
+      ::close(dstFd);
+    }
+  }
+
+  bool baseRecordAt(uint64_t i, pwned::PasswordHashAndCount &phc) const
+  {
+    char record[RecordSize];
+    if (::pread(baseFd, record, RecordSize, off_t(i * RecordSize)) != ssize_t(RecordSize))
+      return false;
+    phc.deserialize(record);
+    return true;
+  }
+
+  // index of the first base record from `first` on whose hash is not less than `hash`
+  uint64_t lowerBound(uint64_t first, const pwned::Hash &hash) const
+  {
+    pwned::PasswordHashAndCount phc;
+    // gallop ahead, since consecutive delta keys tend to be close
+    uint64_t lo = first;
+    uint64_t step = 1;
+    while (lo + step <= baseRecords && baseRecordAt(lo + step - 1, phc) && hashLess(phc.hash, hash))
+    {
+      lo += step;
+      step *= 2;
+    }
+    uint64_t hi = std::min(lo + step - 1, baseRecords);
+    while (lo < hi)
+    {
+      const uint64_t mid = lo + (hi - lo) / 2;
+      if (baseRecordAt(mid, phc) && hashLess(phc.hash, hash))
+      {
+        lo = mid + 1;
+      }
+      else
+      {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  void emit(const pwned::PasswordHashAndCount &phc)
+  {
+    if (buffered == buffer.size())
+    {
+      flush();
+    }
+    phc.serialize(buffer.data() + buffered);
+    buffered += RecordSize;
+    for (pwned::MergeSink *sink : sinks)
+    {
+      sink->consume(phc, recordsOut);
+    }
+    ++recordsOut;
+  }
+
+  void flush()
+  {
+    std::size_t written = 0;
+    while (written < buffered && !failed)
+    {
+      const ssize_t n = ::pwrite(dstFd, buffer.data() + written, buffered - written, off_t(dstOffset + written));
+      if (n < 0 && errno == EINTR)
+        continue;
+      failed = n <= 0;
+      written += failed ? 0 : std::size_t(n);
+    }
+    pwned::dropWrittenPages(dstFd, dstOffset, written);
+    dstOffset += written;
+    buffered = 0;
+  }
+
+  // appends the base records [first, last) to the output
+  void copyBase(uint64_t first, uint64_t last)
+  {
+    if (first >= last)
+      return;
+    const uint64_t length = (last - first) * RecordSize;
+    const bool copyInKernel = last - first >= MinCopyRecords;
+    if (copyInKernel)
+    {
+      flush();
+      const std::vector<unsigned char> &cachedBefore = pwned::cachedPages(baseFd, first * RecordSize, length);
+      failed = failed || !copyRange(baseFd, first * RecordSize, dstFd, dstOffset, length);
+      pwned::dropReadPages(baseFd, first * RecordSize, length, cachedBefore);
+      pwned::dropWrittenPages(dstFd, dstOffset, length);
+      dstOffset += length;
+      bytesCopied += length;
+      if (sinks.empty())
+      {
+        recordsOut += last - first;
+        return;
+      }
+    }
+    // short spans go through the write buffer, and sinks need to see every record
+    pwned::BlockReader reader(basePath.string(), first * RecordSize, length, BufferRecords * RecordSize, 0);
+    pwned::PasswordHashAndCount phc;
+    for (uint64_t i = first; i < last && reader.read(phc); ++i)
+    {
+      if (copyInKernel)
+      {
+        for (pwned::MergeSink *sink : sinks)
+        {
+          sink->consume(phc, recordsOut);
+        }
+        ++recordsOut;
+      }
+      else
+      {
+        emit(phc);
+      }
+    }
+    readFailed = readFailed || reader.failed();
+  }
+};
+
+DeltaMergeOperation::DeltaMergeOperation(const std::string &baseFile,
+                                         const std::string &deltaFile,
+                                         const std::string &dstFile,
+                                         ProgressCallback *progressCallback,
+                                         const std::vector<pwned::MergeSink *> &sinks)
+    : d(std::shared_ptr<DeltaMergeOperationPrivate>(new DeltaMergeOperationPrivate(baseFile,
+                                                                                   deltaFile,
+                                                                                   dstFile,
+                                                                                   progressCallback,
+                                                                                   sinks)))
+{
+}
+
+void DeltaMergeOperation::execute() noexcept(false)
+{
+  if (isCancelled)
+    return;
+  auto t0 = std::chrono::high_resolution_clock::now();
+  if (pwned::BlockReader::isPacked(d->basePath.string()))
+  {
+    // spans of the base file are located and copied by their byte offsets
+    std::cerr << "'" << d->basePath.string() << "' is packed, cannot merge into it." << std::endl;
+    throw pwned::OperationException("Base file is packed", DeltaMergerError::packedBase);
+  }
+  d->baseRecords = fs::file_size(d->basePath) / RecordSize;
+  d->deltaRecords = pwned::BlockReader::recordCount(d->deltaPath.string());
+  {
+    std::ostringstream output;
+    output << "Merging " << d->deltaPath.string() << " (" << d->deltaRecords << " entries) into "
+           << d->basePath.string() << " (" << d->baseRecords << " entries) ..." << std::endl;
+    std::cout << output.str();
+  }
+  d->baseFd = ::open(d->basePath.string().c_str(), O_RDONLY);
+  pwned::BlockReader delta(d->deltaPath.string());
+  if (d->baseFd < 0 || !delta.isOpen())
+  {
+    std::cerr << "Cannot open input files: " << std::strerror(errno) << std::endl;
+    throw pwned::OperationException(std::string("Cannot read file: ") + std::strerror(errno), DeltaMergerError::cannotReadFile);
+  }
+  // opening it for writing would truncate the input before it's read
+  boost::system::error_code ec;
+  if (fs::equivalent(d->dstFilePath, d->basePath, ec) || fs::equivalent(d->dstFilePath, d->deltaPath, ec))
+  {
+    std::cerr << "'" << d->dstFilePath.string() << "' is an input of the merge, cannot write to it." << std::endl;
+    throw pwned::OperationException("Destination file is an input file", DeltaMergerError::dstIsInput);
+  }
+  d->dstFd = ::open(d->dstFilePath.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (d->dstFd < 0)
+  {
+    std::cerr << "Cannot open '" << d->dstFilePath.string() << "' for writing: " << std::strerror(errno) << std::endl;
+    throw pwned::OperationException(std::string("Cannot write to file: ") + std::strerror(errno), DeltaMergerError::cannotWriteToFile);
+  }
+  for (pwned::MergeSink *sink : d->sinks)
+  {
+    sink->begin(d->baseRecords + d->deltaRecords);
+  }
+  const uint64_t updateAfterEntries = std::max<uint64_t>(d->deltaRecords / 1000, 1);
+  uint64_t basePos = 0;
+  uint64_t deltaPos = 0;
+  pwned::PasswordHashAndCount deltaPhc;
+  while (!isCancelled && !d->failed && !d->readFailed && delta.read(deltaPhc))
+  {
+    const uint64_t next = d->lowerBound(basePos, deltaPhc.hash);
+    d->copyBase(basePos, next);
+    basePos = next;
+    pwned::PasswordHashAndCount basePhc;
+    if (basePos < d->baseRecords && d->baseRecordAt(basePos, basePhc) && hashEqual(basePhc.hash, deltaPhc.hash))
+    {
+      deltaPhc.count += basePhc.count;
+      ++basePos;
+    }
+    d->emit(deltaPhc);
+    if (d->progressed != nullptr && ++deltaPos % updateAfterEntries == 0)
+    {
+      (*d->progressed)(basePos + deltaPos);
+    }
+    if (isPaused)
+    {
+      queue->operationWait();
+      isPaused = false;
+    }
+  }
+  if (isCancelled)
+    return;
+  d->copyBase(basePos, d->baseRecords);
+  if (d->readFailed || delta.failed())
+  {
+    std::cerr << "Cannot read input files to their end." << std::endl;
+    throw pwned::OperationException("Cannot read file", DeltaMergerError::cannotReadFile);
+  }
+  d->flush();
+  if (d->failed || ::ftruncate(d->dstFd, off_t(d->dstOffset)) != 0 || ::close(d->dstFd) != 0)
+  {
+    d->dstFd = -1;
+    std::cerr << "Cannot write to '" << d->dstFilePath.string() << "': " << std::strerror(errno) << std::endl;
+    throw pwned::OperationException(std::string("Cannot write to file: ") + std::strerror(errno), DeltaMergerError::cannotWriteToFile);
+  }
+  d->dstFd = -1;
+  if (d->progressed != nullptr)
+  {
+    (*d->progressed)(d->baseRecords + d->deltaRecords);
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto time_span = std::chrono::duration_cast<std::chrono::duration<float>>(t1 - t0);
+  std::cout << std::endl
+            << pwned::readableSize(d->bytesCopied) << " of " << pwned::readableSize(d->dstOffset)
+            << " copied in the kernel ("
+            << pwned::readableTime(time_span.count()) << ")" << std::endl;
+}
+
+} // namespace merger
@@ -0,0 +1,60 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __deltamergeoperation_hpp__
+#define __deltamergeoperation_hpp__
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <pwned-lib/mergesink.hpp>
+#include <pwned-lib/operation.hpp>
+#include <pwned-lib/operationqueue.hpp>
+
+#include "progresscallback.hpp"
+
+namespace merger
+{
+
+class DeltaMergeOperationPrivate;
+
+/**
+ * Merges a small sorted delta file into a large sorted base file.
+ *
+ * For every delta record the position of its hash in the base file is
+ * looked up by galloping search, and the untouched span of base records in
+ * front of it is copied into the output with `copy_file_range()`, which lets
+ * the kernel (or a reflink capable file system) move the data without a
+ * detour through user space. Only records whose hash occurs in the delta
+ * and short spans are read and written by the operation itself.
+ */
+class DeltaMergeOperation : public pwned::Operation
+{
+public:
+  std::shared_ptr<DeltaMergeOperationPrivate> d;
+  DeltaMergeOperation(const std::string &baseFile,
+                      const std::string &deltaFile,
+                      const std::string &dstFile,
+                      ProgressCallback * = nullptr,
+                      const std::vector<pwned::MergeSink *> &sinks = {});
+  void execute() noexcept(false) override;
+};
+
+} // namespace merger
+
+#endif // __deltamergeoperation_hpp__
@@ -16,17 +16,27 @@
  */
 
 #include <iostream>
-#include <queue>
+#include <sstream>
 #include <string>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <boost/filesystem.hpp>
 
 #include <pwned-lib/util.hpp>
 #include <pwned-lib/hash.hpp>
 #include <pwned-lib/passwordhashandcount.hpp>
+#include <pwned-lib/losertree.hpp>
+#include <pwned-lib/blockio.hpp>
+#include <pwned-lib/threadpool.hpp>
 
 #include "mergeoperation.hpp"
 #include "inputfile.hpp"
@@ -37,59 +47,312 @@ namespace fs = boost::filesystem;
 namespace merger
 {
 
-struct SmallestHashFirst
+enum MergerError
+{
+  noData,
+  cannotWriteToFile,
+  cancelled,
+  cannotReadFile
+};
+
+namespace
+{
+
+// partitions smaller than this are not worth a thread of their own
+constexpr uint64_t MinEntriesPerPartition = 1ULL << 16;
+// inputs of a partition are read synchronously in blocks of this size
+constexpr std::size_t PartitionReadBlockSize = 4 * 4096 * pwned::PasswordHashAndCount::size;
+constexpr uint64_t ProgressGranularity = 1ULL << 16;
+
+struct RangeSource
 {
-  bool operator()(const MergerInput *lhs, const MergerInput *rhs)
+  pwned::PasswordHashAndCount phc;
+  std::unique_ptr<pwned::BlockReader> reader;
+  // index of the record after `phc` in the input file
+  uint64_t next{0};
+  bool valid{false};
+
+  inline bool read()
   {
-    return lhs->phc.hash > rhs->phc.hash;
+    valid = reader->read(phc);
+    if (valid)
+    {
+      ++next;
+    }
+    return valid;
   }
 };
 
-enum MergerError
+// receives the index of the next record to merge from each input and the
+// last record handed to `emit`
+using SaveCheckpoint = std::function<void(const std::vector<uint64_t> &, const pwned::PasswordHashAndCount &)>;
+
+struct Partition
 {
-  noData,
-  cannotWriteToFile,
-  cancelled
+  // [first, last) record indexes per input file
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  uint64_t uniqueEntries{0};
+  uint64_t offset{0};
 };
 
+/**
+ * Returns the index of the first record in the sorted file `fd` of
+ * `n` records whose upper hash half is not less than `upper`.
+ */
+uint64_t lowerBound(int fd, uint64_t n, uint64_t upper)
+{
+  uint64_t lo = 0;
+  uint64_t hi = n;
+  pwned::Hash hash;
+  while (lo < hi)
+  {
+    const uint64_t mid = lo + (hi - lo) / 2;
+    if (pread(fd, hash.data, pwned::Hash::size, off_t(mid * pwned::PasswordHashAndCount::size)) != pwned::Hash::size)
+      return n;
+    if (hash.quad.upper < upper)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+[[noreturn]] void readFailed(const std::string &filename)
+{
+  std::cerr << "Cannot read '" << filename << "'" << std::endl;
+  throw pwned::OperationException("Cannot read file", MergerError::cannotReadFile);
+}
+
+// throws if an input ended before its range did
+void checkRead(const std::vector<RangeSource> &sources, const std::vector<InputFile> &files)
+{
+  for (std::size_t i = 0; i < sources.size(); ++i)
+  {
+    if (sources[i].reader->failed())
+    {
+      readFailed(files[i].path.string());
+    }
+  }
+}
+
+/**
+ * Merges the key range of `partition` and hands each resulting record to
+ * `emit`. Every `interval` and when cancelled `save` is called right after
+ * a record has been emitted, if given. Returns false if cancelled and
+ * throws if an input cannot be read.
+ */
+template <typename Emit>
+bool mergeRange(const Partition &partition,
+                const std::vector<InputFile> &files,
+                Emit emit,
+                const SaveCheckpoint &save,
+                std::chrono::seconds interval,
+                std::atomic<uint64_t> &processed,
+                const std::atomic<bool> &isCancelled,
+                const std::atomic<bool> &isPaused)
+{
+  std::vector<RangeSource> sources(files.size());
+  std::vector<RangeSource *> pointers;
+  std::vector<bool> valid;
+  for (std::size_t i = 0; i < files.size(); ++i)
+  {
+    const auto &range = partition.ranges[i];
+    sources[i].reader.reset(new pwned::BlockReader(files[i].path.string(),
+                                                   range.first * pwned::PasswordHashAndCount::size,
+                                                   (range.second - range.first) * pwned::PasswordHashAndCount::size,
+                                                   PartitionReadBlockSize,
+                                                   0));
+    sources[i].next = range.first;
+    pointers.push_back(&sources[i]);
+    valid.push_back(sources[i].read());
+  }
+  pwned::LoserTree<RangeSource> tree(pointers, valid);
+  if (tree.empty())
+  {
+    checkRead(sources, files);
+    return true;
+  }
+  pwned::PasswordHashAndCount current = tree.top()->phc;
+  current.count = 0;
+  uint64_t n = 0;
+  auto nextCheckpoint = std::chrono::steady_clock::now() + interval;
+  bool checkpointDue = false;
+  while (!tree.empty())
+  {
+    const pwned::PasswordHashAndCount &p = tree.top()->phc;
+    if (current.hash.quad.upper == p.hash.quad.upper && current.hash.quad.lower == p.hash.quad.lower)
+    {
+      current.count += p.count;
+    }
+    else
+    {
+      emit(current);
+      if (checkpointDue)
+      {
+        // all records in front of the current ones have been emitted
+        std::vector<uint64_t> next;
+        for (const auto &source : sources)
+        {
+          next.push_back(source.valid ? source.next - 1 : source.next);
+        }
+        save(next, current);
+        if (isCancelled)
+          return false;
+        checkpointDue = false;
+        nextCheckpoint = std::chrono::steady_clock::now() + interval;
+      }
+      current = p;
+    }
+    tree.pop();
+    if (++n == ProgressGranularity)
+    {
+      processed += n;
+      n = 0;
+      while (isPaused && !isCancelled)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      if (save)
+      {
+        checkpointDue = isCancelled || std::chrono::steady_clock::now() >= nextCheckpoint;
+      }
+      else if (isCancelled)
+        return false;
+    }
+  }
+  checkRead(sources, files);
+  emit(current);
+  processed += n;
+  return true;
+}
+
+/**
+ * Hands the first `records` records from `offset` on in `filename` to
+ * `sinks`, as if they had just been merged.
+ */
+template <typename Sinks>
+void replay(const std::string &filename, uint64_t offset, uint64_t records, const Sinks &sinks)
+{
+  if (sinks.empty() || records == 0)
+    return;
+  pwned::BlockReader reader(filename, offset, records * pwned::PasswordHashAndCount::size, pwned::BlockReader::DefaultBlockSize);
+  pwned::PasswordHashAndCount phc;
+  uint64_t index = offset / pwned::PasswordHashAndCount::size;
+  while (reader.read(phc))
+  {
+    for (const auto &sink : sinks)
+    {
+      sink->consume(phc, index);
+    }
+    ++index;
+  }
+  if (reader.failed())
+  {
+    readFailed(filename);
+  }
+}
+
+// true if the raw file `filename` holds `records` records up to `offset`, the last with hash `lastHash`
+bool endsWith(const std::string &filename, uint64_t offset, uint64_t records, const std::string &lastHash)
+{
+  if (records == 0)
+    return true;
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  char data[pwned::PasswordHashAndCount::size];
+  const bool ok = offset >= pwned::PasswordHashAndCount::size &&
+                  pread(fd, data, sizeof(data), off_t(offset - sizeof(data))) == ssize_t(sizeof(data));
+  ::close(fd);
+  if (!ok)
+    return false;
+  pwned::PasswordHashAndCount phc;
+  phc.deserialize(data);
+  return phc.hash.toString() == lastHash;
+}
+
+} // namespace
+
 class MergeOperationPrivate
 {
 public:
-  std::priority_queue<MergerInput *, std::vector<MergerInput *>, SmallestHashFirst> pq;
+  const std::vector<InputFile> srcFiles;
   const fs::path dstFilePath;
-  std::ofstream dstFile;
   uint64_t entriesProcessed;
   bool removeInputFilesAfterMerge;
+  const unsigned int numPartitions;
   ProgressCallback *progressed;
-  uint64_t totalEntries;
+  const std::vector<pwned::MergeSink *> sinks;
+  const pwned::RecordFormat outputFormat;
+  uint64_t totalEntries{0};
+  bool packedInput{false};
+  Checkpoint *checkpoint{nullptr};
+  std::size_t step{0};
+  // states of the key ranges to continue from
+  std::vector<MergeState> resumed;
 
   MergeOperationPrivate(const std::vector<InputFile> &srcFiles,
                         const std::string &dstFilename,
                         bool removeInputFilesAfterMerge,
-                        ProgressCallback *progressCallback)
-      : dstFilePath(dstFilename)
+                        unsigned int numPartitions,
+                        ProgressCallback *progressCallback,
+                        const std::vector<pwned::MergeSink *> &sinks,
+                        pwned::RecordFormat outputFormat)
+      : srcFiles(srcFiles)
+      , dstFilePath(dstFilename)
       , entriesProcessed(0)
       , removeInputFilesAfterMerge(removeInputFilesAfterMerge)
+      , numPartitions(std::max(1U, numPartitions))
       , progressed(progressCallback)
+      , sinks(sinks)
+      , outputFormat(outputFormat)
   {
-    uint64_t sum = 0;
-    for (auto file : srcFiles)
+    for (const auto &file : srcFiles)
     {
-      MergerInput *mi = new MergerInput(file);
-      mi->open();
-      pq.push(mi);
-      sum += mi->inputSize.value();
+      totalEntries += pwned::BlockReader::recordCount(file.path.string());
+      packedInput = packedInput || pwned::BlockReader::isPacked(file.path.string());
     }
-    totalEntries = sum / pwned::PasswordHashAndCount::size;
   }
 
-  ~MergeOperationPrivate()
+  bool isCheckpointing() const
+  {
+    return checkpoint != nullptr && checkpoint->interval() > 0;
+  }
+
+  std::chrono::seconds checkpointInterval() const
   {
-    while (!pq.empty())
+    return std::chrono::seconds(isCheckpointing() ? checkpoint->interval() : 0);
+  }
+
+  // a saved state is only used if the output still looks like it did back then
+  bool canResume(const std::vector<MergeState> &progress, bool rawOnly) const
+  {
+    if (progress.empty() || (progress.size() > 1 && !rawOnly))
+      return false;
+    boost::system::error_code ec;
+    const uint64_t dstSize = fs::file_size(dstFilePath, ec);
+    if (ec)
+      return false;
+    for (const auto &state : progress)
+    {
+      if (state.inputRecords.size() != srcFiles.size() || state.outputBytes > dstSize)
+        return false;
+      if (outputFormat == pwned::RecordFormat::raw && !endsWith(dstFilePath.string(), state.outputBytes, state.recordsWritten, state.lastHash))
+        return false;
+    }
+    return true;
+  }
+
+  void removeInputFiles() const
+  {
+    for (const auto &file : srcFiles)
     {
-      MergerInput *mi = pq.top();
-      pq.pop();
-      delete mi;
+      boost::system::error_code ec;
+      fs::remove(file.path, ec);
     }
   }
 };
@@ -97,12 +360,36 @@ public:
 MergeOperation::MergeOperation(const std::vector<InputFile> &srcFiles,
                                const std::string &dstFile,
                                bool removeInputFilesAfterMerge,
-                               ProgressCallback *progressCallback)
+                               unsigned int numPartitions,
+                               ProgressCallback *progressCallback,
+                               const std::vector<pwned::MergeSink *> &sinks,
+                               pwned::RecordFormat outputFormat)
     : d(std::shared_ptr<MergeOperationPrivate>(new MergeOperationPrivate(srcFiles,
                                                                          dstFile,
                                                                          removeInputFilesAfterMerge,
-                                                                         progressCallback)))
+                                                                         numPartitions,
+                                                                         progressCallback,
+                                                                         sinks,
+                                                                         outputFormat)))
+{
+}
+
+void MergeOperation::setCheckpoint(Checkpoint *checkpoint, std::size_t step)
+{
+  d->checkpoint = checkpoint;
+  d->step = step;
+}
+
+unsigned int MergeOperation::filesPerInput(unsigned int numPartitions)
 {
+  return std::max(1U, numPartitions);
+}
+
+uint64_t MergeOperation::memoryPerInput(unsigned int numPartitions)
+{
+  const uint64_t sequential = pwned::BlockReader::DefaultBlockSize * (pwned::BlockReader::DefaultQueueDepth + 1);
+  const uint64_t partitioned = uint64_t(PartitionReadBlockSize) * numPartitions;
+  return std::max(sequential, partitioned);
 }
 
 void MergeOperation::execute() noexcept(false)
@@ -110,98 +397,392 @@ void MergeOperation::execute() noexcept(false)
   if (isCancelled)
     return;
   auto t0 = std::chrono::high_resolution_clock::now();
-  if (d->pq.empty())
+  if (d->srcFiles.empty())
   {
     return;
   }
+  // partitions are located and written by byte offsets, which packed files don't have
+  const bool rawOnly = !d->packedInput && d->outputFormat == pwned::RecordFormat::raw;
+  if (d->checkpoint != nullptr)
+  {
+    const std::vector<MergeState> &progress = d->checkpoint->progress(d->step);
+    if (d->canResume(progress, rawOnly))
+    {
+      d->resumed = progress;
+    }
+  }
+  // a merge continues with the partitions it was started with
+  const unsigned int numPartitions = !d->resumed.empty()
+                                         ? unsigned(d->resumed.size())
+                                         : rawOnly ? unsigned(std::min<uint64_t>(d->numPartitions, d->totalEntries / MinEntriesPerPartition)) : 1U;
   {
     std::ostringstream output;
-    output << "Merging into " << d->dstFilePath.string()
-           << " (" << d->pq.size() << " files, " << d->totalEntries << " entries) ..."
-           << std::endl;
+    output << (d->resumed.empty() ? "Merging into " : "Resuming merge into ") << d->dstFilePath.string()
+           << " (" << d->srcFiles.size() << " files, " << d->totalEntries << " entries";
+    if (numPartitions > 1)
+    {
+      output << ", " << numPartitions << " partitions";
+    }
+    output << ") ..." << std::endl;
     std::cout << output.str();
   }
-  d->dstFile.open(d->dstFilePath.string(), std::ios::out | std::ios::binary);
-  if (!d->dstFile.is_open())
+  if (numPartitions > 1)
+  {
+    mergePartitioned(numPartitions);
+  }
+  else
+  {
+    mergeSequentially();
+  }
+  if (d->progressed != nullptr)
+  {
+    (*d->progressed)(d->entriesProcessed);
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto time_span = std::chrono::duration_cast<std::chrono::duration<float>>(t1 - t0);
+  std::cout << "(" << pwned::readableTime(time_span.count()) << ")" << std::endl;
+}
+
+void MergeOperation::mergeSequentially()
+{
+  const MergeState *resumed = d->resumed.empty() ? nullptr : &d->resumed.front();
+  std::vector<std::unique_ptr<MergerInput>> inputs;
+  std::vector<MergerInput *> pointers;
+  std::vector<bool> valid;
+  for (std::size_t i = 0; i < d->srcFiles.size(); ++i)
+  {
+    inputs.emplace_back(new MergerInput(d->srcFiles[i]));
+    inputs.back()->open(resumed != nullptr ? resumed->inputRecords[i] : 0);
+    if (inputs.back()->failed())
+    {
+      readFailed(inputs.back()->path.string());
+    }
+    pointers.push_back(inputs.back().get());
+    valid.push_back(inputs.back()->isValid);
+  }
+  pwned::LoserTree<MergerInput> tree(pointers, valid);
+  if (tree.empty())
+    return;
+  std::unique_ptr<pwned::BlockWriter> dstFile(resumed != nullptr
+                                                  ? new pwned::BlockWriter(d->dstFilePath.string(),
+                                                                           d->outputFormat,
+                                                                           resumed->outputBytes,
+                                                                           resumed->recordsWritten)
+                                                  : new pwned::BlockWriter(d->dstFilePath.string(),
+                                                                           pwned::BlockWriter::DefaultBlockSize,
+                                                                           pwned::BlockWriter::DefaultQueueDepth,
+                                                                           d->outputFormat));
+  if (!dstFile->isOpen())
   {
     std::cerr << "Cannot open '" << d->dstFilePath.string() << "' for writing: " << std::strerror(errno) << std::endl;
     throw pwned::OperationException(std::string("Cannot write to file: ") + std::strerror(errno), MergerError::cannotWriteToFile);
-    return;
   }
-  pwned::PasswordHashAndCount current = d->pq.top()->phc;
+  for (pwned::MergeSink *sink : d->sinks)
+  {
+    sink->begin(d->totalEntries);
+  }
+  uint64_t recordsWritten = 0;
+  if (resumed != nullptr)
+  {
+    replay(d->dstFilePath.string(), 0, resumed->recordsWritten, d->sinks);
+    recordsWritten = resumed->recordsWritten;
+    for (uint64_t n : resumed->inputRecords)
+    {
+      d->entriesProcessed += n;
+    }
+  }
+  auto emit = [this, &dstFile, &recordsWritten](const pwned::PasswordHashAndCount &phc) {
+    dstFile->write(phc);
+    for (pwned::MergeSink *sink : d->sinks)
+    {
+      sink->consume(phc, recordsWritten);
+    }
+    ++recordsWritten;
+  };
+  auto save = [this, &dstFile, &inputs, &recordsWritten](const pwned::PasswordHashAndCount &last) {
+    if (!dstFile->sync())
+      return;
+    MergeState state;
+    state.recordsWritten = recordsWritten;
+    state.outputBytes = dstFile->position();
+    state.lastHash = last.hash.toString();
+    for (const auto &input : inputs)
+    {
+      state.inputRecords.push_back(input->recordsConsumed());
+    }
+    d->checkpoint->update(d->step, 0, 1, state);
+  };
+  pwned::PasswordHashAndCount current = tree.top()->phc;
+  current.count = 0;
   uint64_t updateAfterEntries = std::max<uint64_t>(d->totalEntries / 1000, 1);
-  while (!isCancelled)
+  const bool checkpointing = d->isCheckpointing();
+  auto nextCheckpoint = std::chrono::steady_clock::now() + d->checkpointInterval();
+  bool checkpointDue = false;
+  while (!tree.empty())
   {
-    const pwned::PasswordHashAndCount &p = next();
-    if (!d->pq.empty())
+    MergerInput *mergerInput = tree.top();
+    const pwned::PasswordHashAndCount &p = mergerInput->phc;
+    if (d->progressed != nullptr && d->entriesProcessed % updateAfterEntries == 0)
     {
-      if (d->progressed != nullptr && d->entriesProcessed % updateAfterEntries == 0)
+      (*d->progressed)(d->entriesProcessed);
+    }
+    if (checkpointing && d->entriesProcessed % ProgressGranularity == 0)
+    {
+      checkpointDue = std::chrono::steady_clock::now() >= nextCheckpoint;
+    }
+    ++d->entriesProcessed;
+    if (current.hash.quad.upper == p.hash.quad.upper && current.hash.quad.lower == p.hash.quad.lower)
+    {
+      current.count += p.count;
+    }
+    else
+    {
+      emit(current);
+      // all records in front of the current ones have been emitted
+      if (checkpointing && (checkpointDue || isCancelled))
       {
-        (*d->progressed)(d->entriesProcessed);
+        save(current);
+        checkpointDue = false;
+        nextCheckpoint = std::chrono::steady_clock::now() + d->checkpointInterval();
       }
-      ++d->entriesProcessed;
-      if (current.hash == p.hash)
+      if (isCancelled)
+        break;
+      current = p;
+    }
+    if (!tree.pop())
+    {
+      if (mergerInput->failed())
       {
-        current.count += p.count;
+        readFailed(mergerInput->path.string());
       }
-      else
+      if (d->removeInputFilesAfterMerge)
       {
-        current.dump(d->dstFile);
-        current = p;
+        mergerInput->deleteFile();
       }
     }
-    else
-    {
-      current.dump(d->dstFile);
-      break;
-    }
     if (isPaused)
     {
       queue->operationWait();
       isPaused = false;
     }
   }
-  d->dstFile.close();
-  if (d->progressed != nullptr)
+  if (!isCancelled)
   {
-    (*d->progressed)(d->entriesProcessed);
+    emit(current);
+    if (d->removeInputFilesAfterMerge)
+    {
+      // empty input files never took part in the tournament
+      d->removeInputFiles();
+    }
+  }
+  if (!dstFile->close())
+  {
+    std::cerr << "Cannot write to '" << d->dstFilePath.string() << "': " << std::strerror(errno) << std::endl;
+    throw pwned::OperationException(std::string("Cannot write to file: ") + std::strerror(errno), MergerError::cannotWriteToFile);
   }
-  auto t1 = std::chrono::high_resolution_clock::now();
-  auto time_span = std::chrono::duration_cast<std::chrono::duration<float>>(t1 - t0);
-  std::cout << "(" << pwned::readableTime(time_span.count()) << ")" << std::endl;
 }
 
-pwned::PasswordHashAndCount MergeOperation::next()
+/**
+ * Splits the uniformly distributed MD5 key space into `numPartitions`
+ * ranges and locates their boundaries in every input by binary search.
+ * A first, read-only pass merges all ranges concurrently to count their
+ * unique hashes, which yields the exact offset of each range in the output
+ * file. The second pass merges the ranges concurrently again and writes
+ * them into their regions of the pre-sized output file.
+ * A checkpoint taken after the first pass holds the sizes of the ranges,
+ * so a resumed merge only continues the second one.
+ */
+void MergeOperation::mergePartitioned(unsigned int numPartitions)
 {
-  pwned::PasswordHashAndCount result;
-  if (!d->pq.empty())
+  std::vector<Partition> partitions(numPartitions);
+  for (const auto &file : d->srcFiles)
+  {
+    const int fd = ::open(file.path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      std::cerr << "Cannot open '" << file.path.string() << "' for reading: " << std::strerror(errno) << std::endl;
+      throw pwned::OperationException(std::string("Cannot read file: ") + std::strerror(errno), MergerError::noData);
+    }
+    const uint64_t n = file.inputSize.value() / pwned::PasswordHashAndCount::size;
+    uint64_t first = 0;
+    for (unsigned int p = 0; p < numPartitions; ++p)
+    {
+      const uint64_t last = p + 1 == numPartitions
+                                ? n
+                                : lowerBound(fd, n, uint64_t(((unsigned __int128)(p + 1) << 64) / numPartitions));
+      partitions[p].ranges.emplace_back(first, last);
+      first = last;
+    }
+    ::close(fd);
+  }
+
+  std::atomic<uint64_t> processed{0};
+  // runs `job` on every partition as a task of the thread pool while this
+  // thread reports progress and honors pause requests; in between it helps
+  // with the tasks, so the partitions get done even if all workers are busy
+  auto runConcurrently = [this, &partitions, &processed](const std::function<bool(Partition &)> &job) {
+    std::vector<char> succeeded(partitions.size(), 0);
+    pwned::TaskGroup tasks;
+    for (std::size_t p = 0; p < partitions.size(); ++p)
+    {
+      tasks.run([&job, &partitions, &succeeded, p] {
+        succeeded[p] = job(partitions[p]) ? 1 : 0;
+      });
+    }
+    while (!tasks.waitFor(std::chrono::milliseconds(100)))
+    {
+      // every input record is visited once per pass
+      d->entriesProcessed = processed / 2;
+      if (d->progressed != nullptr)
+      {
+        (*d->progressed)(d->entriesProcessed);
+      }
+      if (isPaused)
+      {
+        queue->operationWait();
+        isPaused = false;
+      }
+    }
+    return std::all_of(succeeded.begin(), succeeded.end(), [](char ok) { return ok != 0; });
+  };
+
+  const bool resumed = !d->resumed.empty();
+  if (resumed)
   {
-    MergerInput *mergerInput = d->pq.top();
-    result = mergerInput->phc;
-    if (mergerInput->isValid)
+    for (std::size_t p = 0; p < partitions.size(); ++p)
     {
-      mergerInput->read();
-      if (mergerInput->isValid)
+      partitions[p].uniqueEntries = d->resumed[p].uniqueEntries;
+    }
+    processed = d->totalEntries;
+  }
+  else
+  {
+    const bool counted = runConcurrently([this, &processed](Partition &partition) {
+      return mergeRange(
+          partition, d->srcFiles, [&partition](const pwned::PasswordHashAndCount &) { ++partition.uniqueEntries; },
+          SaveCheckpoint(), std::chrono::seconds(0), processed, isCancelled, isPaused);
+    });
+    if (!counted || isCancelled)
+      return;
+  }
+  uint64_t totalUniqueEntries = 0;
+  for (auto &partition : partitions)
+  {
+    partition.offset = totalUniqueEntries * pwned::PasswordHashAndCount::size;
+    totalUniqueEntries += partition.uniqueEntries;
+  }
+  const int fd = ::open(d->dstFilePath.string().c_str(), resumed ? O_WRONLY : O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ::ftruncate(fd, off_t(totalUniqueEntries * pwned::PasswordHashAndCount::size)) != 0)
+  {
+    std::cerr << "Cannot open '" << d->dstFilePath.string() << "' for writing: " << std::strerror(errno) << std::endl;
+    if (fd >= 0)
+    {
+      ::close(fd);
+    }
+    throw pwned::OperationException(std::string("Cannot write to file: ") + std::strerror(errno), MergerError::cannotWriteToFile);
+  }
+  // where each partition starts writing
+  std::vector<MergeState> starts(d->resumed);
+  if (!resumed)
+  {
+    for (std::size_t p = 0; p < partitions.size(); ++p)
+    {
+      MergeState state;
+      state.uniqueEntries = partitions[p].uniqueEntries;
+      state.outputBytes = partitions[p].offset;
+      for (const auto &range : partitions[p].ranges)
       {
-        d->pq.pop();
-        d->pq.push(mergerInput);
+        state.inputRecords.push_back(range.first);
       }
+      starts.push_back(state);
     }
-    else
+    // the first pass needn't be repeated
+    if (d->isCheckpointing())
     {
-      d->pq.pop();
-      if (d->removeInputFilesAfterMerge)
+      for (std::size_t p = 0; p < starts.size(); ++p)
       {
-        mergerInput->deleteFile();
+        d->checkpoint->update(d->step, p, starts.size(), starts[p]);
+      }
+    }
+  }
+  // every partition feeds its own section of each sink
+  std::vector<std::vector<std::unique_ptr<pwned::MergeSink>>> sections(partitions.size());
+  for (pwned::MergeSink *sink : d->sinks)
+  {
+    sink->begin(totalUniqueEntries);
+    for (auto &partitionSections : sections)
+    {
+      partitionSections.push_back(sink->fork());
+    }
+  }
+  bool written = false;
+  try
+  {
+    written = runConcurrently([this, fd, &processed, &partitions, &sections, &starts](Partition &partition) {
+      const std::size_t p = std::size_t(&partition - partitions.data());
+      const auto &partitionSections = sections[p];
+      const MergeState &start = starts[p];
+      Partition remaining(partition);
+      for (std::size_t i = 0; i < remaining.ranges.size(); ++i)
+      {
+        processed += start.inputRecords[i] - remaining.ranges[i].first;
+        remaining.ranges[i].first = start.inputRecords[i];
       }
-      delete mergerInput;
-      if (d->pq.empty())
+      replay(d->dstFilePath.string(), partition.offset, start.recordsWritten, partitionSections);
+      pwned::BlockWriter writer(fd, start.outputBytes);
+      uint64_t index = start.outputBytes / pwned::PasswordHashAndCount::size;
+      SaveCheckpoint save;
+      if (d->isCheckpointing())
       {
-        return pwned::PasswordHashAndCount();
+        save = [this, p, &partition, &writer, &index, &partitions](const std::vector<uint64_t> &next, const pwned::PasswordHashAndCount &last) {
+          if (!writer.sync())
+            return;
+          MergeState state;
+          state.uniqueEntries = partition.uniqueEntries;
+          state.recordsWritten = index - partition.offset / pwned::PasswordHashAndCount::size;
+          state.outputBytes = writer.position();
+          state.lastHash = last.hash.toString();
+          state.inputRecords = next;
+          d->checkpoint->update(d->step, p, partitions.size(), state);
+        };
       }
+      const bool ok = mergeRange(
+          remaining, d->srcFiles, [&writer, &partitionSections, &index](const pwned::PasswordHashAndCount &phc) {
+            writer.write(phc);
+            for (const auto &section : partitionSections)
+            {
+              section->consume(phc, index);
+            }
+            ++index;
+          },
+          save, d->checkpointInterval(), processed, isCancelled, isPaused);
+      return writer.close() && ok;
+    });
+  }
+  catch (...)
+  {
+    ::close(fd);
+    throw;
+  }
+  const int closeError = ::close(fd) == 0 ? 0 : errno;
+  if (isCancelled)
+    return;
+  if (!written || closeError != 0)
+  {
+    std::cerr << "Cannot write to '" << d->dstFilePath.string() << "'" << std::endl;
+    throw pwned::OperationException("Cannot write to file", MergerError::cannotWriteToFile);
+  }
+  for (std::size_t i = 0; i < d->sinks.size(); ++i)
+  {
+    for (auto &partitionSections : sections)
+    {
+      d->sinks[i]->join(*partitionSections[i]);
     }
   }
-  return result;
+  if (d->removeInputFilesAfterMerge)
+  {
+    d->removeInputFiles();
+  }
 }
 
 } // namespace merger
@@ -21,12 +21,16 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <cstdint>
 
+#include <pwned-lib/blockio.hpp>
 #include <pwned-lib/passwordhashandcount.hpp>
+#include <pwned-lib/mergesink.hpp>
 #include <pwned-lib/operation.hpp>
 #include <pwned-lib/operationqueue.hpp>
 
 #include "progresscallback.hpp"
+#include "checkpoint.hpp"
 #include "inputfile.hpp"
 #include "mergerinput.hpp"
 
@@ -42,9 +46,22 @@ public:
   MergeOperation(const std::vector<InputFile> &srcFiles,
                  const std::string &dstFile,
                  bool removeInputFilesAfterMerge,
-                 ProgressCallback * = nullptr);
+                 unsigned int numPartitions = 1,
+                 ProgressCallback * = nullptr,
+                 const std::vector<pwned::MergeSink *> &sinks = {},
+                 pwned::RecordFormat outputFormat = pwned::RecordFormat::raw);
   void execute() noexcept(false) override;
-  pwned::PasswordHashAndCount next();
+  // saves the progress of the merge as `step` of the plan in `checkpoint`
+  // and continues from there if it holds a state for this step
+  void setCheckpoint(Checkpoint *checkpoint, std::size_t step);
+
+  // file descriptors and buffer memory a merge needs per input file at most
+  static unsigned int filesPerInput(unsigned int numPartitions);
+  static uint64_t memoryPerInput(unsigned int numPartitions);
+
+private:
+  void mergeSequentially();
+  void mergePartitioned(unsigned int numPartitions);
 };
 
 } // namespace merger
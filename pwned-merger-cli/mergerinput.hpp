@@ -18,12 +18,14 @@
 #ifndef __mergerinput_hpp__
 #define __mergerinput_hpp__
 
-#include <iostream>
-#include <fstream>
+#include <limits>
+#include <memory>
+#include <cstdint>
 
 #include <boost/filesystem.hpp>
 
 #include <pwned-lib/passwordhashandcount.hpp>
+#include <pwned-lib/blockio.hpp>
 
 #include "inputfile.hpp"
 
@@ -35,30 +37,65 @@ class MergerInput : public InputFile
 public:
   pwned::PasswordHashAndCount phc;
   bool isValid{false};
-  std::ifstream f;
+  uint64_t recordsRead{0};
+  std::unique_ptr<pwned::BlockReader> reader;
 
   explicit MergerInput(const InputFile &inputFile)
       : InputFile(inputFile)
   {
   }
 
-  void open()
+  void open(uint64_t skipRecords = 0)
   {
-    f.open(path.string(), std::ios::binary);
-    if (f.is_open())
+    const bool seekable = skipRecords > 0 && !pwned::BlockReader::isPacked(path.string());
+    if (seekable)
     {
-      read();
+      reader.reset(new pwned::BlockReader(path.string(),
+                                          skipRecords * pwned::PasswordHashAndCount::size,
+                                          std::numeric_limits<uint64_t>::max(),
+                                          pwned::BlockReader::DefaultBlockSize));
+      recordsRead = skipRecords;
+    }
+    else
+    {
+      reader.reset(new pwned::BlockReader(path.string()));
+      recordsRead = 0;
+    }
+    if (reader->isOpen())
+    {
+      // packed files have no record offsets, so records are skipped by reading them
+      do
+      {
+        read();
+      } while (isValid && recordsRead <= skipRecords);
     }
   }
 
   inline bool read()
   {
-    isValid = phc.read(f);
+    isValid = reader->read(phc);
+    if (isValid)
+    {
+      ++recordsRead;
+    }
     return isValid;
   }
 
+  // true if the file could not be read to its end
+  inline bool failed() const
+  {
+    return reader != nullptr && reader->failed();
+  }
+
+  // index of the record `phc` holds, i.e. the number of records merged so far
+  inline uint64_t recordsConsumed() const
+  {
+    return isValid ? recordsRead - 1 : recordsRead;
+  }
+
   void deleteFile()
   {
+    reader.reset();
     boost::filesystem::remove(path);
   }
 };
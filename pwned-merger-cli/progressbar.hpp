@@ -61,6 +61,8 @@ public:
 
   void update(uint64_t value) override
   {
+    if (hi == 0)
+      return;
     std::cout << '\r' << begin;
     const int w = int(uint64_t(width) * value / hi);
     for (int i = 0; i < w; ++i)
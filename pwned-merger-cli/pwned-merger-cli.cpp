@@ -22,6 +22,8 @@
 #include <vector>
 #include <iterator>
 #include <thread>
+#include <atomic>
+#include <memory>
 #include <algorithm>
 #include <chrono>
 
@@ -30,13 +32,19 @@
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/program_options.hpp>
 
+#include <pwned-lib/blockio.hpp>
 #include <pwned-lib/operation.hpp>
 #include <pwned-lib/operationqueue.hpp>
 #include <pwned-lib/util.hpp>
+#include <pwned-lib/pagecache.hpp>
+#include <pwned-lib/mergeplan.hpp>
+#include <pwned-lib/mergesink.hpp>
 #include <pwned-lib/uuid.hpp>
 
 #include "progresscallback.hpp"
+#include "checkpoint.hpp"
 #include "mergeoperation.hpp"
+#include "deltamergeoperation.hpp"
 #include "progressbar.hpp"
 
 namespace fs = boost::filesystem;
@@ -79,7 +87,13 @@ void usage()
 int main(int argc, const char *argv[])
 {
   const std::string DefaultOutputExt = ".md5";
-  constexpr int DefaultMaxFilesAtOnce = 50;
+  constexpr int DefaultMaxFilesAtOnce = 0;
+  constexpr unsigned int DefaultConcurrentMerges = 2;
+  constexpr unsigned int DefaultBits = 24;
+  constexpr unsigned int DefaultCheckpointInterval = 60;
+  const std::string CheckpointFilename = "checkpoint.json";
+  pwned::MemoryStat memStat;
+  pwned::getMemoryStat(memStat);
   std::vector<std::string> filenames;
   std::string srcDirectory;
   std::string dstFile;
@@ -87,12 +101,40 @@ int main(int argc, const char *argv[])
   std::string outputExt;
   std::string inputExt = DefaultOutputExt;
   int maxFilesAtOnce;
+  unsigned int numPartitions;
+  unsigned int numConcurrentMerges;
+  uint64_t memFreeAssumedMBytes;
+  std::string indexFilename;
+  unsigned int bits;
+  std::string bloomFilename;
+  unsigned int bloomBitsPerKey;
+  std::string histogramFilename;
+  std::string checksumFilename;
+  std::string baseFilename;
+  bool cacheNeutral;
+  bool compressTemp;
+  bool resume;
+  unsigned int checkpointInterval;
   desc.add_options()("help,?", "produce help message")
   ("src,S", po::value<std::string>(&srcDirectory), "set user:pass input directory")
   ("input,I", po::value<std::vector<std::string>>(&filenames), "set MD5:count input file(s)")
   ("output,O", po::value<std::string>(&dstFile), "set MD5:count output file")
   ("tmp,T", po::value<std::string>(&tmpDirectory)->default_value(tmpDirectory), "set working directory")
-  ("max-files-at-once,n", po::value<int>(&maxFilesAtOnce)->default_value(DefaultMaxFilesAtOnce), "process max files at once")
+  ("max-files-at-once,n", po::value<int>(&maxFilesAtOnce)->default_value(DefaultMaxFilesAtOnce), "process max files at once (0: derive from the open file limit and memory)")
+  ("partitions,P", po::value<unsigned int>(&numPartitions)->default_value(std::max(1U, std::thread::hardware_concurrency())), "merge this many key ranges in parallel")
+  ("jobs,j", po::value<unsigned int>(&numConcurrentMerges)->default_value(DefaultConcurrentMerges), "run this many independent merges at once")
+  ("ram", po::value<uint64_t>(&memFreeAssumedMBytes)->default_value(memStat.phys.avail / 1024 / 1024), "program can use as many as the given MB of RAM for read buffers")
+  ("base", po::value<std::string>(&baseFilename), "merge the inputs into this large MD5:count file, copying untouched spans in the kernel")
+  ("index", po::value<std::string>(&indexFilename), "also write index to this file")
+  ("bits,B", po::value<unsigned int>(&bits)->default_value(DefaultBits), "set bit count of index key")
+  ("bloom", po::value<std::string>(&bloomFilename), "also write a membership filter to this file")
+  ("bloom-bits", po::value<unsigned int>(&bloomBitsPerKey)->default_value(pwned::BloomFilter::DefaultBitsPerKey), "set bits per hash of the membership filter")
+  ("histogram", po::value<std::string>(&histogramFilename), "also write a histogram of the counts to this file")
+  ("checksum", po::value<std::string>(&checksumFilename), "also write the CRC-32 of the output file to this file")
+  ("resume", po::bool_switch(&resume)->default_value(false), "continue an interrupted merge from the checkpoint in the working directory")
+  ("checkpoint-interval", po::value<unsigned int>(&checkpointInterval)->default_value(DefaultCheckpointInterval), "save the progress of running merges every this many seconds (0: never)")
+  ("compress-temp", po::bool_switch(&compressTemp)->default_value(false), "pack intermediate files to save disk space and I/O at the expense of CPU time")
+  ("cache-neutral", po::bool_switch(&cacheNeutral)->default_value(false), "drop streamed data from the page cache to keep the cached pages of other processes")
   ("ext,X", po::value<std::string>(&outputExt)->default_value(DefaultOutputExt), "set extension for output files")
   ("warranty,W", "show warranty info");
   po::variables_map vm;
@@ -108,6 +150,7 @@ int main(int argc, const char *argv[])
     return EXIT_FAILURE;
   }
   po::notify(vm);
+  pwned::setCacheNeutralIO(cacheNeutral);
 
   hello();
   if (vm.count("warranty") > 0)
@@ -125,6 +168,16 @@ int main(int argc, const char *argv[])
     usage();
     return EXIT_FAILURE;
   }
+  if (bits == 0 || bits > 32)
+  {
+    std::cerr << "ERROR: bit count of index key must be between 1 and 32." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (!baseFilename.empty() && !fs::is_regular_file(baseFilename))
+  {
+    std::cerr << "ERROR: base file '" << baseFilename << "' does not exist." << std::endl;
+    return EXIT_FAILURE;
+  }
   if (!srcDirectory.empty())
   {
     std::cout << "Scanning " << srcDirectory << " for files ... " << std::flush;
@@ -144,7 +197,17 @@ int main(int argc, const char *argv[])
     usage();
     return EXIT_FAILURE;
   }
-  if (fs::exists(dstFile))
+  {
+    // also catches links to the base file
+    boost::system::error_code ec;
+    if (!baseFilename.empty() && fs::equivalent(dstFile, baseFilename, ec))
+    {
+      std::cerr << "ERROR: destination file '" << dstFile << "' is the base file; merge into a new file instead." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  // a resumed merge continues to write the destination file
+  if (fs::exists(dstFile) && !resume)
   {
     std::cout << "Destination file '" << dstFile << "' already exists." << std::endl
               << "Do you want to overwrite it? (y/n)" << std::endl;
@@ -175,10 +238,170 @@ int main(int argc, const char *argv[])
     inputFiles.push_back(merger::InputFile(filename));
   }
   std::sort(inputFiles.begin(), inputFiles.end(), merger::InputFileLess);
-  std::vector<std::string> intermediateFilenames;
+  numConcurrentMerges = std::max(1U, numConcurrentMerges);
+  std::size_t fanIn = pwned::MergePlan::maxFanIn(pwned::MergePlan::openFileLimit(),
+                                                 memFreeAssumedMBytes * 1024ULL * 1024ULL,
+                                                 merger::MergeOperation::filesPerInput(numPartitions),
+                                                 merger::MergeOperation::memoryPerInput(numPartitions),
+                                                 numConcurrentMerges);
+  if (maxFilesAtOnce > 0)
+  {
+    fanIn = std::min(fanIn, std::size_t(std::max(2, maxFilesAtOnce)));
+  }
+  std::vector<uint64_t> inputSizes;
+  for (const auto &file : inputFiles)
+  {
+    inputSizes.push_back(file.inputSize.value());
+  }
+  if (!baseFilename.empty())
+  {
+    // the base file is merged last, see below
+    inputFiles.erase(std::remove_if(inputFiles.begin(), inputFiles.end(), [&baseFilename](const merger::InputFile &file) {
+                       boost::system::error_code ec;
+                       return fs::equivalent(file.path, baseFilename, ec);
+                     }),
+                     inputFiles.end());
+    inputSizes.clear();
+    for (const auto &file : inputFiles)
+    {
+      inputSizes.push_back(file.inputSize.value());
+    }
+    if (inputFiles.empty())
+    {
+      std::cerr << "ERROR: nothing to merge into '" << baseFilename << "'." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  const bool checkpointing = checkpointInterval > 0;
+  merger::Checkpoint checkpoint((fs::path(tmpDirectory) / CheckpointFilename).string(), checkpointInterval);
+  if (resume)
+  {
+    if (!checkpoint.load())
+    {
+      std::cerr << "ERROR: no checkpoint to resume from in '" << tmpDirectory << "'." << std::endl;
+      return EXIT_FAILURE;
+    }
+    const merger::Checkpoint::Plan &saved = checkpoint.plan();
+    std::map<std::string, uint64_t> sizes;
+    for (const auto &file : inputFiles)
+    {
+      sizes[file.path.string()] = file.inputSize.value();
+    }
+    bool unchanged = saved.inputs.size() == sizes.size() && saved.dstFile == dstFile && saved.baseFile == baseFilename;
+    for (std::size_t i = 0; unchanged && i < saved.inputs.size(); ++i)
+    {
+      const auto &it = sizes.find(saved.inputs[i]);
+      unchanged = it != sizes.end() && it->second == saved.inputSizes[i];
+    }
+    if (!unchanged)
+    {
+      std::cerr << "ERROR: the files to merge differ from those of the interrupted merge." << std::endl;
+      return EXIT_FAILURE;
+    }
+    // the plan depends on the order of the inputs and the fan-in
+    inputFiles.clear();
+    inputSizes.clear();
+    for (const auto &filename : saved.inputs)
+    {
+      inputFiles.push_back(merger::InputFile(filename));
+      inputSizes.push_back(inputFiles.back().inputSize.value());
+    }
+    fanIn = saved.fanIn;
+    compressTemp = saved.compressTemp;
+  }
+  // with a base file the inputs are merged into a delta file first,
+  // unless there's only one
+  const bool mergeIntoBase = !baseFilename.empty();
+  const bool inputIsDelta = mergeIntoBase && inputFiles.size() == 1;
+  const pwned::MergePlan plan(inputIsDelta ? std::vector<uint64_t>() : inputSizes, fanIn);
+  std::cout << "Merge plan: " << plan.steps().size() << " merges of up to " << plan.fanIn() << " files, "
+            << pwned::readableSize(plan.bytesRewritten()) << " rewritten in intermediate files, "
+            << pwned::readableSize(plan.bytesWritten()) << " written in total (at most)." << std::endl;
+  // node numbers of the plan: input files first, then the outputs of its steps
+  std::vector<merger::InputFile> nodes(inputFiles);
+  if (resume)
+  {
+    if (checkpoint.plan().outputs.size() != plan.steps().size())
+    {
+      std::cerr << "ERROR: the checkpoint does not match the merge plan." << std::endl;
+      return EXIT_FAILURE;
+    }
+    for (const auto &filename : checkpoint.plan().outputs)
+    {
+      nodes.push_back(merger::InputFile(filename));
+    }
+  }
+  else
+  {
+    for (std::size_t i = 0; i < plan.steps().size(); ++i)
+    {
+      const bool isLastStep = i + 1 == plan.steps().size();
+      nodes.push_back(merger::InputFile(isLastStep && !mergeIntoBase
+                                            ? fs::path(dstFile)
+                                            : fs::path(tmpDirectory) / (fs::unique_path().string() + outputExt)));
+    }
+    if (checkpointing)
+    {
+      merger::Checkpoint::Plan saved;
+      for (const auto &file : inputFiles)
+      {
+        saved.inputs.push_back(file.path.string());
+        saved.inputSizes.push_back(file.inputSize.value());
+      }
+      saved.dstFile = dstFile;
+      saved.baseFile = baseFilename;
+      saved.fanIn = fanIn;
+      saved.compressTemp = compressTemp;
+      for (std::size_t node = inputFiles.size(); node < nodes.size(); ++node)
+      {
+        saved.outputs.push_back(nodes[node].path.string());
+      }
+      if (!checkpoint.start(saved))
+      {
+        std::cerr << "WARNING: cannot write checkpoint to '" << checkpoint.filename() << "'." << std::endl;
+      }
+    }
+  }
+  // the final merge also produces the requested side outputs
+  std::vector<std::unique_ptr<pwned::MergeSink>> sinks;
+  if (!indexFilename.empty())
+  {
+    sinks.emplace_back(new pwned::IndexSink(indexFilename, bits));
+  }
+  if (!bloomFilename.empty())
+  {
+    sinks.emplace_back(new pwned::BloomFilterSink(bloomFilename, bloomBitsPerKey));
+  }
+  if (!histogramFilename.empty())
+  {
+    sinks.emplace_back(new pwned::HistogramSink(histogramFilename));
+  }
+  if (!checksumFilename.empty())
+  {
+    sinks.emplace_back(new pwned::ChecksumSink(checksumFilename));
+  }
+  std::vector<pwned::MergeSink *> finalSinks;
+  for (const auto &sink : sinks)
+  {
+    finalSinks.push_back(sink.get());
+  }
+  std::vector<bool> available(nodes.size(), false);
+  std::fill(available.begin(), available.begin() + std::ptrdiff_t(inputFiles.size()), true);
+  std::vector<bool> scheduled(plan.steps().size(), false);
+  std::size_t stepsLeft = plan.steps().size();
+  for (std::size_t i = 0; i < plan.steps().size(); ++i)
+  {
+    if (checkpoint.isCompleted(i))
+    {
+      scheduled[i] = true;
+      available[plan.steps()[i].output] = true;
+      --stepsLeft;
+    }
+  }
   ProgressBar progressBar(32);
-  pwned::OperationQueue<merger::MergeOperation> opQueue;
-  std::thread keyThread = pwned::runAsync([&opQueue] {
+  pwned::OperationQueue<pwned::Operation> opQueue;
+  std::atomic<bool> cancelled{false};
+  std::thread keyThread([&opQueue, &cancelled] {
     char ch;
     do
     {
@@ -196,6 +419,7 @@ int main(int argc, const char *argv[])
         }
         break;
       case 'q':
+        cancelled = true;
         opQueue.resume();
         opQueue.cancel();
         break;
@@ -203,51 +427,128 @@ int main(int argc, const char *argv[])
         break;
       }
     } while (ch != 'q');
-  },
-                                          0);
+  });
   keyThread.detach();
-  while (inputFiles.size() > 0 && !opQueue.isCancelled())
-  {
-    const auto b = std::min(inputFiles.end(), inputFiles.begin() + maxFilesAtOnce);
-    const std::vector<merger::InputFile> inputFileSlice(inputFiles.begin(), b);
-    const bool isLastChunk = inputFileSlice.size() == inputFiles.size();
-    const std::string &targetFilename = isLastChunk
-                                            ? dstFile
-                                            : (fs::path(tmpDirectory) / fs::unique_path()).string() + outputExt;
-    if (!isLastChunk)
-    {
-      intermediateFilenames.push_back(targetFilename);
-    }
-    const uint64_t chunkInputSize = std::accumulate(inputFileSlice.begin(),
-                                                    inputFileSlice.end(),
-                                                    0ULL,
-                                                    [](uint64_t sum, const merger::InputFile &file) {
-                                                      return sum + file.inputSize.value();
-                                                    });
-    progressBar.setHi(chunkInputSize / pwned::PasswordHashAndCount::size);
-    merger::MergeOperation *const op = new merger::MergeOperation(inputFileSlice, targetFilename, false, &progressBar);
-    opQueue.add(op);
-    opQueue.execute(true);
+  while (stepsLeft > 0 && !cancelled)
+  {
+    // independent steps whose inputs are all available run side by side
+    std::vector<std::size_t> ready;
+    for (std::size_t i = 0; i < plan.steps().size() && ready.size() < numConcurrentMerges; ++i)
+    {
+      const auto &inputs = plan.steps()[i].inputs;
+      if (!scheduled[i] && std::all_of(inputs.begin(), inputs.end(), [&available](std::size_t node) { return available[node]; }))
+      {
+        ready.push_back(i);
+      }
+    }
+    uint64_t waveEntries = 0;
+    for (std::size_t i : ready)
+    {
+      for (std::size_t node : plan.steps()[i].inputs)
+      {
+        waveEntries += pwned::BlockReader::recordCount(nodes[node].path.string());
+      }
+    }
+    progressBar.setHi(waveEntries);
+    for (std::size_t i : ready)
+    {
+      const auto &step = plan.steps()[i];
+      std::vector<merger::InputFile> inputFileSlice;
+      for (std::size_t node : step.inputs)
+      {
+        inputFileSlice.push_back(nodes[node]);
+      }
+      const bool writesDstFile = i + 1 == plan.steps().size() && !mergeIntoBase;
+      merger::MergeOperation *op = new merger::MergeOperation(inputFileSlice,
+                                                              nodes[step.output].path.string(),
+                                                              false,
+                                                              numPartitions,
+                                                              ready.size() == 1 ? &progressBar : nullptr,
+                                                              writesDstFile ? finalSinks : std::vector<pwned::MergeSink *>(),
+                                                              compressTemp && !writesDstFile ? pwned::RecordFormat::packed : pwned::RecordFormat::raw);
+      if (checkpointing || resume)
+      {
+        op->setCheckpoint(&checkpoint, i);
+      }
+      opQueue.add(op);
+      scheduled[i] = true;
+    }
+    opQueue.execute();
     opQueue.waitForFinished();
-    if (!opQueue.isCancelled())
+    if (cancelled)
+      break;
+    if (opQueue.failures() > 0)
+    {
+      // which of the steps failed is unknown, so none of them counts as done
+      std::cerr << "ERROR: merging failed; the input files are kept." << std::endl;
+      return EXIT_FAILURE;
+    }
+    for (std::size_t i : ready)
     {
-      inputFiles = std::vector<merger::InputFile>(b, inputFiles.end());
-      if (!isLastChunk)
+      const auto &step = plan.steps()[i];
+      available[step.output] = true;
+      // recorded before the inputs of the step disappear
+      if (checkpointing)
       {
-        inputFiles.push_back(merger::InputFile(targetFilename));
+        checkpoint.complete(i);
+      }
+      for (std::size_t node : step.inputs)
+      {
+        // intermediate files are not needed any longer
+        if (node >= inputFiles.size())
+        {
+          boost::system::error_code ec;
+          fs::remove(nodes[node].path, ec);
+        }
+      }
+    }
+    stepsLeft -= ready.size();
+    std::cout << stepsLeft << " merges left." << std::endl;
+  }
+  if (mergeIntoBase && !cancelled)
+  {
+    progressBar.setHi(pwned::BlockReader::recordCount(baseFilename) + pwned::BlockReader::recordCount(nodes.back().path.string()));
+    opQueue.add(new merger::DeltaMergeOperation(baseFilename, nodes.back().path.string(), dstFile, &progressBar, finalSinks));
+    opQueue.execute();
+    opQueue.waitForFinished();
+    if (opQueue.failures() > 0 && !cancelled)
+    {
+      std::cerr << "ERROR: merging into '" << baseFilename << "' failed; the delta file is kept." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  bool sinksWritten = true;
+  if (!cancelled)
+  {
+    for (const auto &sink : sinks)
+    {
+      std::cout << "Writing " << sink->description() << " to " << sink->filename() << " ..." << std::endl;
+      if (!sink->finish())
+      {
+        std::cerr << "ERROR: cannot write " << sink->description() << " to '" << sink->filename() << "'." << std::endl;
+        sinksWritten = false;
       }
-      std::cout << inputFiles.size() << " files left." << std::endl;
     }
   }
   auto t1 = std::chrono::high_resolution_clock::now();
   auto time_span = std::chrono::duration_cast<std::chrono::duration<float>>(t1 - t0);
-  if (!opQueue.isCancelled())
+  if (!cancelled)
   {
     std::cout << "Total time: " << pwned::readableTime(time_span.count()) << std::endl;
   }
-  for (const auto &intermediateFile : intermediateFilenames)
+  if (cancelled && checkpointing)
+  {
+    std::cout << "Interrupted. Run again with --resume to continue." << std::endl;
+    return EXIT_FAILURE;
+  }
+  checkpoint.remove();
+  // intermediate files, including the delta file of a merge into a base file
+  const std::size_t numOutputs = nodes.size() - inputFiles.size();
+  const std::size_t numIntermediateFiles = mergeIntoBase || numOutputs == 0 ? numOutputs : numOutputs - 1;
+  for (std::size_t node = inputFiles.size(); node < inputFiles.size() + numIntermediateFiles; ++node)
   {
-    fs::remove(intermediateFile);
+    boost::system::error_code ec;
+    fs::remove(nodes[node].path, ec);
   }
-  return EXIT_SUCCESS;
+  return sinksWritten ? EXIT_SUCCESS : EXIT_FAILURE;
 }
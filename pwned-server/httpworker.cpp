@@ -16,11 +16,15 @@
  */
 
 #include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string_view>
+#include <vector>
+#include <charconv>
+#include <cctype>
+#include <cstring>
 
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
-#include <boost/algorithm/string/replace.hpp>
-#include <boost/filesystem.hpp>
+#include <boost/asio/dispatch.hpp>
 
 #include <pwned-lib/hash.hpp>
 
@@ -28,8 +32,6 @@
 #include "uri.hpp"
 #include "httpworker.hpp"
 
-namespace fs = boost::filesystem;
-namespace pt = boost::property_tree;
 namespace beast = boost::beast;
 namespace http = beast::http;
 namespace net = boost::asio;
@@ -37,72 +39,190 @@ using tcp = boost::asio::ip::tcp;
 
 namespace webservice {
 
-HttpWorker::HttpWorker(
-    tcp::acceptor &acceptor,
-    const std::string &basePath,
-    const std::string &inputFilename,
-    const std::string &indexFilename,
-    log_callback_t *logCallback)
-    : mAcceptor(acceptor)
-    , mBasePath(basePath)
-    , mInspector(inputFilename, indexFilename)
-    , mLogCallback(logCallback)
-    , mLastUpdated(fs::last_write_time(fs::path(inputFilename)))
+constexpr std::chrono::seconds HttpWorker::Timeout;
+constexpr std::chrono::seconds HttpWorker::DefaultIdleTimeout;
+constexpr std::uint64_t HttpWorker::MaxBodySize;
+
+namespace {
+
+constexpr char JsonContentType[] = "application/json";
+constexpr char BinaryContentType[] = "application/octet-stream";
+constexpr char MetricsContentType[] = "text/plain; version=0.0.4";
+constexpr char ServerName[] = "#pwned server " PWNED_SERVER_VERSION;
+
+// room for the longest number `put()` writes
+constexpr std::size_t MaxNumberLength = 32;
+// a count in a JSON array: up to ten digits and a comma
+constexpr std::size_t MaxCountLength = 11;
+
+// the writers of the response bodies; each returns the end of what it wrote
+char *put(char *dst, std::string_view s)
 {
+  std::memcpy(dst, s.data(), s.size());
+  return dst + s.size();
 }
 
-void HttpWorker::start()
+char *put(char *dst, uint64_t value)
 {
-  accept();
-  checkTimeout();
+  return std::to_chars(dst, dst + MaxNumberLength, value).ptr;
 }
 
-void HttpWorker::accept()
+// six decimals, like std::to_string()
+char *put(char *dst, double value)
 {
-  beast::error_code ec;
-  mSocket.close(ec);
-  mBuffer.consume(mBuffer.size());
-  mAcceptor.async_accept(
-      mSocket,
-      [this](beast::error_code ec) {
-        if (ec)
-        {
-          accept();
-        }
-        else
-        {
-          mReqTimeout.expires_after(Timeout);
-          readRequest();
-        }
+  return std::to_chars(dst, dst + MaxNumberLength, value, std::chars_format::fixed, 6).ptr;
+}
+
+// whether `path` is `basePath` followed by `endpoint`
+bool isEndpoint(std::string_view path, std::string_view basePath, std::string_view endpoint)
+{
+  return path.size() == basePath.size() + endpoint.size()
+      && path.substr(0, basePath.size()) == basePath
+      && path.substr(basePath.size()) == endpoint;
+}
+
+// parses a JSON array of strings; strings that aren't hex encoded hashes
+// yield invalid hashes, which are never found
+bool parseHashArray(std::string_view body, std::vector<pwned::Hash> &hashes)
+{
+  std::size_t pos = 0;
+  auto skipSpace = [&body, &pos] {
+    while (pos < body.size() && std::isspace(static_cast<unsigned char>(body[pos])))
+    {
+      ++pos;
+    }
+  };
+  auto endsAfter = [&body, &pos, &skipSpace](char c) {
+    if (pos >= body.size() || body[pos] != c)
+      return false;
+    ++pos;
+    skipSpace();
+    return pos == body.size();
+  };
+  skipSpace();
+  if (pos >= body.size() || body[pos] != '[')
+    return false;
+  ++pos;
+  skipSpace();
+  if (pos < body.size() && body[pos] == ']')
+    return endsAfter(']');
+  for (;;)
+  {
+    if (pos >= body.size() || body[pos] != '"')
+      return false;
+    const std::size_t end = body.find('"', pos + 1);
+    if (end == std::string_view::npos)
+      return false;
+    hashes.push_back(pwned::Hash::fromHex(body.substr(pos + 1, end - pos - 1)));
+    pos = end + 1;
+    skipSpace();
+    if (pos < body.size() && body[pos] == ',')
+    {
+      ++pos;
+      skipSpace();
+      continue;
+    }
+    return endsAfter(']');
+  }
+}
+
+// MD5 digests as they come out of the hash function, 16 bytes each
+bool parseHashDigests(std::string_view body, std::vector<pwned::Hash> &hashes)
+{
+  if (body.size() % pwned::Hash::size != 0)
+    return false;
+  hashes.resize(body.size() / pwned::Hash::size);
+  for (std::size_t i = 0; i < hashes.size(); ++i)
+  {
+    std::memcpy(hashes[i].data, body.data() + i * pwned::Hash::size, pwned::Hash::size);
+    hashes[i].toHostByteOrder();
+    hashes[i].isValid = true;
+  }
+  return true;
+}
+
+}
+
+HttpWorker::HttpWorker(tcp::socket &&socket, const ServiceOptions &options)
+    : mStream(std::move(socket))
+    , mOptions(options)
+    , mEndpoint(Endpoint::other)
+{
+  Metrics::connectionOpened();
+  // set once for all responses of the session
+  mResponse.set(http::field::server, ServerName);
+  mResponse.set("Access-Control-Allow-Origin", "*");
+  // the buffer of the body is kept from one response to the next
+  mResponse.body().reserve(256);
+}
+
+HttpWorker::~HttpWorker()
+{
+  Metrics::connectionClosed();
+}
+
+void HttpWorker::start()
+{
+  // run on the strand of the connection
+  net::dispatch(
+      mStream.get_executor(),
+      [self = shared_from_this()] {
+        self->readRequest();
       });
 }
 
+pwned::PasswordInspector &HttpWorker::inspector(const ServiceOptions &options)
+{
+  thread_local std::unique_ptr<pwned::PasswordInspector> threadInspector;
+  if (!threadInspector)
+  {
+    threadInspector.reset(new pwned::PasswordInspector(options.inputFilename, options.indexFilename));
+  }
+  return *threadInspector;
+}
+
 void HttpWorker::readRequest()
 {
   mParser.emplace();
+  mParser->body_limit(MaxBodySize);
+  // also ends connections that are kept open but not used
+  mStream.expires_after(mOptions.idleTimeout);
   http::async_read(
-      mSocket,
+      mStream,
       mBuffer,
       *mParser,
-      [this](beast::error_code ec, std::size_t) {
-        if (ec)
+      [self = shared_from_this()](beast::error_code ec, std::size_t) {
+        self->mRequestStart = std::chrono::steady_clock::now();
+        self->mEndpoint = Endpoint::other;
+        if (ec == http::error::body_limit)
         {
-          accept();
+          self->mResponse.keep_alive(false);
+          self->sendBadResponse(http::status::payload_too_large, "Request body too large\r\n");
+        }
+        else if (ec)
+        {
+          self->close();
         }
         else
         {
-          processRequest(mParser->get());
+          self->processRequest(self->mParser->get());
         }
       });
 }
 
 void HttpWorker::processRequest(http::request<http::string_body> const &req)
 {
+  // the header fields all responses share are already there
+  mResponse.version(req.version());
+  mResponse.keep_alive(req.keep_alive());
   switch (req.method())
   {
   case http::verb::get:
     sendResponse(req);
     break;
+  case http::verb::post:
+    sendBatchResponse(req);
+    break;
   default:
     sendBadResponse(
         http::status::bad_request,
@@ -128,78 +248,78 @@ std::ostream &operator<<(std::ostream &stream, const std::chrono::time_point<Clo
 #endif
 }
 
-void makeResponse(boost::optional<http::response<http::string_body>> &response, const std::string &msg)
+void HttpWorker::prepareResponse(const char *contentType)
 {
-  response.emplace();
-  response->result(http::status::ok);
-  response->set(http::field::server, std::string("#pwned server ") + PWNED_SERVER_VERSION);
-  response->set(http::field::content_type, "application/json");
-  response->set("Access-Control-Allow-Origin", "*");
-  response->body() = msg;
-  response->prepare_payload();
+  mResponse.result(http::status::ok);
+  if (mResponse[http::field::content_type] != contentType)
+  {
+    mResponse.set(http::field::content_type, contentType);
+  }
+}
+
+void HttpWorker::logRequest(http::request<http::string_body> const &req)
+{
+  if (mOptions.logCallback == nullptr)
+    return;
+  beast::error_code ec;
+  std::ostringstream ss;
+  ss << std::chrono::system_clock::now() << ' '
+     << mStream.socket().remote_endpoint(ec).address().to_string() << ' '
+     << req.method_string() << ' '
+     << req.target().to_string();
+  (*mOptions.logCallback)(ss.str());
 }
 
 void HttpWorker::sendResponse(http::request<http::string_body> const &req)
 {
   URI uri;
   uri.parseTarget(req.target().to_string());
-  if (mLogCallback != nullptr)
-  {
-    std::ostringstream ss;
-    ss << std::chrono::system_clock::now() << ' '
-       << mSocket.remote_endpoint().address().to_string() << ' '
-       << req.target().to_string();
-    (*mLogCallback)(ss.str());
-  }
-  if (uri.path() == (mBasePath + "/lookup") && uri.query().find("hash") != uri.query().end())
+  logRequest(req);
+  std::string &body = mResponse.body();
+  if (isEndpoint(uri.path(), mOptions.basePath, "/lookup") && uri.query().find("hash") != uri.query().end())
   {
+    mEndpoint = Endpoint::lookup;
     const pwned::Hash &hash = pwned::Hash::fromHex(uri.query().at("hash"));
+    int readCount = 0;
     const auto &t0 = std::chrono::high_resolution_clock::now();
-    const pwned::PasswordHashAndCount &phc = mInspector.binsearch(hash);
+    const pwned::PasswordHashAndCount &phc = inspector(mOptions).binsearch(hash, &readCount);
     const auto &t1 = std::chrono::high_resolution_clock::now();
     const double duration = 1e3 * std::chrono::duration_cast<std::chrono::duration<double>>(t1 - t0).count();
-    pt::ptree response;
-    response.put<std::string>("hash", hash.toString());
-    response.put<std::string>("found", "[found]");
-    response.put<std::string>("lookup-time-ms", "[lookup-time-ms]");
-    std::ostringstream ss;
-    pt::write_json(ss, response, false);
-    std::string responseStr = ss.str();
-    boost::replace_all<std::string>(responseStr, std::string("\"[found]\""), std::to_string(phc.count));
-    boost::replace_all<std::string>(responseStr, std::string("\"[lookup-time-ms]\""), std::to_string(duration));
-    makeResponse(mResponse, responseStr);
-    mSerializer.emplace(*mResponse);
-    http::async_write(
-        mSocket,
-        *mSerializer,
-        [this](boost::beast::error_code ec, std::size_t) {
-          mSocket.shutdown(tcp::socket::shutdown_send, ec);
-          mSerializer.reset();
-          mResponse.reset();
-          accept();
-        });
+    Metrics::countLookup(t1 - t0, readCount);
+    // {"hash":"...","found":...,"lookup-time-ms":...}
+    body.resize(64 + 2 * pwned::Hash::size + 2 * MaxNumberLength);
+    char *p = put(&body[0], "{\"hash\":\"");
+    p = hash.toHex(p);
+    p = put(p, "\",\"found\":");
+    p = put(p, uint64_t(phc.count));
+    p = put(p, ",\"lookup-time-ms\":");
+    p = put(p, duration);
+    p = put(p, "}\n");
+    body.resize(std::size_t(p - body.data()));
+    prepareResponse(JsonContentType);
+    write();
   }
-  else if (uri.path() == (mBasePath + "/info"))
+  else if (isEndpoint(uri.path(), mOptions.basePath, "/info"))
   {
-    pt::ptree response;
-    response.put<std::string>("count", "[count]");
-    response.put<std::string>("last-update", "[last-update]");
-    std::ostringstream ss;
-    pt::write_json(ss, response, false);
-    std::string responseStr = ss.str();
-    boost::replace_all<std::string>(responseStr, std::string("\"[count]\""), std::to_string(mInspector.size()));
-    boost::replace_all<std::string>(responseStr, std::string("\"[last-update]\""), std::to_string(mLastUpdated));
-    makeResponse(mResponse, responseStr);
-    mSerializer.emplace(*mResponse);
-    http::async_write(
-        mSocket,
-        *mSerializer,
-        [this](boost::beast::error_code ec, std::size_t) {
-          mSocket.shutdown(tcp::socket::shutdown_send, ec);
-          mSerializer.reset();
-          mResponse.reset();
-          accept();
-        });
+    mEndpoint = Endpoint::info;
+    // {"count":...,"last-update":...}
+    body.resize(64 + 2 * MaxNumberLength);
+    char *p = put(&body[0], "{\"count\":");
+    p = put(p, uint64_t(inspector(mOptions).size()));
+    p = put(p, ",\"last-update\":");
+    p = put(p, uint64_t(mOptions.lastUpdated));
+    p = put(p, "}\n");
+    body.resize(std::size_t(p - body.data()));
+    prepareResponse(JsonContentType);
+    write();
+  }
+  else if (isEndpoint(uri.path(), mOptions.basePath, "/metrics"))
+  {
+    mEndpoint = Endpoint::metrics;
+    body.clear();
+    Metrics::write(body);
+    prepareResponse(MetricsContentType);
+    write();
   }
   else
   {
@@ -207,37 +327,99 @@ void HttpWorker::sendResponse(http::request<http::string_body> const &req)
   }
 }
 
+void HttpWorker::sendBatchResponse(http::request<http::string_body> const &req)
+{
+  URI uri;
+  uri.parseTarget(req.target().to_string());
+  logRequest(req);
+  if (!isEndpoint(uri.path(), mOptions.basePath, "/lookup"))
+  {
+    sendBadResponse(http::status::not_found, "");
+    return;
+  }
+  mEndpoint = Endpoint::batchLookup;
+  const bool binary = req[http::field::content_type].starts_with(BinaryContentType);
+  std::vector<pwned::Hash> hashes;
+  if (binary ? !parseHashDigests(req.body(), hashes) : !parseHashArray(req.body(), hashes))
+  {
+    sendBadResponse(
+        http::status::bad_request,
+        binary ? "Body must consist of 16-byte MD5 digests\r\n"
+               : "Body must be a JSON array of hex encoded MD5 hashes\r\n");
+    return;
+  }
+  int readCount = 0;
+  const auto &t0 = std::chrono::high_resolution_clock::now();
+  const std::vector<uint32_t> &counts = inspector(mOptions).lookupBatch(hashes, &readCount);
+  const auto &t1 = std::chrono::high_resolution_clock::now();
+  const double duration = 1e3 * std::chrono::duration_cast<std::chrono::duration<double>>(t1 - t0).count();
+  Metrics::countBatchLookup(hashes.size(), t1 - t0, readCount);
+  std::string &body = mResponse.body();
+  if (binary)
+  {
+    // the counts in the byte order of the MD5:count files
+    body.resize(counts.size() * sizeof(uint32_t));
+    std::memcpy(&body[0], counts.data(), body.size());
+  }
+  else
+  {
+    // {"found":[...],"lookup-time-ms":...}
+    body.resize(64 + MaxNumberLength + counts.size() * MaxCountLength);
+    char *p = put(&body[0], "{\"found\":[");
+    for (std::size_t i = 0; i < counts.size(); ++i)
+    {
+      if (i > 0)
+      {
+        *p++ = ',';
+      }
+      p = put(p, uint64_t(counts[i]));
+    }
+    p = put(p, "],\"lookup-time-ms\":");
+    p = put(p, duration);
+    p = put(p, "}\n");
+    body.resize(std::size_t(p - body.data()));
+  }
+  prepareResponse(binary ? BinaryContentType : JsonContentType);
+  write();
+}
+
 void HttpWorker::sendBadResponse(http::status status, const std::string &error)
 {
-  mResponse.emplace();
-  mResponse->result(status);
-  mResponse->set(http::field::server, std::string("#pwned server ") + PWNED_SERVER_VERSION);
-  mResponse->set(http::field::content_type, "text/plain");
-  mResponse->body() = error;
-  mResponse->prepare_payload();
-  mSerializer.emplace(*mResponse);
+  mResponse.result(status);
+  mResponse.set(http::field::content_type, "text/plain");
+  mResponse.body() = error;
+  write();
+}
+
+void HttpWorker::write()
+{
+  mResponse.prepare_payload();
+  mStream.expires_after(Timeout);
   http::async_write(
-      mSocket,
-      *mSerializer,
-      [this](beast::error_code ec, std::size_t) {
-        mSocket.shutdown(tcp::socket::shutdown_send, ec);
-        mSerializer.reset();
-        mResponse.reset();
-        accept();
+      mStream,
+      mResponse,
+      [self = shared_from_this()](beast::error_code ec, std::size_t) {
+        Metrics::countRequest(
+            self->mEndpoint,
+            self->mResponse.result_int(),
+            std::chrono::steady_clock::now() - self->mRequestStart);
+        if (ec || self->mResponse.need_eof())
+        {
+          self->close();
+        }
+        else
+        {
+          // a pipelined request may already be in the buffer
+          self->readRequest();
+        }
       });
 }
 
-void HttpWorker::checkTimeout()
+void HttpWorker::close()
 {
-  if (mReqTimeout.expiry() <= std::chrono::steady_clock::now())
-  {
-    mSocket.close();
-    mReqTimeout.expires_at(std::chrono::steady_clock::time_point::max());
-  }
-  mReqTimeout.async_wait(
-      [this](beast::error_code) {
-        checkTimeout();
-      });
+  beast::error_code ec;
+  mStream.socket().shutdown(tcp::socket::shutdown_send, ec);
+  // the socket is closed when the last handler lets go of the session
 }
 
 }
@@ -20,7 +20,9 @@
 
 #include <string>
 #include <chrono>
+#include <memory>
 #include <ctime>
+#include <cstdint>
 
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
@@ -30,50 +32,75 @@
 
 #include <pwned-lib/passwordinspector.hpp>
 
+#include "metrics.hpp"
+
 namespace webservice {
 
 namespace beast = boost::beast;
 namespace http = beast::http;
 
-class HttpWorker
+typedef boost::function<void(const std::string&)> log_callback_t;
+
+// what the sessions of a server have in common
+struct ServiceOptions
+{
+  std::string basePath;
+  std::string inputFilename;
+  std::string indexFilename;
+  std::time_t lastUpdated;
+  // how long an open connection may wait for its next request
+  std::chrono::seconds idleTimeout;
+  log_callback_t *logCallback;
+};
+
+/**
+ * Serves the requests of one connection, one after the other: requests
+ * pipelined by the client wait in the read buffer and are answered in
+ * order. The connection stays open for the next request unless the client
+ * asks to close it (HTTP/1.0 without keep-alive or `Connection: close`) or
+ * stays silent for longer than the idle timeout. A session lives as long
+ * as one of its asynchronous operations refers to it.
+ */
+class HttpWorker : public std::enable_shared_from_this<HttpWorker>
 {
   using tcp = boost::asio::ip::tcp;
 
 public:
-  typedef boost::function<void(const std::string&)> log_callback_t;
+  typedef webservice::log_callback_t log_callback_t;
   HttpWorker(HttpWorker const &) = delete;
   HttpWorker& operator=(HttpWorker const &) = delete;
-  HttpWorker(
-      tcp::acceptor &acceptor,
-      const std::string &basePath,
-      const std::string &inputFilename,
-      const std::string &indexFilename,
-      log_callback_t *logFn = nullptr);
+  HttpWorker(tcp::socket &&socket, const ServiceOptions &options);
+  ~HttpWorker();
   void start();
 
+  // the inspector of the calling thread; it keeps file positions, so each
+  // thread serving requests has one of its own
+  static pwned::PasswordInspector &inspector(const ServiceOptions &options);
+
   static constexpr std::chrono::seconds Timeout{60};
+  static constexpr std::chrono::seconds DefaultIdleTimeout{30};
+  // room for a million hashes in binary form
+  static constexpr std::uint64_t MaxBodySize = 16 * 1024 * 1024;
 
 private:
-  tcp::acceptor &mAcceptor;
-  tcp::socket mSocket{mAcceptor.get_executor()};
+  beast::tcp_stream mStream;
   beast::flat_buffer mBuffer;
   boost::optional<http::request_parser<http::string_body>> mParser;
-  boost::asio::basic_waitable_timer<std::chrono::steady_clock> mReqTimeout{
-    mAcceptor.get_executor(),
-    (std::chrono::steady_clock::time_point::max)()};
-  boost::optional<http::response<http::string_body>> mResponse;
-  boost::optional<http::response_serializer<http::string_body>> mSerializer;
-  std::string mBasePath;
-  pwned::PasswordInspector mInspector;
-  log_callback_t *mLogCallback;
-  std::time_t mLastUpdated;
-
-  void accept();
+  http::response<http::string_body> mResponse;
+  const ServiceOptions &mOptions;
+  // of the request being answered
+  std::chrono::steady_clock::time_point mRequestStart;
+  Endpoint mEndpoint;
+
   void readRequest();
   void sendResponse(http::request<http::string_body> const &);
+  void sendBatchResponse(http::request<http::string_body> const &req);
+  void logRequest(http::request<http::string_body> const &req);
+  void prepareResponse(const char *contentType);
   void processRequest(http::request<http::string_body> const &req);
   void sendBadResponse(http::status status, const std::string &error);
-  void checkTimeout();
+  void write();
+  void close();
 };
 
 }
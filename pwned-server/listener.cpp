@@ -0,0 +1,75 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdexcept>
+
+#include <sys/socket.h>
+
+#include <boost/asio/strand.hpp>
+#include <boost/asio/detail/socket_option.hpp>
+
+#include "listener.hpp"
+
+namespace beast = boost::beast;
+namespace net = boost::asio;
+using tcp = boost::asio::ip::tcp;
+
+namespace webservice {
+
+Listener::Listener(net::io_context &ioc, const tcp::endpoint &endpoint, const ServiceOptions &options, bool perThread)
+    : mIoc(ioc)
+    , mAcceptor(ioc)
+    , mOptions(options)
+    , mPerThread(perThread)
+{
+  mAcceptor.open(endpoint.protocol());
+  mAcceptor.set_option(net::socket_base::reuse_address(true));
+  if (perThread)
+  {
+#if defined(SO_REUSEPORT)
+    mAcceptor.set_option(net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#else
+    throw std::runtime_error("listeners of their own per thread need SO_REUSEPORT");
+#endif
+  }
+  mAcceptor.bind(endpoint);
+  mAcceptor.listen(net::socket_base::max_listen_connections);
+}
+
+void Listener::start()
+{
+  accept();
+}
+
+void Listener::accept()
+{
+  // a single thread serializes the handlers of a session by itself
+  const net::any_io_executor executor = mPerThread
+      ? net::any_io_executor(mIoc.get_executor())
+      : net::any_io_executor(net::make_strand(mIoc));
+  mAcceptor.async_accept(
+      executor,
+      [this](beast::error_code ec, tcp::socket socket) {
+        if (!ec)
+        {
+          std::make_shared<HttpWorker>(std::move(socket), mOptions)->start();
+        }
+        accept();
+      });
+}
+
+}
@@ -0,0 +1,60 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __listener_hpp__
+#define __listener_hpp__
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include "httpworker.hpp"
+
+namespace webservice {
+
+/**
+ * Accepts connections and starts an HttpWorker session for each of them,
+ * on a strand of its own, so that a session's handlers never run
+ * concurrently, while different sessions are served by all threads of
+ * the io_context. There is no limit to the number of sessions.
+ *
+ * With `perThread`, the listener belongs to the only thread running `ioc`.
+ * Its sessions then need no strand, and other threads can listen on the
+ * same port with listeners of their own (SO_REUSEPORT); the kernel spreads
+ * the incoming connections over them.
+ */
+class Listener
+{
+  using tcp = boost::asio::ip::tcp;
+
+public:
+  Listener(Listener const &) = delete;
+  Listener& operator=(Listener const &) = delete;
+  Listener(boost::asio::io_context &ioc, const tcp::endpoint &endpoint, const ServiceOptions &options, bool perThread = false);
+  void start();
+
+private:
+  boost::asio::io_context &mIoc;
+  tcp::acceptor mAcceptor;
+  const ServiceOptions mOptions;
+  const bool mPerThread;
+
+  void accept();
+};
+
+}
+
+#endif // __listener_hpp__
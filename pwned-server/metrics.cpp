@@ -0,0 +1,241 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+
+#include <pwned-lib/latencyhistogram.hpp>
+
+#include "metrics.hpp"
+
+namespace webservice {
+
+namespace {
+
+constexpr unsigned int StatusCount = Metrics::MaxStatus - Metrics::MinStatus + 1;
+
+constexpr const char *EndpointNames[Metrics::EndpointCount] = {
+    "lookup",
+    "batch-lookup",
+    "info",
+    "metrics",
+    "other"};
+
+// only the thread owning a counter writes to it
+inline void add(std::atomic<uint64_t> &counter, uint64_t n)
+{
+  counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline uint64_t get(const std::atomic<uint64_t> &counter)
+{
+  return counter.load(std::memory_order_relaxed);
+}
+
+void append(std::string &out, uint64_t value)
+{
+  char buf[24];
+  out.append(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr);
+}
+
+void append(std::string &out, double value)
+{
+  char buf[32];
+  out.append(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr);
+}
+
+void appendHeader(std::string &out, const char *name, const char *type, const char *help)
+{
+  out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+  out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void appendHistogram(std::string &out, const char *name, const char *labels, const pwned::LatencyHistogram &h)
+{
+  // the last bucket also holds everything beyond its bound
+  uint64_t cumulative = 0;
+  for (unsigned int i = 0; i + 1 < pwned::LatencyHistogram::BucketCount; ++i)
+  {
+    cumulative += h.bucket(i);
+    out.append(name).append("_bucket{").append(labels).append(*labels ? ",le=\"" : "le=\"");
+    append(out, double(pwned::LatencyHistogram::upperBound(i)) / 1e6);
+    out.append("\"} ");
+    append(out, cumulative);
+    out += '\n';
+  }
+  cumulative += h.bucket(pwned::LatencyHistogram::BucketCount - 1);
+  out.append(name).append("_bucket{").append(labels).append(*labels ? ",le=\"+Inf\"} " : "le=\"+Inf\"} ");
+  append(out, cumulative);
+  out += '\n';
+  out.append(name).append("_sum");
+  if (*labels)
+  {
+    out.append("{").append(labels).append("}");
+  }
+  out += ' ';
+  append(out, double(h.sum().count()) / 1e9);
+  out += '\n';
+  out.append(name).append("_count");
+  if (*labels)
+  {
+    out.append("{").append(labels).append("}");
+  }
+  out += ' ';
+  append(out, cumulative);
+  out += '\n';
+}
+
+}
+
+struct alignas(64) Metrics::ThreadMetrics
+{
+  std::array<std::atomic<uint64_t>, EndpointCount * StatusCount> requests{};
+  pwned::LatencyHistogram requestLatency;
+  pwned::LatencyHistogram lookupLatency;
+  pwned::LatencyHistogram batchLookupLatency;
+  std::atomic<uint64_t> hashes{0};
+  std::atomic<uint64_t> reads{0};
+  std::atomic<uint64_t> connectionsOpened{0};
+  std::atomic<uint64_t> connectionsClosed{0};
+};
+
+constexpr unsigned int Metrics::EndpointCount;
+constexpr unsigned int Metrics::MinStatus;
+constexpr unsigned int Metrics::MaxStatus;
+std::mutex Metrics::mtx;
+std::vector<std::unique_ptr<Metrics::ThreadMetrics>> Metrics::threadMetrics;
+
+Metrics::ThreadMetrics &Metrics::local()
+{
+  // kept after the thread has ended, so that nothing it counted gets lost
+  thread_local ThreadMetrics *metrics = nullptr;
+  if (metrics == nullptr)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    threadMetrics.emplace_back(new ThreadMetrics);
+    metrics = threadMetrics.back().get();
+  }
+  return *metrics;
+}
+
+void Metrics::countRequest(Endpoint endpoint, unsigned int status, std::chrono::nanoseconds duration)
+{
+  ThreadMetrics &m = local();
+  if (status < MinStatus || status > MaxStatus)
+  {
+    status = 500;
+  }
+  add(m.requests[unsigned(endpoint) * StatusCount + status - MinStatus], 1);
+  m.requestLatency.record(duration);
+}
+
+void Metrics::countLookup(std::chrono::nanoseconds duration, int reads)
+{
+  ThreadMetrics &m = local();
+  m.lookupLatency.record(duration);
+  add(m.hashes, 1);
+  add(m.reads, uint64_t(reads));
+}
+
+void Metrics::countBatchLookup(std::size_t numHashes, std::chrono::nanoseconds duration, int reads)
+{
+  ThreadMetrics &m = local();
+  m.batchLookupLatency.record(duration);
+  add(m.hashes, numHashes);
+  add(m.reads, uint64_t(reads));
+}
+
+void Metrics::connectionOpened()
+{
+  add(local().connectionsOpened, 1);
+}
+
+void Metrics::connectionClosed()
+{
+  add(local().connectionsClosed, 1);
+}
+
+void Metrics::write(std::string &out)
+{
+  std::array<uint64_t, EndpointCount * StatusCount> requests{};
+  pwned::LatencyHistogram requestLatency;
+  pwned::LatencyHistogram lookupLatency;
+  pwned::LatencyHistogram batchLookupLatency;
+  uint64_t hashes = 0;
+  uint64_t reads = 0;
+  uint64_t connectionsOpened = 0;
+  uint64_t connectionsClosed = 0;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (const auto &m : threadMetrics)
+    {
+      for (std::size_t i = 0; i < requests.size(); ++i)
+      {
+        requests[i] += get(m->requests[i]);
+      }
+      requestLatency.merge(m->requestLatency);
+      lookupLatency.merge(m->lookupLatency);
+      batchLookupLatency.merge(m->batchLookupLatency);
+      hashes += get(m->hashes);
+      reads += get(m->reads);
+      connectionsOpened += get(m->connectionsOpened);
+      connectionsClosed += get(m->connectionsClosed);
+    }
+  }
+
+  appendHeader(out, "pwned_requests_total", "counter", "Requests answered, by endpoint and HTTP status.");
+  for (unsigned int e = 0; e < EndpointCount; ++e)
+  {
+    for (unsigned int s = 0; s < StatusCount; ++s)
+    {
+      const uint64_t n = requests[e * StatusCount + s];
+      if (n == 0)
+        continue;
+      out.append("pwned_requests_total{endpoint=\"").append(EndpointNames[e]).append("\",status=\"");
+      append(out, uint64_t(MinStatus + s));
+      out.append("\"} ");
+      append(out, n);
+      out += '\n';
+    }
+  }
+  appendHeader(out, "pwned_request_duration_seconds", "histogram", "Time from having read a request to having sent the response.");
+  appendHistogram(out, "pwned_request_duration_seconds", "", requestLatency);
+  appendHeader(out, "pwned_lookup_duration_seconds", "histogram", "Time spent looking up the hashes of a request.");
+  appendHistogram(out, "pwned_lookup_duration_seconds", "kind=\"single\"", lookupLatency);
+  appendHistogram(out, "pwned_lookup_duration_seconds", "kind=\"batch\"", batchLookupLatency);
+  appendHeader(out, "pwned_lookup_hashes_total", "counter", "Hashes looked up.");
+  out.append("pwned_lookup_hashes_total ");
+  append(out, hashes);
+  out += '\n';
+  appendHeader(out, "pwned_lookup_reads_total", "counter", "Reads from the index and the MD5:count file while looking up hashes.");
+  out.append("pwned_lookup_reads_total ");
+  append(out, reads);
+  out += '\n';
+  appendHeader(out, "pwned_connections_total", "counter", "Connections accepted.");
+  out.append("pwned_connections_total ");
+  append(out, connectionsOpened);
+  out += '\n';
+  appendHeader(out, "pwned_open_connections", "gauge", "Connections currently open.");
+  out.append("pwned_open_connections ");
+  // the counters of different threads are read one after the other
+  append(out, connectionsOpened > connectionsClosed ? connectionsOpened - connectionsClosed : uint64_t(0));
+  out += '\n';
+}
+
+}
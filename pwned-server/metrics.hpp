@@ -0,0 +1,74 @@
+/*
+ Copyright © 2019 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG - Redaktion c't
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __metrics_hpp__
+#define __metrics_hpp__
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace webservice {
+
+// what a request asked for, as far as the metrics are concerned
+enum class Endpoint
+{
+  lookup,
+  batchLookup,
+  info,
+  metrics,
+  other
+};
+
+/**
+ * Counts the requests and connections of the server and records how long
+ * they took. Each thread records into counters of its own, without locks
+ * or read-modify-write operations; only a thread's first record takes the
+ * lock under which `write()` adds up the counters of all threads and
+ * formats them in the Prometheus text format.
+ */
+class Metrics
+{
+public:
+  static constexpr unsigned int EndpointCount = unsigned(Endpoint::other) + 1;
+  static constexpr unsigned int MinStatus = 100;
+  static constexpr unsigned int MaxStatus = 599;
+
+  static void countRequest(Endpoint endpoint, unsigned int status, std::chrono::nanoseconds duration);
+  // `reads` is the number of reads from the index and the MD5:count file
+  static void countLookup(std::chrono::nanoseconds duration, int reads);
+  static void countBatchLookup(std::size_t numHashes, std::chrono::nanoseconds duration, int reads);
+  static void connectionOpened();
+  static void connectionClosed();
+
+  // appends the metrics of all threads to `out`
+  static void write(std::string &out);
+
+private:
+  struct ThreadMetrics;
+  static std::mutex mtx;
+  static std::vector<std::unique_ptr<ThreadMetrics>> threadMetrics;
+
+  static ThreadMetrics &local();
+};
+
+}
+
+#endif // __metrics_hpp__
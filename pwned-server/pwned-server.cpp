@@ -22,18 +22,27 @@
 #include <memory>
 #include <exception>
 #include <sstream>
-#include <list>
 #include <thread>
 #include <mutex>
+#include <vector>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include <boost/program_options.hpp>
 #include <boost/function.hpp>
+#include <boost/filesystem.hpp>
 
 #include "pwned-server.hpp"
 #include "uri.hpp"
 #include "httpworker.hpp"
+#include "listener.hpp"
 
 namespace po = boost::program_options;
+namespace fs = boost::filesystem;
 using tcp = boost::asio::ip::tcp;
 
 void hello()
@@ -82,24 +91,50 @@ void validate(boost::any &v, std::vector<std::string> const &xs, Counter*, long)
   }
 }
 
+// pins the calling thread to the `index`th of the CPUs it may run on
+void pinToCore(unsigned int index)
+{
+#if defined(__linux__)
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+    return;
+  index %= unsigned(CPU_COUNT(&allowed));
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+  {
+    if (CPU_ISSET(cpu, &allowed) && index-- == 0)
+    {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      return;
+    }
+  }
+#else
+  (void)index;
+#endif
+}
+
 int main(int argc, const char *argv[])
 {
   const std::string DefaultAddress = "http://127.0.0.1:31337/v1/pwned/api";
   const int DefaultNumThreads = int(std::thread::hardware_concurrency());
-  constexpr int DefaultNumWorkers = 64;
   std::string inputFilename;
   std::string indexFilename;
   std::string address;
   int numWorkers;
   int numThreads;
+  int idleTimeout;
   Counter verbosity;
   desc.add_options()
   ("help,?", "produce help message")
   ("input,I", po::value<std::string>(&inputFilename), "set MD5:count input file")
   ("index,X", po::value<std::string>(&indexFilename), "set index file")
   ("address,A", po::value<std::string>(&address)->default_value(DefaultAddress), "server address")
-  ("workers,W", po::value<int>(&numWorkers)->default_value(DefaultNumWorkers), "number of workers")
+  ("workers,W", po::value<int>(&numWorkers), "ignored; connections get a session each (formerly the number of workers)")
   ("threads,T", po::value<int>(&numThreads)->default_value(DefaultNumThreads), "number of threads")
+  ("thread-per-core", "give each thread an io_context and a listener of its own and pin it to a core")
+  ("idle-timeout", po::value<int>(&idleTimeout)->default_value(int(webservice::HttpWorker::DefaultIdleTimeout.count())), "close kept-alive connections after this many seconds without a request")
   ("verbose,v", po::value(&verbosity)->zero_tokens(), "increase verbosity")
   ("warranty", "display warranty information")
   ("license", "display license information");
@@ -135,54 +170,102 @@ int main(int argc, const char *argv[])
     return EXIT_FAILURE;
   }
 
-  if (numWorkers < 1)
+  if (vm.count("workers") > 0 && verbosity.level > 0)
   {
-    std::cout << "WARNING: Illegal number of workers given. Defaulting to "
-              << DefaultNumWorkers << std::endl;
-    numWorkers = DefaultNumWorkers;
+    std::cout << "WARNING: --workers is obsolete and will be ignored." << std::endl;
+  }
+
+  numThreads = std::max(1, numThreads);
+  const bool threadPerCore = vm.count("thread-per-core") > 0;
+
+  if (idleTimeout < 1)
+  {
+    idleTimeout = int(webservice::HttpWorker::DefaultIdleTimeout.count());
   }
 
   try
   {
     URI uri(address);
-    boost::asio::io_context ioc{numWorkers};
-    tcp::acceptor acceptor{ioc, {boost::asio::ip::make_address(uri.host()), uri.port()}};
-    std::list<webservice::HttpWorker> workers;
+    const boost::asio::ip::tcp::endpoint endpoint{boost::asio::ip::make_address(uri.host()), uri.port()};
 
     std::mutex logMtx;
-    webservice::HttpWorker::log_callback_t logger = [verbosity, &logMtx](const std::string &msg)
+    webservice::log_callback_t logger = [&logMtx](const std::string &msg)
     {
-      if (verbosity.level > 1)
-      {
-        std::lock_guard<std::mutex> lock(logMtx);
-        std::cout << msg << std::endl;
-      }
+      std::lock_guard<std::mutex> lock(logMtx);
+      std::cout << msg << std::endl;
     };
-    for (int i = 0; i < numWorkers; ++i)
-    {
-      workers.emplace_back(acceptor, uri.path(), inputFilename, indexFilename, &logger);
-      workers.back().start();
-    }
-    std::vector<std::thread> threads;
-    threads.reserve(size_t(numThreads));
-    for (auto i = 0; i < numThreads; ++i)
+    webservice::ServiceOptions options{
+        uri.path(),
+        inputFilename,
+        indexFilename,
+        fs::last_write_time(fs::path(inputFilename)),
+        std::chrono::seconds(idleTimeout),
+        // without a logger, requests aren't even formatted for it
+        verbosity.level > 1 ? &logger : nullptr};
+    // fails early if the files cannot be opened
+    webservice::HttpWorker::inspector(options);
+    if (threadPerCore)
     {
-      threads.emplace_back(
-      [&ioc]
+      // nothing on the request path is shared between the threads: each
+      // has its own io_context, listener, sessions and inspector, and the
+      // kernel decides which listener gets a new connection
+      std::vector<std::unique_ptr<boost::asio::io_context>> contexts;
+      std::vector<std::unique_ptr<webservice::Listener>> listeners;
+      for (auto i = 0; i < numThreads; ++i)
       {
-        ioc.run();
-      });
-    }
-    if (verbosity.level > 0)
-    {
-      std::cout << numWorkers << " workers in " << numThreads << " threads"
-                << " listening on " << uri.host() << ':' << uri.port() << " ..."
-                << std::endl;
+        contexts.emplace_back(new boost::asio::io_context{1});
+        listeners.emplace_back(new webservice::Listener{*contexts.back(), endpoint, options, true});
+        listeners.back()->start();
+      }
+      std::vector<std::thread> threads;
+      threads.reserve(size_t(numThreads));
+      for (auto i = 0; i < numThreads; ++i)
+      {
+        threads.emplace_back(
+        [&ioc = *contexts[size_t(i)], &options, i]
+        {
+          pinToCore(unsigned(i));
+          webservice::HttpWorker::inspector(options);
+          ioc.run();
+        });
+      }
+      if (verbosity.level > 0)
+      {
+        std::cout << numThreads << " threads, one per core,"
+                  << " listening on " << uri.host() << ':' << uri.port() << " ..."
+                  << std::endl;
+      }
+      for (auto &t : threads)
+      {
+        t.join();
+      }
     }
-    ioc.run();
-    for (auto &t : threads)
+    else
     {
-      t.join();
+      boost::asio::io_context ioc{numThreads};
+      webservice::Listener listener{ioc, endpoint, options};
+      listener.start();
+      std::vector<std::thread> threads;
+      threads.reserve(size_t(numThreads));
+      for (auto i = 0; i < numThreads; ++i)
+      {
+        threads.emplace_back(
+        [&ioc]
+        {
+          ioc.run();
+        });
+      }
+      if (verbosity.level > 0)
+      {
+        std::cout << numThreads << " threads"
+                  << " listening on " << uri.host() << ':' << uri.port() << " ..."
+                  << std::endl;
+      }
+      ioc.run();
+      for (auto &t : threads)
+      {
+        t.join();
+      }
     }
   }
   catch (const std::exception &e)
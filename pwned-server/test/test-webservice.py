@@ -9,7 +9,7 @@ from time import sleep
 def uint64_to_string(x):
   return '{:0>16}'.format(hex(unpack('<Q', x)[0]).lstrip('0x'))
 
-def run_test():
+def run_test(options=[]):
   N = 10000
   testsetFilename = '../../../../pwned-lib/test/testset-{}-existent-collection1+2+3+4+5.md5'.format(N)
   webservice = subprocess.Popen([
@@ -17,7 +17,7 @@ def run_test():
     '-I', testsetFilename,
     '-W', '16',
     '-T', '2'
-  ])
+  ] + options)
   sleep(1)
   rc = 0
   with open(testsetFilename, 'rb') as f:
@@ -62,10 +62,75 @@ def run_test():
     if found != N:
       rc = 1
 
+  if rc == 0:
+    rc = run_batch_test(testsetFilename)
+  if rc == 0:
+    rc = run_metrics_test(N)
+
   webservice.kill()
   webservice.wait()
   return rc
 
+def run_batch_test(testsetFilename):
+  hashes = []
+  counts = []
+  with open(testsetFilename, 'rb') as f:
+    while True:
+      upper = f.read(8)
+      if not upper:
+        break
+      lower = f.read(8)
+      hashes.append(uint64_to_string(upper) + uint64_to_string(lower))
+      count, = unpack('<i', f.read(4))
+      counts.append(count)
+  hashes.reverse()
+  counts.reverse()
+  request = urllib.request.Request(
+    'http://localhost:31337/v1/pwned/api/lookup',
+    data=json.dumps(hashes).encode('utf-8'),
+    headers={'Content-Type': 'application/json'})
+  try:
+    url_ctx = urllib.request.urlopen(request)
+  except urllib.error.URLError as err:
+    print(err)
+    return 1
+  data = json.loads(url_ctx.read().decode('utf-8'))
+  url_ctx.close()
+  if not isinstance(data, dict) or data.get('found') != counts:
+    print('Batch lookup returned wrong counts')
+    return 1
+  return 0
+
+def run_metrics_test(N):
+  try:
+    url_ctx = urllib.request.urlopen('http://localhost:31337/v1/pwned/api/metrics')
+  except urllib.error.URLError as err:
+    print(err)
+    return 1
+  metrics = {}
+  for line in url_ctx.read().decode('utf-8').splitlines():
+    if line and not line.startswith('#'):
+      name, value = line.rsplit(' ', 1)
+      metrics[name] = float(value)
+  url_ctx.close()
+  expected = {
+    'pwned_requests_total{endpoint="lookup",status="200"}': N,
+    'pwned_requests_total{endpoint="batch-lookup",status="200"}': 1,
+    'pwned_lookup_duration_seconds_count{kind="single"}': N,
+    'pwned_lookup_duration_seconds_bucket{kind="single",le="+Inf"}': N,
+    'pwned_lookup_hashes_total': 2 * N,
+  }
+  for name, value in expected.items():
+    if metrics.get(name) != value:
+      print('Metric {} is {} (should be {})'.format(name, metrics.get(name), value))
+      return 1
+  if metrics.get('pwned_lookup_reads_total', 0) < N:
+    print('Too few reads counted')
+    return 1
+  return 0
+
 if __name__ == '__main__':
   rc = run_test()
+  if rc == 0:
+    rc = run_test(['--thread-per-core'])
   exit(rc)